@@ -0,0 +1,74 @@
+#include "allocationCounter.hpp"
+
+#ifdef KACZKA_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+static atomic<size_t> gAllocationCount(0);
+
+static void *countedAllocate(size_t size) {
+  gAllocationCount.fetch_add(1, memory_order_relaxed);
+  auto memory = malloc(size == 0 ? 1 : size);
+  if (memory == nullptr) {
+    throw bad_alloc();
+  }
+  return memory;
+}
+
+void *operator new(size_t size) {
+  return countedAllocate(size);
+}
+
+void *operator new[](size_t size) {
+  return countedAllocate(size);
+}
+
+void *operator new(size_t size, const nothrow_t&) noexcept {
+  gAllocationCount.fetch_add(1, memory_order_relaxed);
+  return malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](size_t size, const nothrow_t&) noexcept {
+  gAllocationCount.fetch_add(1, memory_order_relaxed);
+  return malloc(size == 0 ? 1 : size);
+}
+
+void operator delete(void *memory) noexcept {
+  free(memory);
+}
+
+void operator delete[](void *memory) noexcept {
+  free(memory);
+}
+
+void operator delete(void *memory, const nothrow_t&) noexcept {
+  free(memory);
+}
+
+void operator delete[](void *memory, const nothrow_t&) noexcept {
+  free(memory);
+}
+
+size_t getAllocationCount() {
+  return gAllocationCount.load(memory_order_relaxed);
+}
+
+bool isCountingAllocations() {
+  return true;
+}
+
+#else
+
+std::size_t getAllocationCount() {
+  return 0;
+}
+
+bool isCountingAllocations() {
+  return false;
+}
+
+#endif
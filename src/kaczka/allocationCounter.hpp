@@ -0,0 +1,12 @@
+#ifndef __ALLOCATION_COUNTER_HPP__
+#define __ALLOCATION_COUNTER_HPP__
+
+#include <cstddef>
+
+// Number of calls to the global operator new so far, from all threads.
+// Counting replaces operator new and is only built in with
+// KACZKA_COUNT_ALLOCATIONS; otherwise this always returns zero.
+std::size_t getAllocationCount();
+bool isCountingAllocations();
+
+#endif
@@ -0,0 +1,42 @@
+#include "allocators.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+static uintptr_t alignAddress(uintptr_t address, size_t alignment) {
+  return (address + alignment - 1) & ~(uintptr_t)(alignment - 1);
+}
+
+LinearArena::LinearArena(size_t capacity) :
+  _block(capacity), _offset(0), _overflowSize(0), _peak(0) {
+}
+
+LinearArena::~LinearArena() {
+}
+
+void *LinearArena::allocate(size_t size, size_t alignment) {
+  auto base = (uintptr_t)_block.data();
+  auto first = alignAddress(base + _offset, alignment) - base;
+  if (first + size <= _block.size()) {
+    _offset = first + size;
+    _peak = max(_peak, _offset + _overflowSize);
+    return _block.data() + first;
+  }
+
+  unique_ptr<unsigned char[]> overflow(new unsigned char[size + alignment]);
+  auto address = alignAddress((uintptr_t)overflow.get(), alignment);
+  _overflowBlocks.push_back(move(overflow));
+  _overflowSize += size + alignment;
+  _peak = max(_peak, _offset + _overflowSize);
+  return (void*)address;
+}
+
+void LinearArena::reset() {
+  if (!_overflowBlocks.empty()) {
+    _overflowBlocks.clear();
+    _block.resize(_peak);
+  }
+  _offset = 0;
+  _overflowSize = 0;
+}
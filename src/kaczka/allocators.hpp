@@ -0,0 +1,92 @@
+#ifndef __ALLOCATORS_HPP__
+#define __ALLOCATORS_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Bump allocator for memory that lives until the next reset, like the
+// scratch arrays of a single frame. Requests that do not fit go to
+// overflow blocks; reset frees them and grows the arena to the peak usage,
+// so a steady workload stops touching the heap after its first frames.
+class LinearArena {
+public:
+  explicit LinearArena(std::size_t capacity = 0);
+  ~LinearArena();
+
+  void *allocate(std::size_t size, std::size_t alignment);
+  template <typename T>
+  T *allocate(std::size_t count) {
+    return (T*)allocate(count * sizeof(T), alignof(T));
+  }
+  void reset();
+
+  inline std::size_t getCapacity() const { return _block.size(); }
+  inline std::size_t getPeak() const { return _peak; }
+
+private:
+  std::vector<unsigned char> _block;
+  std::size_t _offset;
+  std::size_t _overflowSize;
+  std::size_t _peak;
+  std::vector<std::unique_ptr<unsigned char[]>> _overflowBlocks;
+};
+
+// Slots for long-lived objects of one type that need stable addresses.
+// Slots are carved out of chunks of ChunkSize and freed ones are reused
+// before a new chunk is taken. Objects still alive when the pool goes away
+// are not destroyed.
+template <typename T, int ChunkSize = 16>
+class PoolAllocator {
+public:
+  PoolAllocator() : _free(nullptr) {}
+
+  template <typename... Args>
+  T *create(Args&&... args) {
+    if (_free == nullptr) {
+      addChunk();
+    }
+    auto slot = _free;
+    _free = slot->next;
+    return new (slot->storage) T(std::forward<Args>(args)...);
+  }
+
+  void destroy(T *object) {
+    if (object == nullptr) {
+      return;
+    }
+    object->~T();
+    auto slot = (Slot*)object;
+    slot->next = _free;
+    _free = slot;
+  }
+
+private:
+  union Slot {
+    Slot *next;
+    alignas(T) unsigned char storage[sizeof(T)];
+  };
+
+  // Chunks are aligned by hand, new[] does not honor alignments above the
+  // fundamental one.
+  void addChunk() {
+    std::unique_ptr<unsigned char[]> chunk(
+        new unsigned char[ChunkSize * sizeof(Slot) + alignof(Slot)]);
+    auto address = (std::uintptr_t)chunk.get();
+    auto slots = (Slot*)((address + alignof(Slot) - 1)
+        & ~(std::uintptr_t)(alignof(Slot) - 1));
+    for (auto i = ChunkSize - 1; i >= 0; --i) {
+      slots[i].next = _free;
+      _free = &slots[i];
+    }
+    _chunks.push_back(std::move(chunk));
+  }
+
+  std::vector<std::unique_ptr<unsigned char[]>> _chunks;
+  Slot *_free;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include "heightCapture.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+// Lists the records of a height capture with statistics of their heights,
+// or exports a range of them as raw little endian float32 images.
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 5) {
+    cerr << "usage: " << argv[0] << " <capture>" << endl
+      << "       " << argv[0] << " <capture> <first> <last> <prefix>" << endl
+      << "Lists the records, or writes records first to last as" << endl
+      << "<prefix><step>.raw, width x height float32 each." << endl;
+    return 1;
+  }
+
+  HeightCaptureReader reader;
+  if (!reader.open(argv[1])) {
+    return 1;
+  }
+
+  const auto &header = reader.getHeader();
+  const char *precisions[] = { "float32", "float16", "fixed16" };
+  cout << "# " << header.width << "x" << header.height << " "
+    << precisions[(int)header.precision] << ", every "
+    << header.interval << " steps" << endl;
+
+  auto exporting = argc == 5;
+  auto first = exporting ? atoi(argv[2]) : 0;
+  auto last = exporting ? atoi(argv[3]) : -1;
+  if (first > 0 && !reader.seekFrame(first)) {
+    cerr << "capture has no record " << first << endl;
+    return 1;
+  }
+
+  auto rawBytes = (double)header.width * header.height
+    * (header.precision == HeightFieldPrecision::Float32 ? 4 : 2);
+  cout << "record,step,bytes,ratio,min,max,rms" << endl;
+
+  vector<float> heights;
+  int step;
+  for (auto index = first; last < 0 || index <= last; ++index) {
+    if (!reader.readFrame(step, heights)) {
+      break;
+    }
+
+    auto minimum = heights[0], maximum = heights[0];
+    auto sumSquares = 0.0;
+    for (auto height : heights) {
+      minimum = min(minimum, height);
+      maximum = max(maximum, height);
+      sumSquares += (double)height * height;
+    }
+    cout << index << "," << step << "," << reader.getLastFrameSize() << ","
+      << rawBytes / max((size_t)1, reader.getLastFrameSize()) << ","
+      << minimum << "," << maximum << ","
+      << sqrt(sumSquares / heights.size()) << endl;
+
+    if (exporting) {
+      ostringstream path;
+      path << argv[4] << step << ".raw";
+      ofstream file(path.str(), ios::binary | ios::trunc);
+      file.write((const char*)&heights[0], heights.size() * sizeof(float));
+      if (!file) {
+        cerr << "cannot write " << path.str() << endl;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include "checkpoint.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_MMAP
+#endif
+
+using namespace std;
+
+namespace {
+
+const uint32_t cCheckpointMagic = 0x504b434b;
+const uint32_t cCheckpointVersion = 1;
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t numSections;
+  uint32_t reserved;
+};
+
+struct SectionEntry {
+  uint32_t tag;
+  int32_t index;
+  uint64_t offset;
+  uint64_t size;
+};
+
+size_t alignOffset(size_t offset) {
+  return (offset + cCheckpointAlignment - 1) & ~(cCheckpointAlignment - 1);
+}
+
+} // namespace
+
+void CheckpointWriter::add(uint32_t tag, int index, const void *data,
+    size_t size) {
+  auto offset = alignOffset(_data.size());
+  _data.resize(offset + size);
+  if (size > 0) {
+    memcpy(&_data[offset], data, size);
+  }
+  _sections.push_back({tag, index, offset, size});
+}
+
+bool CheckpointWriter::save(const string &path) {
+  // Written next to the target and renamed over it, so a crash while
+  // saving leaves the previous checkpoint intact.
+  auto temporaryPath = path + ".tmp";
+  ofstream file(temporaryPath, ios::binary | ios::trunc);
+  if (!file) {
+    cerr << "cannot write checkpoint " << temporaryPath << endl;
+    return false;
+  }
+
+  FileHeader header = {
+    cCheckpointMagic, cCheckpointVersion, (uint32_t)_sections.size(), 0
+  };
+  auto tableSize = sizeof(header) + _sections.size() * sizeof(SectionEntry);
+  auto dataStart = alignOffset(tableSize);
+  vector<SectionEntry> entries;
+  for (const auto &section : _sections) {
+    entries.push_back({section.tag, section.index,
+        dataStart + section.offset, section.size});
+  }
+
+  const char padding[cCheckpointAlignment] = {};
+  file.write((const char*)&header, sizeof(header));
+  if (!entries.empty()) {
+    file.write((const char*)&entries[0],
+        entries.size() * sizeof(SectionEntry));
+  }
+  file.write(padding, dataStart - tableSize);
+  if (!_data.empty()) {
+    file.write((const char*)&_data[0], _data.size());
+  }
+  file.close();
+  if (!file) {
+    cerr << "cannot write checkpoint " << temporaryPath << endl;
+    return false;
+  }
+
+  if (rename(temporaryPath.c_str(), path.c_str()) != 0) {
+    cerr << "cannot replace checkpoint " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+Checkpoint::Checkpoint() : _data(nullptr), _size(0), _mapped(false) {
+}
+
+Checkpoint::~Checkpoint() {
+  close();
+}
+
+bool Checkpoint::open(const string &path) {
+  close();
+
+#ifdef USE_MMAP
+  auto descriptor = ::open(path.c_str(), O_RDONLY);
+  if (descriptor < 0) {
+    return false;
+  }
+  struct stat status;
+  if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+    auto mapping = mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE,
+        descriptor, 0);
+    if (mapping != MAP_FAILED) {
+      _data = (const unsigned char*)mapping;
+      _size = status.st_size;
+      _mapped = true;
+    }
+  }
+  ::close(descriptor);
+#else
+  ifstream file(path, ios::binary | ios::ate);
+  if (file) {
+    _contents.resize((size_t)file.tellg());
+    file.seekg(0);
+    if (!_contents.empty() && file.read((char*)&_contents[0],
+          _contents.size())) {
+      _data = &_contents[0];
+      _size = _contents.size();
+    }
+  }
+#endif
+  if (!_data) {
+    return false;
+  }
+
+  // Every section is checked against the file size here, so find can hand
+  // out pointers without further checks.
+  FileHeader header;
+  auto valid = _size >= sizeof(header);
+  if (valid) {
+    memcpy(&header, _data, sizeof(header));
+    valid = header.magic == cCheckpointMagic
+      && header.version == cCheckpointVersion
+      && header.numSections <= (_size - sizeof(header)) / sizeof(SectionEntry);
+  }
+  auto entries = (const SectionEntry*)(_data + sizeof(header));
+  for (uint32_t i = 0; valid && i < header.numSections; ++i) {
+    valid = entries[i].offset % cCheckpointAlignment == 0
+      && entries[i].offset <= _size
+      && entries[i].size <= _size - entries[i].offset;
+  }
+  if (!valid) {
+    cerr << path << " is not a checkpoint" << endl;
+    close();
+    return false;
+  }
+  return true;
+}
+
+void Checkpoint::close() {
+#ifdef USE_MMAP
+  if (_mapped) {
+    munmap((void*)_data, _size);
+  }
+#endif
+  _data = nullptr;
+  _size = 0;
+  _mapped = false;
+  _contents.clear();
+}
+
+const void *Checkpoint::find(uint32_t tag, int index, size_t &size) const {
+  if (!_data) {
+    return nullptr;
+  }
+
+  FileHeader header;
+  memcpy(&header, _data, sizeof(header));
+  auto entries = (const SectionEntry*)(_data + sizeof(header));
+  for (uint32_t i = 0; i < header.numSections; ++i) {
+    if (entries[i].tag == tag && entries[i].index == index) {
+      size = entries[i].size;
+      return _data + entries[i].offset;
+    }
+  }
+  return nullptr;
+}
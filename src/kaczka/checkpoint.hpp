@@ -0,0 +1,93 @@
+#ifndef __CHECKPOINT_HPP__
+#define __CHECKPOINT_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Checkpoint files are a header, a table of sections and the section data.
+// Sections are named by a tag and an index, for objects with several
+// instances, and start on cCheckpointAlignment byte boundaries, so a
+// mapped file is read in place without copies or parsing.
+const std::size_t cCheckpointAlignment = 64;
+
+inline std::uint32_t makeCheckpointTag(char a, char b, char c, char d) {
+  return (std::uint32_t)(unsigned char)a
+    | (std::uint32_t)(unsigned char)b << 8
+    | (std::uint32_t)(unsigned char)c << 16
+    | (std::uint32_t)(unsigned char)d << 24;
+}
+
+// Sections are copied when added, so the state can move on before save.
+class CheckpointWriter {
+public:
+  void add(std::uint32_t tag, int index, const void *data, std::size_t size);
+
+  template <typename T>
+  void add(std::uint32_t tag, int index, const std::vector<T> &values) {
+    add(tag, index, values.empty() ? nullptr : &values[0],
+        values.size() * sizeof(T));
+  }
+
+  bool save(const std::string &path);
+
+private:
+  struct Section {
+    std::uint32_t tag;
+    int index;
+    std::size_t offset;
+    std::size_t size;
+  };
+
+  std::vector<Section> _sections;
+  // Section data at aligned offsets from the start of the data area.
+  std::vector<unsigned char> _data;
+};
+
+// Maps the whole file read only where the platform can, otherwise reads it.
+class Checkpoint {
+public:
+  Checkpoint();
+  ~Checkpoint();
+
+  bool open(const std::string &path);
+  void close();
+
+  // Null when the checkpoint has no such section.
+  const void *find(std::uint32_t tag, int index, std::size_t &size) const;
+
+  // Plain structures must match the section size exactly.
+  template <typename T>
+  bool read(std::uint32_t tag, int index, T &value) const {
+    std::size_t size;
+    auto data = find(tag, index, size);
+    if (!data || size != sizeof(T)) {
+      return false;
+    }
+    value = *(const T*)data;
+    return true;
+  }
+
+  template <typename T>
+  bool read(std::uint32_t tag, int index, std::vector<T> &values) const {
+    std::size_t size;
+    auto data = find(tag, index, size);
+    if (!data || size % sizeof(T) != 0) {
+      return false;
+    }
+    values.assign((const T*)data, (const T*)data + size / sizeof(T));
+    return true;
+  }
+
+private:
+  Checkpoint(const Checkpoint &) = delete;
+  Checkpoint &operator=(const Checkpoint &) = delete;
+
+  const unsigned char *_data;
+  std::size_t _size;
+  bool _mapped;
+  std::vector<unsigned char> _contents;
+};
+
+#endif
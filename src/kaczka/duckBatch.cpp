@@ -0,0 +1,64 @@
+#include "duckBatch.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+// Critically damped spring, so ducks settle on a swell without bouncing.
+static const float cBuoyancyStiffness = 60.0f;
+
+// Longer frames are split, the explicit spring is only stable for short
+// ones.
+static const float cMaxBuoyancyStep = 1.0f / 60.0f;
+
+DuckBatch::DuckBatch() : hullRadius(0.0f) {
+}
+
+void DuckBatch::resize(int count) {
+  x.resize(count, 0.0f);
+  z.resize(count, 0.0f);
+  headingX.resize(count, 1.0f);
+  headingZ.resize(count, 0.0f);
+  y.resize(count, 0.0f);
+  verticalVelocity.resize(count, 0.0f);
+  waterHeight.resize(count, 0.0f);
+  slopeX.resize(count, 0.0f);
+  slopeZ.resize(count, 0.0f);
+}
+
+void updateDuckBuoyancy(DuckBatch &ducks, float deltaTime) {
+  auto damping = 2.0f * sqrtf(cBuoyancyStiffness);
+  auto count = ducks.size();
+  while (deltaTime > 0.0f) {
+    auto dt = min(deltaTime, cMaxBuoyancyStep);
+    for (auto i = 0; i < count; ++i) {
+      auto acceleration =
+        cBuoyancyStiffness * (ducks.waterHeight[i] - ducks.y[i])
+        - damping * ducks.verticalVelocity[i];
+      ducks.verticalVelocity[i] += acceleration * dt;
+      ducks.y[i] += ducks.verticalVelocity[i] * dt;
+    }
+    deltaTime -= dt;
+  }
+}
+
+void buildDuckTransforms(const DuckBatch &ducks, float scale,
+    TransformBatch &transforms) {
+  auto count = ducks.size();
+  for (auto i = 0; i < count; ++i) {
+    auto invLength = 1.0f / sqrtf(
+        ducks.slopeX[i] * ducks.slopeX[i] + 1.0f
+        + ducks.slopeZ[i] * ducks.slopeZ[i]);
+    transforms.x[i] = ducks.x[i];
+    transforms.y[i] = ducks.y[i];
+    transforms.z[i] = ducks.z[i];
+    transforms.upX[i] = -ducks.slopeX[i] * invLength;
+    transforms.upY[i] = invLength;
+    transforms.upZ[i] = -ducks.slopeZ[i] * invLength;
+    transforms.headingX[i] = ducks.headingX[i];
+    transforms.headingZ[i] = ducks.headingZ[i];
+    transforms.scale[i] = scale;
+  }
+  buildTransforms(transforms);
+}
@@ -0,0 +1,36 @@
+#ifndef __DUCK_BATCH_HPP__
+#define __DUCK_BATCH_HPP__
+
+#include <vector>
+
+#include "transformBatch.hpp"
+
+// Floating ducks kept as one array per attribute, so the coupling passes
+// over the water stream through them. Positions and headings are set by
+// the caller, headings as the unit direction in the xz plane that the
+// mesh x axis is turned onto; water heights and slopes under each hull are
+// filled in by WaterSurface::sampleDucks.
+struct DuckBatch {
+  std::vector<float> x, z, headingX, headingZ;
+  std::vector<float> y, verticalVelocity;
+  std::vector<float> waterHeight, slopeX, slopeZ;
+
+  // Footprint radius of every hull, in world units.
+  float hullRadius;
+
+  DuckBatch();
+
+  void resize(int count);
+  inline int size() const { return (int)x.size(); }
+};
+
+// Pulls every duck towards the water height under it.
+void updateDuckBuoyancy(DuckBatch &ducks, float deltaTime);
+
+// Places every duck on the water, pitched and rolled to the slope under
+// its hull and turned by its heading. The transforms must have been
+// resized to the batch.
+void buildDuckTransforms(const DuckBatch &ducks, float scale,
+    TransformBatch &transforms);
+
+#endif
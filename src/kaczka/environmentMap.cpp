@@ -0,0 +1,417 @@
+#include "environmentMap.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <SOIL/SOIL.h>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+namespace {
+
+const uint32_t cCacheMagic = 0x4d43504b;
+const uint32_t cCacheVersion = 1;
+const int cPrefilterSamples = 64;
+const float cPi = 3.14159265358979f;
+
+// The faces are stored with gamma, lobes are integrated over linear
+// radiance.
+const float cGamma = 2.2f;
+
+struct SourceLevel {
+  int size;
+  vector<glm::vec3> texels;
+};
+
+struct LobeSample {
+  glm::vec3 direction;
+  float weight;
+  float lod;
+};
+
+// Directions of texel centers and back, following the face selection of
+// the GL specification.
+glm::vec3 getFaceDirection(int face, float s, float t) {
+  auto sc = 2.0f * s - 1.0f;
+  auto tc = 2.0f * t - 1.0f;
+  switch (face) {
+    case 0: return glm::vec3(1.0f, -tc, -sc);
+    case 1: return glm::vec3(-1.0f, -tc, sc);
+    case 2: return glm::vec3(sc, 1.0f, tc);
+    case 3: return glm::vec3(sc, -1.0f, -tc);
+    case 4: return glm::vec3(sc, -tc, 1.0f);
+    default: return glm::vec3(-sc, -tc, -1.0f);
+  }
+}
+
+void getFaceCoordinates(const glm::vec3 &direction, int &face,
+    float &s, float &t) {
+  auto ax = fabsf(direction.x);
+  auto ay = fabsf(direction.y);
+  auto az = fabsf(direction.z);
+  float sc, tc, major;
+  if (ax >= ay && ax >= az) {
+    major = ax;
+    face = direction.x > 0.0f ? 0 : 1;
+    sc = direction.x > 0.0f ? -direction.z : direction.z;
+    tc = -direction.y;
+  } else if (ay >= az) {
+    major = ay;
+    face = direction.y > 0.0f ? 2 : 3;
+    sc = direction.x;
+    tc = direction.y > 0.0f ? direction.z : -direction.z;
+  } else {
+    major = az;
+    face = direction.z > 0.0f ? 4 : 5;
+    sc = direction.z > 0.0f ? direction.x : -direction.x;
+    tc = -direction.y;
+  }
+  s = 0.5f * (sc / major + 1.0f);
+  t = 0.5f * (tc / major + 1.0f);
+}
+
+// Bilinear within a face, clamped at its edges.
+glm::vec3 sampleLevel(const SourceLevel &level, int face, float s, float t) {
+  auto size = level.size;
+  auto x = s * size - 0.5f;
+  auto y = t * size - 0.5f;
+  auto x0 = (int)floorf(x);
+  auto y0 = (int)floorf(y);
+  auto fx = x - x0;
+  auto fy = y - y0;
+  auto x1 = min(max(x0 + 1, 0), size - 1);
+  auto y1 = min(max(y0 + 1, 0), size - 1);
+  x0 = min(max(x0, 0), size - 1);
+  y0 = min(max(y0, 0), size - 1);
+
+  auto texels = &level.texels[(size_t)face * size * size];
+  auto top = glm::mix(texels[y0 * size + x0], texels[y0 * size + x1], fx);
+  auto bottom = glm::mix(texels[y1 * size + x0], texels[y1 * size + x1], fx);
+  return glm::mix(top, bottom, fy);
+}
+
+glm::vec3 sampleLevels(const vector<SourceLevel> &levels,
+    const glm::vec3 &direction, float lod) {
+  int face;
+  float s, t;
+  getFaceCoordinates(direction, face, s, t);
+
+  auto lower = min((int)lod, (int)levels.size() - 1);
+  auto upper = min(lower + 1, (int)levels.size() - 1);
+  auto color = sampleLevel(levels[lower], face, s, t);
+  if (upper == lower) {
+    return color;
+  }
+  return glm::mix(color, sampleLevel(levels[upper], face, s, t),
+      lod - lower);
+}
+
+void buildSourceLevels(const vector<const unsigned char*> &faces,
+    int faceSize, vector<SourceLevel> &levels) {
+  float toLinear[256];
+  for (auto i = 0; i < 256; ++i) {
+    toLinear[i] = powf(i / 255.0f, cGamma);
+  }
+
+  levels.resize(1);
+  levels[0].size = faceSize;
+  levels[0].texels.resize((size_t)6 * faceSize * faceSize);
+  for (auto face = 0; face < 6; ++face) {
+    auto source = faces[face];
+    auto target = &levels[0].texels[(size_t)face * faceSize * faceSize];
+    for (auto i = 0; i < faceSize * faceSize; ++i) {
+      target[i] = glm::vec3(toLinear[source[3 * i]],
+          toLinear[source[3 * i + 1]], toLinear[source[3 * i + 2]]);
+    }
+  }
+
+  while (levels.back().size > 1) {
+    SourceLevel level;
+    auto &finer = levels.back();
+    level.size = finer.size / 2;
+    level.texels.resize((size_t)6 * level.size * level.size);
+    for (auto face = 0; face < 6; ++face) {
+      auto source = &finer.texels[(size_t)face * finer.size * finer.size];
+      auto target = &level.texels[(size_t)face * level.size * level.size];
+      for (auto y = 0; y < level.size; ++y) {
+        auto row0 = source + 2 * y * finer.size;
+        auto row1 = source + min(2 * y + 1, finer.size - 1) * finer.size;
+        for (auto x = 0; x < level.size; ++x) {
+          auto x1 = min(2 * x + 1, finer.size - 1);
+          target[y * level.size + x] = 0.25f * (row0[2 * x] + row0[x1]
+              + row1[2 * x] + row1[x1]);
+        }
+      }
+    }
+    levels.push_back(move(level));
+  }
+}
+
+float radicalInverse(uint32_t bits) {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return bits * 2.3283064365386963e-10f;
+}
+
+// With the view along the normal every texel sees the same lobe, so the
+// GGX samples are generated once per level around +z. Each one reads the
+// source level whose texels cover about the solid angle of the sample,
+// which keeps narrow and wide lobes alike free of aliasing.
+void buildLobeSamples(float roughness, int sampleCount, int faceSize,
+    int numSourceLevels, vector<LobeSample> &samples) {
+  auto alpha = roughness * roughness;
+  auto alpha2 = alpha * alpha;
+  auto texelSolidAngle = 4.0f * cPi / (6.0f * faceSize * faceSize);
+
+  samples.clear();
+  for (auto i = 0; i < sampleCount; ++i) {
+    auto u = (i + 0.5f) / sampleCount;
+    auto v = radicalInverse(i);
+    auto phi = 2.0f * cPi * u;
+    auto cosTheta = sqrtf((1.0f - v) / (1.0f + (alpha2 - 1.0f) * v));
+    auto sinTheta = sqrtf(max(0.0f, 1.0f - cosTheta * cosTheta));
+
+    auto halfVector = glm::vec3(sinTheta * cosf(phi), sinTheta * sinf(phi),
+        cosTheta);
+    auto direction = 2.0f * cosTheta * halfVector - glm::vec3(0, 0, 1);
+    if (direction.z <= 0.0f) {
+      continue;
+    }
+
+    auto d = cosTheta * cosTheta * (alpha2 - 1.0f) + 1.0f;
+    auto distribution = alpha2 / (cPi * d * d);
+    auto sampleSolidAngle = 4.0f / (sampleCount * distribution);
+    auto lod = 0.5f * log2f(sampleSolidAngle / texelSolidAngle) + 1.0f;
+
+    LobeSample sample;
+    sample.direction = direction;
+    sample.weight = direction.z;
+    sample.lod = min(max(lod, 0.0f), (float)(numSourceLevels - 1));
+    samples.push_back(sample);
+  }
+}
+
+uint64_t hashBytes(uint64_t hash, const void *data, size_t size) {
+  auto bytes = (const unsigned char*)data;
+  for (size_t i = 0; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+  }
+  return hash;
+}
+
+}
+
+PrefilteredCubemap::PrefilteredCubemap() :
+  faceSize(0), numLevels(0), sourceHash(0) {
+}
+
+size_t PrefilteredCubemap::getLevelOffset(int level, int face) const {
+  size_t offset = 0;
+  for (auto l = 0; l < level; ++l) {
+    offset += (size_t)6 * 3 * getLevelSize(l) * getLevelSize(l);
+  }
+  return offset + (size_t)face * 3 * getLevelSize(level) * getLevelSize(level);
+}
+
+void prefilterCubemap(const vector<const unsigned char*> &faces,
+    int faceSize, int sampleCount, PrefilteredCubemap &result) {
+  result.faceSize = faceSize;
+  result.numLevels = 1;
+  while (result.getLevelSize(result.numLevels - 1) > 1) {
+    ++result.numLevels;
+  }
+  result.texels.resize(result.getLevelOffset(result.numLevels, 0));
+
+  // The mirror level is the source itself.
+  for (auto face = 0; face < 6; ++face) {
+    copy(faces[face], faces[face] + 3 * faceSize * faceSize,
+        &result.texels[result.getLevelOffset(0, face)]);
+  }
+
+  vector<SourceLevel> sourceLevels;
+  buildSourceLevels(faces, faceSize, sourceLevels);
+
+  vector<LobeSample> samples;
+  for (auto level = 1; level < result.numLevels; ++level) {
+    auto roughness = (float)level / (result.numLevels - 1);
+    buildLobeSamples(roughness, sampleCount, faceSize,
+        (int)sourceLevels.size(), samples);
+
+    auto size = result.getLevelSize(level);
+    auto levelTexels = &result.texels[result.getLevelOffset(level, 0)];
+    parallelFor(0, 6 * size, [&](int firstRow, int lastRow) {
+      for (auto row = firstRow; row < lastRow; ++row) {
+        auto face = row / size;
+        auto y = row % size;
+        auto target = levelTexels + 3 * (size_t)row * size;
+        for (auto x = 0; x < size; ++x) {
+          auto normal = glm::normalize(getFaceDirection(face,
+                (x + 0.5f) / size, (y + 0.5f) / size));
+          auto up = fabsf(normal.y) < 0.999f
+            ? glm::vec3(0, 1, 0) : glm::vec3(1, 0, 0);
+          auto tangentX = glm::normalize(glm::cross(up, normal));
+          auto tangentY = glm::cross(normal, tangentX);
+
+          auto color = glm::vec3(0.0f);
+          auto totalWeight = 0.0f;
+          for (auto &sample : samples) {
+            auto direction = sample.direction.x * tangentX
+              + sample.direction.y * tangentY + sample.direction.z * normal;
+            color += sample.weight
+              * sampleLevels(sourceLevels, direction, sample.lod);
+            totalWeight += sample.weight;
+          }
+          color /= max(totalWeight, 1e-6f);
+
+          for (auto c = 0; c < 3; ++c) {
+            auto value = powf(min(max(color[c], 0.0f), 1.0f), 1.0f / cGamma);
+            target[3 * x + c] = (unsigned char)(255.0f * value + 0.5f);
+          }
+        }
+      }
+    });
+  }
+}
+
+bool loadPrefilteredCubemapCache(const string &path, uint64_t sourceHash,
+    PrefilteredCubemap &result) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  uint32_t magic = 0, version = 0;
+  uint64_t hash = 0;
+  int32_t faceSize = 0, numLevels = 0;
+  file.read((char*)&magic, sizeof(magic));
+  file.read((char*)&version, sizeof(version));
+  file.read((char*)&hash, sizeof(hash));
+  file.read((char*)&faceSize, sizeof(faceSize));
+  file.read((char*)&numLevels, sizeof(numLevels));
+  if (!file || magic != cCacheMagic || version != cCacheVersion
+      || hash != sourceHash || faceSize <= 0 || numLevels <= 0) {
+    return false;
+  }
+
+  PrefilteredCubemap cubemap;
+  cubemap.faceSize = faceSize;
+  cubemap.numLevels = numLevels;
+  cubemap.sourceHash = hash;
+  cubemap.texels.resize(cubemap.getLevelOffset(numLevels, 0));
+  file.read((char*)&cubemap.texels[0], cubemap.texels.size());
+  if (!file) {
+    cerr << "truncated prefiltered cubemap cache " << path << endl;
+    return false;
+  }
+
+  result = move(cubemap);
+  return true;
+}
+
+bool savePrefilteredCubemapCache(const string &path,
+    const PrefilteredCubemap &cubemap) {
+  ofstream file(path, ios::binary | ios::trunc);
+  if (!file) {
+    cerr << "cannot write prefiltered cubemap cache " << path << endl;
+    return false;
+  }
+
+  int32_t faceSize = cubemap.faceSize, numLevels = cubemap.numLevels;
+  file.write((const char*)&cCacheMagic, sizeof(cCacheMagic));
+  file.write((const char*)&cCacheVersion, sizeof(cCacheVersion));
+  file.write((const char*)&cubemap.sourceHash, sizeof(cubemap.sourceHash));
+  file.write((const char*)&faceSize, sizeof(faceSize));
+  file.write((const char*)&numLevels, sizeof(numLevels));
+  file.write((const char*)&cubemap.texels[0], cubemap.texels.size());
+  return (bool)file;
+}
+
+GLTexture createPrefilteredCubemap(const vector<string> &faces,
+    const string &cachePath, int &numLevels) {
+  numLevels = 0;
+  if (faces.size() != 6) {
+    cerr << "cubemap needs 6 faces, got " << faces.size() << endl;
+    return GLTexture();
+  }
+
+  vector<unsigned char*> images(6, nullptr);
+  int faceSize = 0;
+  auto loaded = true;
+  for (auto i = 0; i < 6 && loaded; ++i) {
+    int width, height;
+    images[i] = SOIL_load_image(faces[i].c_str(), &width, &height, 0,
+        SOIL_LOAD_RGB);
+    if (!images[i]) {
+      cerr << "cannot load image " << faces[i] << " reason: "
+        << SOIL_last_result() << endl;
+      loaded = false;
+    } else if (width != height || (i > 0 && width != faceSize)) {
+      cerr << "cubemap face " << faces[i] << " is " << width << "x"
+        << height << ", faces must be squares of one size" << endl;
+      loaded = false;
+    }
+    faceSize = width;
+  }
+
+  PrefilteredCubemap cubemap;
+  if (loaded) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    hash = hashBytes(hash, &cCacheVersion, sizeof(cCacheVersion));
+    hash = hashBytes(hash, &cPrefilterSamples, sizeof(cPrefilterSamples));
+    hash = hashBytes(hash, &faceSize, sizeof(faceSize));
+    for (auto image : images) {
+      hash = hashBytes(hash, image, (size_t)3 * faceSize * faceSize);
+    }
+
+    if (!loadPrefilteredCubemapCache(cachePath, hash, cubemap)) {
+      vector<const unsigned char*> faceTexels(images.begin(), images.end());
+      prefilterCubemap(faceTexels, faceSize, cPrefilterSamples, cubemap);
+      cubemap.sourceHash = hash;
+      savePrefilteredCubemapCache(cachePath, cubemap);
+    }
+  }
+
+  for (auto image : images) {
+    if (image) {
+      SOIL_free_image_data(image);
+    }
+  }
+  if (!loaded) {
+    return GLTexture();
+  }
+
+  auto texture = GLTexture::create();
+  glBindTexture(GL_TEXTURE_CUBE_MAP, texture.get());
+
+  // Rows of the small levels are not multiples of 4 bytes.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (auto level = 0; level < cubemap.numLevels; ++level) {
+    auto size = cubemap.getLevelSize(level);
+    for (auto face = 0; face < 6; ++face) {
+      glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_RGB8,
+          size, size, 0, GL_RGB, GL_UNSIGNED_BYTE,
+          &cubemap.texels[cubemap.getLevelOffset(level, face)]);
+    }
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL,
+      cubemap.numLevels - 1);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+      GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+  numLevels = cubemap.numLevels;
+  return texture;
+}
@@ -0,0 +1,48 @@
+#ifndef __ENVIRONMENT_MAP_HPP__
+#define __ENVIRONMENT_MAP_HPP__
+
+#include "glHandles.hpp"
+
+#include <GL/glew.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Cubemap with a full mip chain where level l holds the environment
+// blurred for roughness l / (numLevels - 1), level 0 being the mirror
+// image. Texels are RGB8, faces in GL order, levels one after another.
+struct PrefilteredCubemap {
+  int faceSize;
+  int numLevels;
+  std::uint64_t sourceHash;
+  std::vector<unsigned char> texels;
+
+  PrefilteredCubemap();
+
+  std::size_t getLevelOffset(int level, int face) const;
+  inline int getLevelSize(int level) const {
+    return faceSize >> level > 0 ? faceSize >> level : 1;
+  }
+};
+
+// Faces are square RGB8 images of faceSize, in GL order. Every texel of
+// every level is integrated over the GGX lobe of its roughness with
+// sampleCount importance samples, rows of all faces run in parallel.
+void prefilterCubemap(const std::vector<const unsigned char*> &faces,
+    int faceSize, int sampleCount, PrefilteredCubemap &result);
+
+// The cache holds one cubemap and the hash of the faces it was built
+// from, it is rebuilt when that hash or the sample count changes.
+bool loadPrefilteredCubemapCache(const std::string &path,
+    std::uint64_t sourceHash, PrefilteredCubemap &result);
+bool savePrefilteredCubemapCache(const std::string &path,
+    const PrefilteredCubemap &cubemap);
+
+// Loads the faces, prefilters them or takes the result from the cache
+// and uploads every level. The number of levels is returned for the
+// shaders to map roughness onto them, 0 with an empty handle when the
+// faces cannot be loaded.
+GLTexture createPrefilteredCubemap(const std::vector<std::string> &faces,
+    const std::string &cachePath, int &numLevels);
+
+#endif
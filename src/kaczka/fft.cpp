@@ -0,0 +1,139 @@
+#include "fft.hpp"
+#include "parallel.hpp"
+
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+// Columns are transformed in blocks this wide; each butterfly then works
+// on a contiguous run of a row, which keeps the inner loop vectorizable.
+static const int cColumnBlock = 64;
+
+static void buildBitReverse(int size, vector<int> &table) {
+  table.resize(size);
+  int bits = 0;
+  while ((1 << bits) < size) {
+    ++bits;
+  }
+  for (auto i = 0; i < size; ++i) {
+    int reversed = 0;
+    for (auto b = 0; b < bits; ++b) {
+      reversed |= ((i >> b) & 1) << (bits - 1 - b);
+    }
+    table[i] = reversed;
+  }
+}
+
+static void buildTwiddles(int size, vector<float> &real,
+    vector<float> &imaginary) {
+  real.resize(size / 2);
+  imaginary.resize(size / 2);
+  for (auto i = 0; i < size / 2; ++i) {
+    double angle = 2.0 * M_PI * i / size;
+    real[i] = (float)cos(angle);
+    imaginary[i] = (float)sin(angle);
+  }
+}
+
+bool isPowerOfTwo(int value) {
+  return value > 0 && (value & (value - 1)) == 0;
+}
+
+FFT2D::FFT2D() : _width(0), _height(0) {
+}
+
+void FFT2D::create(int width, int height) {
+  _width = width;
+  _height = height;
+  buildBitReverse(_width, _rowBitReverse);
+  buildBitReverse(_height, _columnBitReverse);
+  buildTwiddles(_width, _rowTwiddleReal, _rowTwiddleImaginary);
+  buildTwiddles(_height, _columnTwiddleReal, _columnTwiddleImaginary);
+}
+
+void FFT2D::inverse(vector<float> &real, vector<float> &imaginary) {
+  float *re = &real[0], *im = &imaginary[0];
+  parallelFor(0, _height, [this, re, im](int first, int last) {
+    transformRows(re, im, first, last);
+  });
+
+  int numBlocks = (_width + cColumnBlock - 1) / cColumnBlock;
+  parallelFor(0, numBlocks, [this, re, im](int first, int last) {
+    transformColumns(re, im, first * cColumnBlock,
+        min(_width, last * cColumnBlock));
+  });
+}
+
+void FFT2D::transformRows(float *real, float *imaginary, int firstRow,
+    int lastRow) {
+  for (auto row = firstRow; row < lastRow; ++row) {
+    float *re = real + row * _width;
+    float *im = imaginary + row * _width;
+
+    for (auto i = 0; i < _width; ++i) {
+      auto j = _rowBitReverse[i];
+      if (i < j) {
+        swap(re[i], re[j]);
+        swap(im[i], im[j]);
+      }
+    }
+
+    for (auto length = 2; length <= _width; length <<= 1) {
+      auto half = length / 2;
+      auto step = _width / length;
+      for (auto i = 0; i < _width; i += length) {
+        for (auto j = 0; j < half; ++j) {
+          float wr = _rowTwiddleReal[j * step];
+          float wi = _rowTwiddleImaginary[j * step];
+          auto a = i + j, b = i + j + half;
+          float vr = re[b] * wr - im[b] * wi;
+          float vi = re[b] * wi + im[b] * wr;
+          re[b] = re[a] - vr;
+          im[b] = im[a] - vi;
+          re[a] += vr;
+          im[a] += vi;
+        }
+      }
+    }
+  }
+}
+
+void FFT2D::transformColumns(float *real, float *imaginary, int firstColumn,
+    int lastColumn) {
+  auto count = lastColumn - firstColumn;
+
+  for (auto i = 0; i < _height; ++i) {
+    auto j = _columnBitReverse[i];
+    if (i < j) {
+      swap_ranges(real + i * _width + firstColumn,
+          real + i * _width + lastColumn, real + j * _width + firstColumn);
+      swap_ranges(imaginary + i * _width + firstColumn,
+          imaginary + i * _width + lastColumn,
+          imaginary + j * _width + firstColumn);
+    }
+  }
+
+  for (auto length = 2; length <= _height; length <<= 1) {
+    auto half = length / 2;
+    auto step = _height / length;
+    for (auto i = 0; i < _height; i += length) {
+      for (auto j = 0; j < half; ++j) {
+        float wr = _columnTwiddleReal[j * step];
+        float wi = _columnTwiddleImaginary[j * step];
+        float *ar = real + (i + j) * _width + firstColumn;
+        float *ai = imaginary + (i + j) * _width + firstColumn;
+        float *br = real + (i + j + half) * _width + firstColumn;
+        float *bi = imaginary + (i + j + half) * _width + firstColumn;
+        for (auto x = 0; x < count; ++x) {
+          float vr = br[x] * wr - bi[x] * wi;
+          float vi = br[x] * wi + bi[x] * wr;
+          br[x] = ar[x] - vr;
+          bi[x] = ai[x] - vi;
+          ar[x] += vr;
+          ai[x] += vi;
+        }
+      }
+    }
+  }
+}
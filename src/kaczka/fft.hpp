@@ -0,0 +1,33 @@
+#ifndef __FFT_HPP__
+#define __FFT_HPP__
+
+#include <vector>
+
+bool isPowerOfTwo(int value);
+
+// Unnormalized inverse 2D FFT (positive exponent) over split real and
+// imaginary planes stored row by row. Both sizes must be powers of two.
+class FFT2D {
+public:
+  FFT2D();
+
+  void create(int width, int height);
+  void inverse(std::vector<float> &real, std::vector<float> &imaginary);
+
+  inline int getWidth() { return _width; }
+  inline int getHeight() { return _height; }
+
+protected:
+  void transformRows(float *real, float *imaginary, int firstRow,
+      int lastRow);
+  void transformColumns(float *real, float *imaginary, int firstColumn,
+      int lastColumn);
+
+private:
+  int _width, _height;
+  std::vector<int> _rowBitReverse, _columnBitReverse;
+  std::vector<float> _rowTwiddleReal, _rowTwiddleImaginary;
+  std::vector<float> _columnTwiddleReal, _columnTwiddleImaginary;
+};
+
+#endif
@@ -0,0 +1,105 @@
+#include "frameGovernor.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+const int FrameGovernor::cLogCapacity;
+
+// Weight of the newest frame in the smoothed frame time.
+static const float cSmoothing = 0.1f;
+
+// Fractions of the target a smoothed frame has to be over to count
+// against the level, or under to count for the next better one.
+static const float cOverBudget = 1.0f;
+static const float cUnderBudget = 0.7f;
+
+static const int cDowngradeFrames = 15;
+static const int cUpgradeFrames = 120;
+static const int cMaxUpgradeFrames = 16 * cUpgradeFrames;
+static const int cSettleFrames = 30;
+
+FrameGovernor::FrameGovernor() :
+  _level(0), _targetFrameTime(0.0f), _frameTime(0.0f), _settleFrames(0),
+  _overBudgetFrames(0), _underBudgetFrames(0),
+  _upgradeFrames(cUpgradeFrames), _lastUpgradeFrame(-cMaxUpgradeFrames),
+  _numDecisions(0) {
+}
+
+void FrameGovernor::create(const vector<QualityLevel> &levels,
+    int startLevel, float targetFrameTime) {
+  _levels = levels;
+  _level = max(0, min((int)_levels.size() - 1, startLevel));
+  _targetFrameTime = targetFrameTime;
+  _frameTime = 0.0f;
+  _settleFrames = cSettleFrames;
+  _overBudgetFrames = 0;
+  _underBudgetFrames = 0;
+  _upgradeFrames = cUpgradeFrames;
+  _lastUpgradeFrame = -cMaxUpgradeFrames;
+  _numDecisions = 0;
+}
+
+bool FrameGovernor::update(int frame, const FrameTimings &timings) {
+  if (_levels.empty()) {
+    return false;
+  }
+
+  auto cost = max(timings.simulation + timings.render, timings.gpu);
+  if (_settleFrames > 0) {
+    --_settleFrames;
+    _frameTime = cost;
+    return false;
+  }
+  _frameTime += cSmoothing * (cost - _frameTime);
+
+  if (_frameTime > cOverBudget * _targetFrameTime) {
+    ++_overBudgetFrames;
+  } else {
+    _overBudgetFrames = 0;
+  }
+  if (_frameTime < cUnderBudget * _targetFrameTime) {
+    ++_underBudgetFrames;
+  } else {
+    _underBudgetFrames = 0;
+  }
+
+  auto cheapest = (int)_levels.size() - 1;
+  if (_overBudgetFrames >= cDowngradeFrames && _level < cheapest) {
+    // The better level did not hold for long, it needs a longer calm run
+    // before it is tried again.
+    if (frame - _lastUpgradeFrame < cSettleFrames + cUpgradeFrames) {
+      _upgradeFrames = min(2 * _upgradeFrames, cMaxUpgradeFrames);
+    } else {
+      _upgradeFrames = cUpgradeFrames;
+    }
+    changeLevel(frame, _level + 1, "over budget");
+    return true;
+  }
+  if (_underBudgetFrames >= _upgradeFrames && _level > 0) {
+    _lastUpgradeFrame = frame;
+    changeLevel(frame, _level - 1, "under budget");
+    return true;
+  }
+  return false;
+}
+
+int FrameGovernor::getNumDecisions() const {
+  return min(_numDecisions, cLogCapacity);
+}
+
+const GovernorDecision &FrameGovernor::getDecision(int index) const {
+  auto first = max(0, _numDecisions - cLogCapacity);
+  return _log[(first + index) % cLogCapacity];
+}
+
+void FrameGovernor::changeLevel(int frame, int level, const char *reason) {
+  GovernorDecision decision = { frame, _level, level, _frameTime, reason };
+  _log[_numDecisions % cLogCapacity] = decision;
+  ++_numDecisions;
+
+  _level = level;
+  _settleFrames = cSettleFrames;
+  _overBudgetFrames = 0;
+  _underBudgetFrames = 0;
+}
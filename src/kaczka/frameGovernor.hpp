@@ -0,0 +1,81 @@
+#ifndef __FRAME_GOVERNOR_HPP__
+#define __FRAME_GOVERNOR_HPP__
+
+#include <vector>
+
+// Settings the governor steps between, from the best to the cheapest.
+struct QualityLevel {
+  int gridResolution;
+  int substeps;
+  // Screen space error in pixels that duck LODs may show.
+  float duckLodError;
+  int numDucks;
+};
+
+// Seconds spent in each phase of a frame. Simulation and render are CPU
+// time on the main thread, gpu is the render phase on the GPU, measured
+// some frames late.
+struct FrameTimings {
+  float simulation;
+  float render;
+  float gpu;
+};
+
+struct GovernorDecision {
+  int frame;
+  int fromLevel, toLevel;
+  // Smoothed cost of a frame when the decision was made, in seconds.
+  float frameTime;
+  const char *reason;
+};
+
+// Holds the frame time under a target by moving one quality level at a
+// time. A frame costs the longer of its CPU and GPU time, smoothed over
+// recent frames. Quality drops after a short run of frames over the
+// target and rises only after a long run well under it; a rise that has
+// to be taken back soon doubles the run the next rise needs. Measurements
+// of the frames right after a change are dropped, they include the
+// change itself.
+class FrameGovernor {
+public:
+  FrameGovernor();
+
+  void create(const std::vector<QualityLevel> &levels, int startLevel,
+      float targetFrameTime);
+
+  // True when the level changed; the new one applies from the next frame.
+  bool update(int frame, const FrameTimings &timings);
+
+  inline int getLevelIndex() const { return _level; }
+  inline const QualityLevel &getLevel() const { return _levels[_level]; }
+  inline int getNumLevels() const { return (int)_levels.size(); }
+  inline float getTargetFrameTime() const { return _targetFrameTime; }
+  inline float getFrameTime() const { return _frameTime; }
+
+  // The most recent decisions, oldest first.
+  int getNumDecisions() const;
+  const GovernorDecision &getDecision(int index) const;
+  inline const GovernorDecision &getLastDecision() const {
+    return getDecision(getNumDecisions() - 1);
+  }
+
+private:
+  static const int cLogCapacity = 64;
+
+  void changeLevel(int frame, int level, const char *reason);
+
+  std::vector<QualityLevel> _levels;
+  int _level;
+  float _targetFrameTime;
+
+  float _frameTime;
+  int _settleFrames;
+  int _overBudgetFrames, _underBudgetFrames;
+  int _upgradeFrames;
+  int _lastUpgradeFrame;
+
+  GovernorDecision _log[cLogCapacity];
+  int _numDecisions;
+};
+
+#endif
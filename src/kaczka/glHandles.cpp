@@ -0,0 +1,30 @@
+#include "glHandles.hpp"
+
+#include <iostream>
+
+using namespace std;
+
+static int gLiveGLHandles[cNumGLHandleTypes] = {};
+
+void countGLHandles(GLHandleType type, int change) {
+  gLiveGLHandles[(int)type] += change;
+}
+
+int getNumLiveGLHandles(GLHandleType type) {
+  return gLiveGLHandles[(int)type];
+}
+
+bool checkGLHandleLeaks() {
+  const char *names[cNumGLHandleTypes] = {
+    "buffers", "vertex arrays", "textures", "shaders", "programs", "queries"
+  };
+  auto clean = true;
+  for (auto i = 0; i < cNumGLHandleTypes; ++i) {
+    if (gLiveGLHandles[i] != 0) {
+      cerr << gLiveGLHandles[i] << " GL " << names[i] << " still alive."
+        << endl;
+      clean = false;
+    }
+  }
+  return clean;
+}
@@ -0,0 +1,127 @@
+#ifndef __GL_HANDLES_HPP__
+#define __GL_HANDLES_HPP__
+
+#include <GL/glew.h>
+
+enum class GLHandleType {
+  Buffer,
+  VertexArray,
+  Texture,
+  Shader,
+  Program,
+  Query
+};
+
+const int cNumGLHandleTypes = 6;
+
+// Names of each type currently owned by handles. Names are created and
+// deleted on the thread of the context only, so the counts are plain.
+void countGLHandles(GLHandleType type, int change);
+int getNumLiveGLHandles(GLHandleType type);
+// Reports every type with names still alive, false when there are any.
+bool checkGLHandleLeaks();
+
+struct GLBufferTraits {
+  static const GLHandleType cType = GLHandleType::Buffer;
+  static GLuint create() { GLuint id = 0; glGenBuffers(1, &id); return id; }
+  static void destroy(GLuint id) { glDeleteBuffers(1, &id); }
+};
+
+struct GLVertexArrayTraits {
+  static const GLHandleType cType = GLHandleType::VertexArray;
+  static GLuint create() {
+    GLuint id = 0;
+    glGenVertexArrays(1, &id);
+    return id;
+  }
+  static void destroy(GLuint id) { glDeleteVertexArrays(1, &id); }
+};
+
+struct GLTextureTraits {
+  static const GLHandleType cType = GLHandleType::Texture;
+  static GLuint create() { GLuint id = 0; glGenTextures(1, &id); return id; }
+  static void destroy(GLuint id) { glDeleteTextures(1, &id); }
+};
+
+// Shaders are created with their stage, see Shader.
+struct GLShaderTraits {
+  static const GLHandleType cType = GLHandleType::Shader;
+  static void destroy(GLuint id) { glDeleteShader(id); }
+};
+
+struct GLProgramTraits {
+  static const GLHandleType cType = GLHandleType::Program;
+  static GLuint create() { return glCreateProgram(); }
+  static void destroy(GLuint id) { glDeleteProgram(id); }
+};
+
+struct GLQueryTraits {
+  static const GLHandleType cType = GLHandleType::Query;
+  static GLuint create() { GLuint id = 0; glGenQueries(1, &id); return id; }
+  static void destroy(GLuint id) { glDeleteQueries(1, &id); }
+};
+
+// Owns one GL name and deletes it when destroyed, reset or assigned over.
+// Handles move but do not copy, so every name has a single owner. The
+// context has to be current whenever a handle holding a name goes away.
+template <typename Traits>
+class GLHandle {
+public:
+  GLHandle() : _id(0) {
+  }
+
+  // Takes over a name made elsewhere.
+  explicit GLHandle(GLuint id) : _id(0) {
+    reset(id);
+  }
+
+  GLHandle(GLHandle &&other) : _id(other._id) {
+    other._id = 0;
+  }
+
+  ~GLHandle() {
+    reset();
+  }
+
+  GLHandle &operator=(GLHandle &&other) {
+    if (this != &other) {
+      reset();
+      _id = other._id;
+      other._id = 0;
+    }
+    return *this;
+  }
+
+  static GLHandle create() {
+    return GLHandle(Traits::create());
+  }
+
+  void reset(GLuint id = 0) {
+    if (_id) {
+      Traits::destroy(_id);
+      countGLHandles(Traits::cType, -1);
+    }
+    _id = id;
+    if (_id) {
+      countGLHandles(Traits::cType, 1);
+    }
+  }
+
+  inline GLuint get() const { return _id; }
+  inline explicit operator bool() const { return _id != 0; }
+
+private:
+  GLHandle(const GLHandle &) = delete;
+  GLHandle &operator=(const GLHandle &) = delete;
+
+  GLuint _id;
+};
+
+typedef GLHandle<GLBufferTraits> GLBuffer;
+typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+typedef GLHandle<GLTextureTraits> GLTexture;
+typedef GLHandle<GLShaderTraits> GLShader;
+typedef GLHandle<GLProgramTraits> GLProgram;
+typedef GLHandle<GLQueryTraits> GLQuery;
+
+#endif
@@ -0,0 +1,55 @@
+#include "gpuTimer.hpp"
+
+using namespace std;
+
+GpuTimer::GpuTimer() :
+  _next(0), _numPending(0), _measuring(false), _hasResult(false),
+  _seconds(0.0f) {
+}
+
+void GpuTimer::create() {
+  for (auto &query : _queries) {
+    query = GLQuery::create();
+  }
+  _next = 0;
+  _numPending = 0;
+  _measuring = false;
+  _hasResult = false;
+}
+
+void GpuTimer::begin() {
+  _measuring = _queries[_next] && _numPending < cNumQueries;
+  if (_measuring) {
+    glBeginQuery(GL_TIME_ELAPSED, _queries[_next].get());
+  }
+}
+
+void GpuTimer::end() {
+  if (!_measuring) {
+    return;
+  }
+  glEndQuery(GL_TIME_ELAPSED);
+  _next = (_next + 1) % cNumQueries;
+  ++_numPending;
+  _measuring = false;
+}
+
+bool GpuTimer::read(float &seconds) {
+  while (_numPending > 0) {
+    auto oldest = (_next - _numPending + cNumQueries) % cNumQueries;
+    GLint available = 0;
+    glGetQueryObjectiv(_queries[oldest].get(), GL_QUERY_RESULT_AVAILABLE,
+        &available);
+    if (!available) {
+      break;
+    }
+    GLuint64 nanoseconds = 0;
+    glGetQueryObjectui64v(_queries[oldest].get(), GL_QUERY_RESULT,
+        &nanoseconds);
+    _seconds = nanoseconds * 1e-9f;
+    _hasResult = true;
+    --_numPending;
+  }
+  seconds = _seconds;
+  return _hasResult;
+}
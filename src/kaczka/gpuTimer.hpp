@@ -0,0 +1,34 @@
+#ifndef __GPU_TIMER_HPP__
+#define __GPU_TIMER_HPP__
+
+#include <GL/glew.h>
+
+#include "glHandles.hpp"
+
+// Time the GPU spends on the commands between begin and end, read without
+// waiting for it. Queries go round a ring and are read back once the GPU
+// finished them, usually a few frames later; while all of them are still
+// in flight, begin and end measure nothing.
+class GpuTimer {
+public:
+  GpuTimer();
+
+  // Needs the context, the queries are made here.
+  void create();
+
+  void begin();
+  void end();
+
+  // Latest finished measurement, false until the first one arrives.
+  bool read(float &seconds);
+
+private:
+  static const int cNumQueries = 4;
+
+  GLQuery _queries[cNumQueries];
+  int _next, _numPending;
+  bool _measuring, _hasResult;
+  float _seconds;
+};
+
+#endif
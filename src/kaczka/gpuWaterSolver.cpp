@@ -0,0 +1,283 @@
+#include "gpuWaterSolver.hpp"
+#include "config.hpp"
+
+#include <algorithm>
+
+using namespace std;
+
+// Work groups of the grid shaders, waterStep.comp keeps a tile of this
+// size plus a one sample halo in shared memory.
+static const int cGroupSize = 16;
+static const int cSampleGroupSize = 64;
+
+static void linkComputeProgram(ShaderProgram &program, const char *filename) {
+  ComputeShader shader(filename);
+  program.attach(&shader);
+  program.link();
+}
+
+// Storage buffers only grow, to the largest batch seen.
+static void reserveBuffer(GLuint buffer, int &capacity, int count,
+    size_t elementSize) {
+  if (count <= capacity) {
+    return;
+  }
+  capacity = max(count, 2 * capacity);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+  glBufferData(GL_SHADER_STORAGE_BUFFER, capacity * elementSize, nullptr,
+      GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+GpuWaterSolver::GpuWaterSolver() :
+  _width(0), _height(0), _normalFormat(GL_RG8), _current(0),
+  _splatCapacity(0), _nextSampleBatch(0), _numPendingSamples(0) {
+  for (auto &batch : _sampleBatches) {
+    batch.capacity = batch.count = 0;
+    batch.fence = nullptr;
+  }
+  linkComputeProgram(_stepProgram, SHADER_PATH_PREFIX"waterStep.comp");
+  linkComputeProgram(_normalsProgram, SHADER_PATH_PREFIX"waterNormals.comp");
+  linkComputeProgram(_splatProgram, SHADER_PATH_PREFIX"waterSplat.comp");
+  linkComputeProgram(_sampleProgram, SHADER_PATH_PREFIX"waterSample.comp");
+}
+
+GpuWaterSolver::~GpuWaterSolver() {
+  free();
+}
+
+bool GpuWaterSolver::isSupported() {
+  return GLEW_VERSION_4_3;
+}
+
+void GpuWaterSolver::create(int width, int height, GLenum normalFormat) {
+  _width = width;
+  _height = height;
+  _normalFormat = normalFormat;
+
+  // Texture storage is immutable, so the textures are replaced, while the
+  // storage buffers of an earlier size are kept.
+  for (auto i = 0; i < 3; ++i) {
+    auto &texture = i < 2 ? _heightTextures[i] : _normalTexture;
+    texture = GLTexture::create();
+    glBindTexture(GL_TEXTURE_2D, texture.get());
+    glTexStorage2D(GL_TEXTURE_2D, 1, i < 2 ? GL_R32F : _normalFormat,
+        _width, _height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  if (!_splatBuffer) {
+    _splatBuffer = GLBuffer::create();
+    for (auto &batch : _sampleBatches) {
+      batch.points = GLBuffer::create();
+      batch.results = GLBuffer::create();
+    }
+  }
+
+  clear();
+}
+
+void GpuWaterSolver::free() {
+  _heightTextures[0].reset();
+  _heightTextures[1].reset();
+  _normalTexture.reset();
+  _splatBuffer.reset();
+  _splatCapacity = 0;
+  _splats.clear();
+  for (auto &batch : _sampleBatches) {
+    if (batch.fence) {
+      glDeleteSync(batch.fence);
+    }
+    batch.points.reset();
+    batch.results.reset();
+    batch.capacity = batch.count = 0;
+    batch.fence = nullptr;
+  }
+  _nextSampleBatch = _numPendingSamples = 0;
+}
+
+void GpuWaterSolver::clear() {
+  // Flat water, normals pointing up. Uploaded, as clearing textures needs
+  // GL 4.4.
+  vector<float> texels(2 * _width * _height, 0.0f);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  for (auto i = 0; i < 2; ++i) {
+    glBindTexture(GL_TEXTURE_2D, _heightTextures[i].get());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RED,
+        GL_FLOAT, &texels[0]);
+  }
+  fill(texels.begin(), texels.end(), 0.5f);
+  glBindTexture(GL_TEXTURE_2D, _normalTexture.get());
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RG, GL_FLOAT,
+      &texels[0]);
+  glBindTexture(GL_TEXTURE_2D, 0);
+  _current = 0;
+  _splats.clear();
+}
+
+void GpuWaterSolver::addSplat(const glm::vec4 &splat) {
+  _splats.push_back(splat);
+}
+
+void GpuWaterSolver::dispatchGrid(GLuint program) {
+  glUseProgram(program);
+  glDispatchCompute((_width + cGroupSize - 1) / cGroupSize,
+      (_height + cGroupSize - 1) / cGroupSize, 1);
+  glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+}
+
+// Every sample sums the splats over it, so overlapping ones add up in
+// the order they came in without atomics.
+void GpuWaterSolver::applySplats() {
+  if (_splats.empty()) {
+    return;
+  }
+
+  auto count = (int)_splats.size();
+  reserveBuffer(_splatBuffer.get(), _splatCapacity, count, sizeof(glm::vec4));
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, _splatBuffer.get());
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4),
+      &_splats[0]);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  _splats.clear();
+
+  glUseProgram(_splatProgram.getId());
+  glUniform1i(glGetUniformLocation(_splatProgram.getId(), "count"), count);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _splatBuffer.get());
+  glBindImageTexture(0, _heightTextures[_current].get(), 0, GL_FALSE, 0,
+      GL_READ_WRITE, GL_R32F);
+  dispatchGrid(_splatProgram.getId());
+}
+
+void GpuWaterSolver::step(int count, float A, float damping) {
+  applySplats();
+
+  // The next step overwrites the previous heights in place.
+  glUseProgram(_stepProgram.getId());
+  glUniform1f(glGetUniformLocation(_stepProgram.getId(), "A"), A);
+  glUniform1f(glGetUniformLocation(_stepProgram.getId(), "damping"),
+      damping);
+  for (auto i = 0; i < count; ++i) {
+    auto previous = 1 - _current;
+    glBindImageTexture(0, _heightTextures[_current].get(), 0, GL_FALSE, 0,
+        GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, _heightTextures[previous].get(), 0, GL_FALSE, 0,
+        GL_READ_WRITE, GL_R32F);
+    dispatchGrid(_stepProgram.getId());
+    _current = previous;
+  }
+}
+
+void GpuWaterSolver::updateNormals() {
+  glBindImageTexture(0, _heightTextures[_current].get(), 0, GL_FALSE, 0,
+      GL_READ_ONLY, GL_R32F);
+  glBindImageTexture(1, _normalTexture.get(), 0, GL_FALSE, 0, GL_WRITE_ONLY,
+      _normalFormat);
+  dispatchGrid(_normalsProgram.getId());
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+}
+
+void GpuWaterSolver::requestSamples(const glm::vec2 *points, int count) {
+  if (count == 0 || _numPendingSamples == cNumSampleBatches) {
+    return;
+  }
+  applySplats();
+
+  auto &batch = _sampleBatches[_nextSampleBatch];
+  if (count > batch.capacity) {
+    auto capacity = batch.capacity;
+    reserveBuffer(batch.points.get(), capacity, count, sizeof(glm::vec2));
+    reserveBuffer(batch.results.get(), batch.capacity, count, sizeof(float));
+  }
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch.points.get());
+  glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec2),
+      points);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+  glUseProgram(_sampleProgram.getId());
+  glUniform1i(glGetUniformLocation(_sampleProgram.getId(), "count"), count);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, batch.points.get());
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, batch.results.get());
+  glBindImageTexture(0, _heightTextures[_current].get(), 0, GL_FALSE, 0,
+      GL_READ_ONLY, GL_R32F);
+  glDispatchCompute((count + cSampleGroupSize - 1) / cSampleGroupSize, 1, 1);
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+  batch.count = count;
+  batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  _nextSampleBatch = (_nextSampleBatch + 1) % cNumSampleBatches;
+  ++_numPendingSamples;
+}
+
+// Finished batches are taken oldest first; only the newest is read.
+int GpuWaterSolver::fetchSamples(float *heights, int capacity) {
+  auto newest = -1;
+  while (_numPendingSamples > 0) {
+    auto oldest = (_nextSampleBatch - _numPendingSamples + cNumSampleBatches)
+      % cNumSampleBatches;
+    auto &batch = _sampleBatches[oldest];
+    auto status = glClientWaitSync(batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+      break;
+    }
+    glDeleteSync(batch.fence);
+    batch.fence = nullptr;
+    --_numPendingSamples;
+    newest = oldest;
+  }
+  if (newest < 0) {
+    return 0;
+  }
+
+  auto &batch = _sampleBatches[newest];
+  auto count = min(batch.count, capacity);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, batch.results.get());
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(float),
+      heights);
+  glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+  return count;
+}
+
+void GpuWaterSolver::readHeights(float *heights) {
+  applySplats();
+  readTexture(_heightTextures[_current].get(), heights);
+}
+
+void GpuWaterSolver::readNormals(float *normals) {
+  glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, _normalTexture.get());
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RG, GL_FLOAT, normals);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GpuWaterSolver::readState(float *current, float *previous) {
+  applySplats();
+  readTexture(_heightTextures[_current].get(), current);
+  readTexture(_heightTextures[1 - _current].get(), previous);
+}
+
+void GpuWaterSolver::writeState(const float *current,
+    const float *previous) {
+  _splats.clear();
+  _current = 0;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  for (auto i = 0; i < 2; ++i) {
+    glBindTexture(GL_TEXTURE_2D, _heightTextures[i].get());
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _width, _height, GL_RED,
+        GL_FLOAT, i == 0 ? current : previous);
+  }
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void GpuWaterSolver::readTexture(GLuint texture, float *heights) {
+  glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+  glBindTexture(GL_TEXTURE_2D, texture);
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  glGetTexImage(GL_TEXTURE_2D, 0, GL_RED, GL_FLOAT, heights);
+  glBindTexture(GL_TEXTURE_2D, 0);
+}
@@ -0,0 +1,87 @@
+#ifndef __GPU_WATER_SOLVER_HPP__
+#define __GPU_WATER_SOLVER_HPP__
+
+#include "glHandles.hpp"
+#include "shaders.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Finite difference water stepped by compute shaders, with the same scheme
+// as the CPU solver minus tile sleeping. Heights ping-pong between two R32F
+// images and normals are written straight into the texture that is drawn,
+// so nothing crosses the bus unless it is read back on request.
+class GpuWaterSolver {
+public:
+  // Compiles the shaders, so it needs the context already.
+  GpuWaterSolver();
+  ~GpuWaterSolver();
+
+  // Compute shaders, image load/store and storage buffers need GL 4.3.
+  static bool isSupported();
+
+  // Normals are RG8 or RG16 like the CPU normal map. Creating again at
+  // another size keeps the shaders and storage buffers.
+  void create(int width, int height, GLenum normalFormat);
+  void free();
+  void clear();
+
+  // Splats are (x, y, radius, strength) in sample coordinates and are
+  // added before the next step. Radius 0 adds strength to the sample at
+  // x, y alone, like a drop; otherwise it fades out as (1 - d)^2 with the
+  // squared distance relative to the radius, like a duck footprint.
+  void addSplat(const glm::vec4 &splat);
+  void step(int count, float A, float damping);
+  void updateNormals();
+
+  // Bilinear heights at points in sample coordinates, clamped to the
+  // field, read back without waiting. Each request is sampled after the
+  // steps and splats so far and fenced; fetching returns the newest batch
+  // the GPU has finished, usually requested a frame or two before, and
+  // the number of heights written, 0 while none has finished. Requests
+  // made while every batch is still in flight are dropped.
+  void requestSamples(const glm::vec2 *points, int count);
+  int fetchSamples(float *heights, int capacity);
+  // The whole current field, row by row. Waits for the GPU.
+  void readHeights(float *heights);
+  // The normal texture as x, z pairs in [0, 1]. Waits for the GPU.
+  void readNormals(float *normals);
+  // Both fields of the leapfrog, for checkpoints. Writing drops splats
+  // that were not applied yet.
+  void readState(float *current, float *previous);
+  void writeState(const float *current, const float *previous);
+
+  inline GLuint getHeightTexture() { return _heightTextures[_current].get(); }
+  inline GLuint getNormalTexture() { return _normalTexture.get(); }
+
+protected:
+  void applySplats();
+  void dispatchGrid(GLuint program);
+  void readTexture(GLuint texture, float *heights);
+
+private:
+  static const int cNumSampleBatches = 3;
+
+  struct SampleBatch {
+    GLBuffer points, results;
+    int capacity, count;
+    GLsync fence;
+  };
+
+  int _width, _height;
+  GLenum _normalFormat;
+  GLTexture _heightTextures[2];
+  int _current;
+  GLTexture _normalTexture;
+  GLBuffer _splatBuffer;
+  int _splatCapacity;
+  std::vector<glm::vec4> _splats;
+  SampleBatch _sampleBatches[cNumSampleBatches];
+  int _nextSampleBatch, _numPendingSamples;
+
+  ShaderProgram _stepProgram, _normalsProgram;
+  ShaderProgram _splatProgram, _sampleProgram;
+};
+
+#endif
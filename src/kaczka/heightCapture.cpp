@@ -0,0 +1,398 @@
+#include "heightCapture.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+using namespace std;
+
+namespace {
+
+const uint32_t cCaptureMagic = 0x5041434b;
+const uint32_t cCaptureVersion = 1;
+
+// Zero runs shorter than this stay in literal runs, where they cost a
+// byte each instead of a token.
+const size_t cMinZeroRun = 4;
+const size_t cMaxLiteralRun = 128;
+const unsigned char cZeroRunToken = 0x80;
+
+struct RecordHeader {
+  int32_t step;
+  int32_t keyFrame;
+  uint32_t size;
+};
+
+void writeVarint(vector<unsigned char> &out, size_t value) {
+  while (value >= 0x80) {
+    out.push_back((unsigned char)(value | 0x80));
+    value >>= 7;
+  }
+  out.push_back((unsigned char)value);
+}
+
+bool readVarint(const unsigned char *data, size_t size, size_t &pos,
+    size_t &value) {
+  value = 0;
+  for (auto shift = 0; shift < 64; shift += 7) {
+    if (pos >= size) {
+      return false;
+    }
+    auto byte = data[pos++];
+    value |= (size_t)(byte & 0x7f) << shift;
+    if (byte < 0x80) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Tokens below cZeroRunToken are followed by that many plus one literal
+// bytes, cZeroRunToken by the length of a run of zeros.
+void encodeRuns(const unsigned char *data, size_t size,
+    vector<unsigned char> &out) {
+  out.clear();
+  out.reserve(size + size / cMaxLiteralRun + 16);
+
+  size_t i = 0, literalStart = 0;
+  auto flushLiterals = [&](size_t end) {
+    while (literalStart < end) {
+      auto n = min(cMaxLiteralRun, end - literalStart);
+      out.push_back((unsigned char)(n - 1));
+      out.insert(out.end(), data + literalStart, data + literalStart + n);
+      literalStart += n;
+    }
+  };
+
+  while (i < size) {
+    if (data[i] != 0) {
+      ++i;
+      continue;
+    }
+    auto runEnd = i + 1;
+    while (runEnd < size && data[runEnd] == 0) {
+      ++runEnd;
+    }
+    if (runEnd - i < cMinZeroRun) {
+      i = runEnd;
+      continue;
+    }
+    flushLiterals(i);
+    out.push_back(cZeroRunToken);
+    writeVarint(out, runEnd - i);
+    i = literalStart = runEnd;
+  }
+  flushLiterals(size);
+}
+
+bool decodeRuns(const unsigned char *data, size_t size, unsigned char *out,
+    size_t outSize) {
+  size_t pos = 0, written = 0;
+  while (pos < size) {
+    auto token = data[pos++];
+    size_t n;
+    if (token < cZeroRunToken) {
+      n = token + 1;
+      if (pos + n > size || written + n > outSize) {
+        return false;
+      }
+      memcpy(out + written, data + pos, n);
+      pos += n;
+    } else {
+      if (!readVarint(data, size, pos, n) || written + n > outSize) {
+        return false;
+      }
+      memset(out + written, 0, n);
+    }
+    written += n;
+  }
+  return written == outSize;
+}
+
+} // namespace
+
+void encodeCaptureFrame(const unsigned char *samples,
+    const unsigned char *previous, int numSamples, int bytesPerSample,
+    vector<unsigned char> &planes, vector<unsigned char> &encoded) {
+  planes.resize((size_t)numSamples * bytesPerSample);
+  for (auto b = 0; b < bytesPerSample; ++b) {
+    auto plane = &planes[(size_t)b * numSamples];
+    auto source = samples + b;
+    if (previous) {
+      auto before = previous + b;
+      for (auto i = 0; i < numSamples; ++i) {
+        plane[i] = source[i * bytesPerSample] ^ before[i * bytesPerSample];
+      }
+    } else {
+      for (auto i = 0; i < numSamples; ++i) {
+        plane[i] = source[i * bytesPerSample];
+      }
+    }
+  }
+  encodeRuns(&planes[0], planes.size(), encoded);
+}
+
+bool decodeCaptureFrame(const unsigned char *encoded, size_t size,
+    bool keyFrame, int numSamples, int bytesPerSample,
+    vector<unsigned char> &planes, unsigned char *samples) {
+  planes.resize((size_t)numSamples * bytesPerSample);
+  if (!decodeRuns(encoded, size, &planes[0], planes.size())) {
+    return false;
+  }
+
+  for (auto b = 0; b < bytesPerSample; ++b) {
+    auto plane = &planes[(size_t)b * numSamples];
+    auto target = samples + b;
+    if (keyFrame) {
+      for (auto i = 0; i < numSamples; ++i) {
+        target[i * bytesPerSample] = plane[i];
+      }
+    } else {
+      for (auto i = 0; i < numSamples; ++i) {
+        target[i * bytesPerSample] ^= plane[i];
+      }
+    }
+  }
+  return true;
+}
+
+static int getBytesPerSample(HeightFieldPrecision precision) {
+  return precision == HeightFieldPrecision::Float32 ? 4 : 2;
+}
+
+HeightCaptureWriter::HeightCaptureWriter() :
+  _frameBytes(0), _framesSinceKey(0), _writerRunning(false), _dropped(0),
+  _written(0) {
+}
+
+HeightCaptureWriter::~HeightCaptureWriter() {
+  close();
+}
+
+bool HeightCaptureWriter::open(const string &path,
+    const HeightCaptureHeader &header) {
+  close();
+
+  _file.open(path, ios::binary | ios::trunc);
+  if (!_file) {
+    cerr << "cannot write height capture " << path << endl;
+    return false;
+  }
+
+  _header = header;
+  int32_t fields[] = {
+    header.width, header.height, (int32_t)header.precision, header.interval
+  };
+  _file.write((const char*)&cCaptureMagic, sizeof(cCaptureMagic));
+  _file.write((const char*)&cCaptureVersion, sizeof(cCaptureVersion));
+  _file.write((const char*)fields, sizeof(fields));
+  _file.write((const char*)&header.fixedPointRange,
+      sizeof(header.fixedPointRange));
+
+  // Every buffer is sized up front, so captured frames allocate nothing.
+  _frameBytes = header.width * header.height
+    * getBytesPerSample(header.precision);
+  for (auto &slot : _slots) {
+    slot.resize(_frameBytes);
+  }
+  _previous.assign(_frameBytes, 0);
+  _planes.resize(_frameBytes);
+  _encoded.reserve(_frameBytes + _frameBytes / cMaxLiteralRun + 16);
+  _framesSinceKey = 0;
+  _dropped.store(0);
+  _written.store(0);
+
+  _freeSlots.clear();
+  _queuedSlots.clear();
+  for (auto i = 0; i < cSlots; ++i) {
+    _freeSlots.push(i);
+  }
+  _writerRunning.store(true);
+  _writerThread = thread(&HeightCaptureWriter::writerLoop, this);
+  return true;
+}
+
+void HeightCaptureWriter::close() {
+  if (!isOpen()) {
+    return;
+  }
+
+  _writerRunning.store(false);
+  _writerThread.join();
+  _file.close();
+  if (_dropped.load() > 0) {
+    cerr << "height capture dropped " << _dropped.load() << " of "
+      << _dropped.load() + _written.load() << " frames" << endl;
+  }
+}
+
+bool HeightCaptureWriter::submit(int step, const void *samples) {
+  int slot;
+  if (!_freeSlots.pop(slot)) {
+    _dropped.fetch_add(1, memory_order_relaxed);
+    return false;
+  }
+
+  memcpy(&_slots[slot][0], samples, _frameBytes);
+  _slotSteps[slot] = step;
+  _queuedSlots.push(slot);
+  return true;
+}
+
+void HeightCaptureWriter::writerLoop() {
+  int slot;
+  while (true) {
+    if (_queuedSlots.pop(slot)) {
+      writeFrame(slot);
+      _freeSlots.push(slot);
+      continue;
+    }
+    // Stopping only once the queue is empty writes every submitted frame.
+    if (!_writerRunning.load(memory_order_acquire)) {
+      break;
+    }
+    this_thread::sleep_for(chrono::microseconds(500));
+  }
+}
+
+void HeightCaptureWriter::writeFrame(int slot) {
+  auto keyFrame = _framesSinceKey == 0;
+  auto bytesPerSample = getBytesPerSample(_header.precision);
+  auto &samples = _slots[slot];
+  encodeCaptureFrame(&samples[0], keyFrame ? nullptr : &_previous[0],
+      _header.width * _header.height, bytesPerSample, _planes, _encoded);
+  _previous.swap(samples);
+  _framesSinceKey = (_framesSinceKey + 1) % cCaptureKeyFrameInterval;
+
+  RecordHeader record = {
+    _slotSteps[slot], keyFrame ? 1 : 0, (uint32_t)_encoded.size()
+  };
+  _file.write((const char*)&record, sizeof(record));
+  _file.write((const char*)&_encoded[0], _encoded.size());
+  _written.fetch_add(1, memory_order_relaxed);
+}
+
+HeightCaptureReader::HeightCaptureReader() : _hasFrame(false) {
+  _header = HeightCaptureHeader();
+}
+
+bool HeightCaptureReader::open(const string &path) {
+  _file.close();
+  _file.clear();
+  _file.open(path, ios::binary);
+  if (!_file) {
+    cerr << "cannot read height capture " << path << endl;
+    return false;
+  }
+
+  uint32_t magic = 0, version = 0;
+  int32_t fields[4] = {};
+  float fixedPointRange = 1.0f;
+  _file.read((char*)&magic, sizeof(magic));
+  _file.read((char*)&version, sizeof(version));
+  _file.read((char*)fields, sizeof(fields));
+  _file.read((char*)&fixedPointRange, sizeof(fixedPointRange));
+  if (!_file || magic != cCaptureMagic || version != cCaptureVersion
+      || fields[0] <= 0 || fields[1] <= 0 || fields[2] < 0 || fields[2] > 2) {
+    cerr << path << " is not a height capture" << endl;
+    return false;
+  }
+
+  _header.width = fields[0];
+  _header.height = fields[1];
+  _header.precision = (HeightFieldPrecision)fields[2];
+  _header.interval = fields[3];
+  _header.fixedPointRange = fixedPointRange;
+  _samples.create(_header.width, _header.height, _header.precision,
+      _header.fixedPointRange);
+  _firstRecord = _file.tellg();
+  _hasFrame = false;
+  return true;
+}
+
+bool HeightCaptureReader::readRecord(int &step, bool &keyFrame) {
+  RecordHeader record;
+  if (!_file.read((char*)&record, sizeof(record))) {
+    return false;
+  }
+  _encoded.resize(record.size);
+  if (record.size > 0 && !_file.read((char*)&_encoded[0], record.size)) {
+    cerr << "truncated height capture record" << endl;
+    return false;
+  }
+
+  step = record.step;
+  keyFrame = record.keyFrame != 0;
+  if (!keyFrame && !_hasFrame) {
+    return false;
+  }
+  _hasFrame = decodeCaptureFrame(_encoded.empty() ? nullptr : &_encoded[0],
+      _encoded.size(), keyFrame, _header.width * _header.height,
+      _samples.getBytesPerSample(), _planes,
+      (unsigned char*)_samples.getData(0, 0));
+  if (!_hasFrame) {
+    cerr << "damaged height capture record at step " << step << endl;
+  }
+  return _hasFrame;
+}
+
+bool HeightCaptureReader::skipRecord(bool &keyFrame) {
+  RecordHeader record;
+  if (!_file.read((char*)&record, sizeof(record))) {
+    return false;
+  }
+  keyFrame = record.keyFrame != 0;
+  return (bool)_file.seekg(record.size, ios::cur);
+}
+
+bool HeightCaptureReader::readFrame(int &step, vector<float> &heights) {
+  bool keyFrame;
+  if (!readRecord(step, keyFrame)) {
+    return false;
+  }
+  heights.resize(_header.width * _header.height);
+  for (auto y = 0; y < _header.height; ++y) {
+    _samples.loadRow(y, 0, _header.width, &heights[y * _header.width]);
+  }
+  return true;
+}
+
+bool HeightCaptureReader::seekFrame(int index) {
+  _file.clear();
+  _file.seekg(_firstRecord);
+  _hasFrame = false;
+
+  // Headers alone find the last key frame at or before the record.
+  auto keyPosition = _firstRecord;
+  auto keyIndex = 0;
+  for (auto i = 0; i < index; ++i) {
+    auto position = _file.tellg();
+    bool keyFrame;
+    if (!skipRecord(keyFrame)) {
+      return false;
+    }
+    if (keyFrame) {
+      keyPosition = position;
+      keyIndex = i;
+    }
+  }
+  auto position = _file.tellg();
+  bool keyFrame;
+  if (!skipRecord(keyFrame)) {
+    return false;
+  }
+  if (keyFrame) {
+    _file.seekg(position);
+    return true;
+  }
+
+  _file.seekg(keyPosition);
+  for (auto i = keyIndex; i < index; ++i) {
+    int step;
+    if (!readRecord(step, keyFrame)) {
+      return false;
+    }
+  }
+  return true;
+}
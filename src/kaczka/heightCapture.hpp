@@ -0,0 +1,109 @@
+#ifndef __HEIGHT_CAPTURE_HPP__
+#define __HEIGHT_CAPTURE_HPP__
+
+#include "heightField.hpp"
+#include "spscQueue.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Capture files hold a header and one record per captured step. Records
+// keep the raw samples at the precision of the field, each one XORed with
+// the previous record, split into byte planes and compressed by runs of
+// zero bytes. Sleeping tiles and the high bytes of slowly changing heights
+// come out as long zero runs. Every cCaptureKeyFrameInterval-th record is
+// a key frame, XORed with nothing, so readers seeking into the file only
+// decode from the key frame before the record they want.
+const int cCaptureKeyFrameInterval = 64;
+
+struct HeightCaptureHeader {
+  int width, height;
+  HeightFieldPrecision precision;
+  float fixedPointRange;
+  // Solver steps between captured records.
+  int interval;
+};
+
+// Bytes are XORed into previous, pass nullptr for a key frame.
+void encodeCaptureFrame(const unsigned char *samples,
+    const unsigned char *previous, int numSamples, int bytesPerSample,
+    std::vector<unsigned char> &planes, std::vector<unsigned char> &encoded);
+// Decodes on top of samples, which holds the previous frame unless this
+// one is a key frame.
+bool decodeCaptureFrame(const unsigned char *encoded, std::size_t size,
+    bool keyFrame, int numSamples, int bytesPerSample,
+    std::vector<unsigned char> &planes, unsigned char *samples);
+
+// Frames are copied into one of a few slots and compressed and written by
+// a thread of its own. When the writer falls behind and every slot is
+// taken, frames are dropped and counted instead of stalling the caller.
+class HeightCaptureWriter {
+public:
+  HeightCaptureWriter();
+  ~HeightCaptureWriter();
+
+  bool open(const std::string &path, const HeightCaptureHeader &header);
+  // Writes the frames still queued first.
+  void close();
+  inline bool isOpen() { return _writerThread.joinable(); }
+
+  // Samples are a whole field, row by row, at the precision of the header.
+  bool submit(int step, const void *samples);
+
+  inline int getNumDropped() { return _dropped.load(); }
+  inline int getNumWritten() { return _written.load(); }
+
+private:
+  static const int cSlots = 4;
+
+  void writerLoop();
+  void writeFrame(int slot);
+
+  std::ofstream _file;
+  HeightCaptureHeader _header;
+  int _frameBytes;
+
+  std::vector<unsigned char> _slots[cSlots];
+  int _slotSteps[cSlots];
+  SpscQueue<int, cSlots> _freeSlots, _queuedSlots;
+
+  std::vector<unsigned char> _previous, _planes, _encoded;
+  int _framesSinceKey;
+
+  std::thread _writerThread;
+  std::atomic<bool> _writerRunning;
+  std::atomic<int> _dropped, _written;
+};
+
+// Reads capture records in order.
+class HeightCaptureReader {
+public:
+  HeightCaptureReader();
+
+  bool open(const std::string &path);
+  inline const HeightCaptureHeader &getHeader() { return _header; }
+
+  // Heights in sample spacings, row by row. False at the end of the file
+  // or when a record is damaged.
+  bool readFrame(int &step, std::vector<float> &heights);
+  // The next readFrame returns record index, counted from 0.
+  bool seekFrame(int index);
+  inline std::size_t getLastFrameSize() { return _encoded.size(); }
+
+private:
+  bool readRecord(int &step, bool &keyFrame);
+  bool skipRecord(bool &keyFrame);
+
+  std::ifstream _file;
+  std::streampos _firstRecord;
+  HeightCaptureHeader _header;
+  HeightField _samples;
+  std::vector<unsigned char> _planes, _encoded;
+  bool _hasFrame;
+};
+
+#endif
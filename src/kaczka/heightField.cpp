@@ -0,0 +1,232 @@
+#include "heightField.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+float halfToFloat(uint16_t value) {
+#ifdef __F16C__
+  return _cvtsh_ss(value);
+#else
+  uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+  uint32_t exponent = (value >> 10) & 0x1f;
+  uint32_t mantissa = value & 0x3ff;
+
+  if (exponent == 0) {
+    float magnitude = mantissa * (1.0f / 16777216.0f);
+    return sign ? -magnitude : magnitude;
+  }
+
+  uint32_t bits = sign | (mantissa << 13);
+  if (exponent == 0x1f) {
+    bits |= 0x7f800000;
+  } else {
+    bits |= (exponent + 112) << 23;
+  }
+
+  float result;
+  memcpy(&result, &bits, sizeof(result));
+  return result;
+#endif
+}
+
+uint16_t floatToHalf(float value) {
+#ifdef __F16C__
+  return _cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT);
+#else
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  uint16_t sign = (bits >> 16) & 0x8000;
+  uint32_t magnitude = bits & 0x7fffffff;
+
+  // Too large for a half, infinity or NaN.
+  if (magnitude >= 0x47800000) {
+    return sign | (magnitude > 0x7f800000 ? 0x7e00 : 0x7c00);
+  }
+
+  // Subnormal halves are multiples of 2^-24; rounding up to 1024 of them
+  // gives the smallest normal half, which has the same bit pattern.
+  if (magnitude < 0x38800000) {
+    return sign | (uint16_t)lrintf(fabsf(value) * 16777216.0f);
+  }
+
+  // Rebias the exponent and round the mantissa to nearest even. A carry
+  // out of the mantissa correctly bumps the exponent, up to infinity.
+  uint32_t half = (magnitude - 0x38000000) >> 13;
+  uint32_t rest = magnitude & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | (uint16_t)half;
+#endif
+}
+
+static void halfRowToFloat(const uint16_t *source, float *destination,
+    int count) {
+  auto i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= count; i += 8) {
+    __m128i halves = _mm_loadu_si128((const __m128i*)(source + i));
+    _mm256_storeu_ps(destination + i, _mm256_cvtph_ps(halves));
+  }
+#endif
+  for (; i < count; ++i) {
+    destination[i] = halfToFloat(source[i]);
+  }
+}
+
+static void floatRowToHalf(const float *source, uint16_t *destination,
+    int count) {
+  auto i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= count; i += 8) {
+    __m128i halves = _mm256_cvtps_ph(_mm256_loadu_ps(source + i),
+        _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128((__m128i*)(destination + i), halves);
+  }
+#endif
+  for (; i < count; ++i) {
+    destination[i] = floatToHalf(source[i]);
+  }
+}
+
+HeightField::HeightField() : _width(0), _height(0),
+  _precision(HeightFieldPrecision::Float32), _fixedPointRange(1.0f),
+  _fixedPointScale(1.0f), _invFixedPointScale(1.0f) {
+}
+
+void HeightField::create(int width, int height,
+    HeightFieldPrecision precision, float fixedPointRange) {
+  _width = width;
+  _height = height;
+  _precision = precision;
+  _fixedPointRange = fixedPointRange;
+  _fixedPointScale = fixedPointRange / 32767.0f;
+  _invFixedPointScale = 32767.0f / fixedPointRange;
+
+  auto total = width * height;
+  _floats.assign(precision == HeightFieldPrecision::Float32 ? total : 0,
+      0.0f);
+  _halves.assign(precision == HeightFieldPrecision::Float16 ? total : 0, 0);
+  _fixed.assign(precision == HeightFieldPrecision::Fixed16 ? total : 0, 0);
+
+  // Release storage of the previous precision as well.
+  vector<float>(_floats).swap(_floats);
+  vector<uint16_t>(_halves).swap(_halves);
+  vector<int16_t>(_fixed).swap(_fixed);
+}
+
+void HeightField::clear() {
+  clearRect(0, 0, _width, _height);
+}
+
+void HeightField::clearRect(int x0, int y0, int x1, int y1) {
+  // Zero has an all zero bit pattern in every precision.
+  for (auto y = y0; y < y1; ++y) {
+    auto first = y * _width + x0, last = y * _width + x1;
+    switch (_precision) {
+      case HeightFieldPrecision::Float32:
+        fill(_floats.begin() + first, _floats.begin() + last, 0.0f);
+        break;
+      case HeightFieldPrecision::Float16:
+        fill(_halves.begin() + first, _halves.begin() + last, 0);
+        break;
+      case HeightFieldPrecision::Fixed16:
+        fill(_fixed.begin() + first, _fixed.begin() + last, 0);
+        break;
+    }
+  }
+}
+
+float HeightField::get(int x, int y) const {
+  auto index = y * _width + x;
+  switch (_precision) {
+    case HeightFieldPrecision::Float16:
+      return halfToFloat(_halves[index]);
+    case HeightFieldPrecision::Fixed16:
+      return _fixed[index] * _fixedPointScale;
+    default:
+      return _floats[index];
+  }
+}
+
+void HeightField::set(int x, int y, float value) {
+  auto index = y * _width + x;
+  switch (_precision) {
+    case HeightFieldPrecision::Float16:
+      _halves[index] = floatToHalf(value);
+      break;
+    case HeightFieldPrecision::Fixed16:
+      _fixed[index] = (int16_t)lrintf(
+          max(-32767.0f, min(32767.0f, value * _invFixedPointScale)));
+      break;
+    default:
+      _floats[index] = value;
+      break;
+  }
+}
+
+void HeightField::loadRow(int y, int x0, int x1, float *destination) const {
+  auto first = y * _width + x0;
+  auto count = x1 - x0;
+  switch (_precision) {
+    case HeightFieldPrecision::Float32:
+      memcpy(destination, &_floats[first], count * sizeof(float));
+      break;
+    case HeightFieldPrecision::Float16:
+      halfRowToFloat(&_halves[first], destination, count);
+      break;
+    case HeightFieldPrecision::Fixed16:
+      for (auto i = 0; i < count; ++i) {
+        destination[i] = _fixed[first + i] * _fixedPointScale;
+      }
+      break;
+  }
+}
+
+void HeightField::storeRow(int y, int x0, int x1, const float *source) {
+  auto first = y * _width + x0;
+  auto count = x1 - x0;
+  switch (_precision) {
+    case HeightFieldPrecision::Float32:
+      memcpy(&_floats[first], source, count * sizeof(float));
+      break;
+    case HeightFieldPrecision::Float16:
+      floatRowToHalf(source, &_halves[first], count);
+      break;
+    case HeightFieldPrecision::Fixed16:
+      for (auto i = 0; i < count; ++i) {
+        _fixed[first + i] = (int16_t)lrintf(
+            max(-32767.0f, min(32767.0f, source[i] * _invFixedPointScale)));
+      }
+      break;
+  }
+}
+
+const void *HeightField::getData(int x, int y) const {
+  auto index = y * _width + x;
+  switch (_precision) {
+    case HeightFieldPrecision::Float16:
+      return &_halves[index];
+    case HeightFieldPrecision::Fixed16:
+      return &_fixed[index];
+    default:
+      return &_floats[index];
+  }
+}
+
+void *HeightField::getData(int x, int y) {
+  return const_cast<void*>(
+      static_cast<const HeightField*>(this)->getData(x, y));
+}
+
+size_t HeightField::getSizeInBytes() const {
+  return _floats.size() * sizeof(float) + _halves.size() * sizeof(uint16_t)
+    + _fixed.size() * sizeof(int16_t);
+}
@@ -0,0 +1,58 @@
+#ifndef __HEIGHT_FIELD_HPP__
+#define __HEIGHT_FIELD_HPP__
+
+#include <cstdint>
+#include <vector>
+
+enum class HeightFieldPrecision {
+  Float32,
+  Float16,
+  Fixed16
+};
+
+float halfToFloat(std::uint16_t value);
+std::uint16_t floatToHalf(float value);
+
+// Row major grid of heights kept at the selected precision. Fixed point
+// samples cover [-fixedPointRange, fixedPointRange] and clamp outside of
+// it. Solvers work on float copies of rows taken with loadRow and written
+// back with storeRow, so the conversion happens once per sample and step.
+class HeightField {
+public:
+  HeightField();
+
+  void create(int width, int height, HeightFieldPrecision precision,
+      float fixedPointRange = 1.0f);
+  void clear();
+  void clearRect(int x0, int y0, int x1, int y1);
+
+  float get(int x, int y) const;
+  void set(int x, int y, float value);
+  void loadRow(int y, int x0, int x1, float *destination) const;
+  void storeRow(int y, int x0, int x1, const float *source);
+
+  // Raw samples starting at (x, y), rows getWidth() samples apart.
+  const void *getData(int x, int y) const;
+  void *getData(int x, int y);
+
+  inline int getWidth() const { return _width; }
+  inline int getHeight() const { return _height; }
+  inline HeightFieldPrecision getPrecision() const { return _precision; }
+  inline float getFixedPointRange() const { return _fixedPointRange; }
+  inline int getBytesPerSample() const {
+    return _precision == HeightFieldPrecision::Float32 ? 4 : 2;
+  }
+  std::size_t getSizeInBytes() const;
+
+private:
+  int _width, _height;
+  HeightFieldPrecision _precision;
+  float _fixedPointRange;
+  float _fixedPointScale, _invFixedPointScale;
+
+  std::vector<float> _floats;
+  std::vector<std::uint16_t> _halves;
+  std::vector<std::int16_t> _fixed;
+};
+
+#endif
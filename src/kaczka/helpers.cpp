@@ -1,11 +1,14 @@
 #include "helpers.hpp"
+#include "textureCompression.hpp"
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <SOIL/SOIL.h>
 
 using namespace std;
 
-void createPlane(float width, float length, GLuint &vao, GLuint &vbo,
-    GLuint &ebo)
+void createPlane(float width, float length, GLVertexArray &vao,
+    GLBuffer &vbo, GLBuffer &ebo)
 {
   float halfWidth = 0.5f * width;
   float halfLength = 0.5f * length;
@@ -19,16 +22,16 @@ void createPlane(float width, float length, GLuint &vao, GLuint &vbo,
 
   GLuint indices[] = { 0, 1, 2, 1, 3, 2 };
 
-  glGenVertexArrays(1, &vao);
-  glGenBuffers(1, &vbo);
-  glGenBuffers(1, &ebo);
+  vao = GLVertexArray::create();
+  vbo = GLBuffer::create();
+  ebo = GLBuffer::create();
 
-  glBindVertexArray(vao);
+  glBindVertexArray(vao.get());
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
   glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, 
       GL_STATIC_DRAW);
 
@@ -40,8 +43,99 @@ void createPlane(float width, float length, GLuint &vao, GLuint &vbo,
   glBindVertexArray(0);
 }
 
-void createSkybox(float size, GLuint &vao, GLuint &vbo, GLuint &ebo, 
-    GLuint &numIndices)
+static void appendGridChunkIndices(int resolution, int stride,
+    vector<GLuint> &indices) {
+  auto row = resolution + 1;
+  for (auto j = 0; j < resolution; j += stride) {
+    for (auto i = 0; i < resolution; i += stride) {
+      GLuint a = j * row + i;
+      GLuint b = j * row + i + stride;
+      GLuint c = (j + stride) * row + i;
+      GLuint d = (j + stride) * row + i + stride;
+      GLuint quad[] = { a, c, b, b, c, d };
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+
+  // Skirt vertices follow the grid, one run of resolution+1 per edge in
+  // counter-clockwise order so that skirts face out of the chunk.
+  auto skirtBase = row * row;
+  for (auto edge = 0; edge < 4; ++edge) {
+    for (auto k = 0; k < resolution; k += stride) {
+      GLuint edgeIndices[2], skirtIndices[2];
+      for (auto n = 0; n < 2; ++n) {
+        auto step = k + n * stride;
+        int u[] = { step, resolution, resolution - step, 0 };
+        int v[] = { 0, step, resolution, resolution - step };
+        edgeIndices[n] = v[edge] * row + u[edge];
+        skirtIndices[n] = skirtBase + edge * row + step;
+      }
+      GLuint quad[] = {
+        edgeIndices[0], edgeIndices[1], skirtIndices[0],
+        edgeIndices[1], skirtIndices[1], skirtIndices[0]
+      };
+      indices.insert(indices.end(), quad, quad + 6);
+    }
+  }
+}
+
+void createGridChunk(int resolution, int numLods, GLVertexArray &vao,
+    GLBuffer &vbo, GLBuffer &ebo, vector<GridLod> &lods) {
+  auto row = resolution + 1;
+  vector<GLfloat> vertices;
+  vertices.reserve(3 * (row * row + 4 * row));
+  for (auto j = 0; j <= resolution; ++j) {
+    for (auto i = 0; i <= resolution; ++i) {
+      vertices.push_back((float)i / resolution);
+      vertices.push_back((float)j / resolution);
+      vertices.push_back(0.0f);
+    }
+  }
+  for (auto edge = 0; edge < 4; ++edge) {
+    for (auto k = 0; k <= resolution; ++k) {
+      int u[] = { k, resolution, resolution - k, 0 };
+      int v[] = { 0, k, resolution, resolution - k };
+      vertices.push_back((float)u[edge] / resolution);
+      vertices.push_back((float)v[edge] / resolution);
+      vertices.push_back(1.0f);
+    }
+  }
+
+  vector<GLuint> indices;
+  lods.clear();
+  for (auto lod = 0, stride = 1; lod < numLods && stride <= resolution;
+      ++lod, stride *= 2) {
+    GridLod level;
+    level.firstIndex = indices.size();
+    appendGridChunkIndices(resolution, stride, indices);
+    level.numIndices = indices.size() - level.firstIndex;
+    lods.push_back(level);
+  }
+
+  vao = GLVertexArray::create();
+  vbo = GLBuffer::create();
+  ebo = GLBuffer::create();
+
+  glBindVertexArray(vao.get());
+
+  glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat),
+      &vertices[0], GL_STATIC_DRAW);
+
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
+      &indices[0], GL_STATIC_DRAW);
+
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), 
+      (GLvoid*)0);
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+}
+
+void createSkybox(float size, GLVertexArray &vao, GLBuffer &vbo,
+    GLBuffer &ebo, GLuint &numIndices)
 {
   float halfSize = size * 0.5f;
 
@@ -67,16 +161,16 @@ void createSkybox(float size, GLuint &vao, GLuint &vbo, GLuint &ebo,
   
   numIndices = 36;
 
-  glGenVertexArrays(1, &vao);
-  glGenBuffers(1, &vbo);
-  glGenBuffers(1, &ebo);
+  vao = GLVertexArray::create();
+  vbo = GLBuffer::create();
+  ebo = GLBuffer::create();
 
-  glBindVertexArray(vao);
+  glBindVertexArray(vao.get());
 
-  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo.get());
   glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo.get());
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, 
       GL_STATIC_DRAW);
 
@@ -109,47 +203,148 @@ GLenum glCheckError_(const char *file, int line)
     return errorCode;
 }
 
-GLuint loadTexture(string filename) {
+namespace {
+
+TextureStatistics gTextureStatistics = {};
+
+size_t getUncompressedSize(int width, int height, int numFaces,
+    int numLevels) {
+  size_t size = 0;
+  for (auto level = 0; level < numLevels; ++level) {
+    size += (size_t)4 * numFaces * max(1, width >> level)
+      * max(1, height >> level);
+  }
+  return size;
+}
+
+int getFullMipCount(int width, int height) {
+  auto numLevels = 1;
+  while (width >> numLevels > 0 || height >> numLevels > 0) {
+    ++numLevels;
+  }
+  return numLevels;
+}
+
+// Uploads every level of a compiled texture to the bound target, the six
+// cube faces for cubemaps. False when there is no usable file.
+bool uploadCompiledTexture(const string &path, GLenum target, int numFaces) {
+  CompressedTexture texture;
+  if (path.empty() || !loadKtx(path, texture)) {
+    return false;
+  }
+  if (texture.numFaces != numFaces) {
+    cerr << "texture " << path << " has " << texture.numFaces
+      << " faces instead of " << numFaces << endl;
+    return false;
+  }
+
+  auto compressed = GLEW_EXT_texture_compression_s3tc != 0;
+  vector<unsigned char> texels;
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (auto level = 0; level < texture.numLevels; ++level) {
+    auto width = texture.getLevelWidth(level);
+    auto height = texture.getLevelHeight(level);
+    auto faceSize = texture.getFaceSize(level);
+    for (auto face = 0; face < numFaces; ++face) {
+      auto faceTarget = numFaces == 6
+        ? GL_TEXTURE_CUBE_MAP_POSITIVE_X + face : target;
+      if (compressed) {
+        glCompressedTexImage2D(faceTarget, level, texture.format, width,
+            height, 0, (GLsizei)faceSize,
+            &texture.levels[level][face * faceSize]);
+      } else {
+        decompressTextureLevel(texture, level, face, texels);
+        glTexImage2D(faceTarget, level, GL_RGB8, width, height, 0, GL_RGB,
+            GL_UNSIGNED_BYTE, &texels[0]);
+      }
+    }
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(target, GL_TEXTURE_BASE_LEVEL, 0);
+  glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, texture.numLevels - 1);
+
+  auto uncompressedSize = getUncompressedSize(texture.width, texture.height,
+      numFaces, texture.numLevels);
+  gTextureStatistics.numCompressed += compressed ? 1 : 0;
+  gTextureStatistics.memoryBytes += compressed
+    ? texture.getTotalSize() : uncompressedSize;
+  gTextureStatistics.uncompressedBytes += uncompressedSize;
+  return true;
+}
+
+double getSecondsSince(const chrono::steady_clock::time_point &start) {
+  return chrono::duration<double>(chrono::steady_clock::now() - start)
+    .count();
+}
+
+}
+
+const TextureStatistics &getTextureStatistics() {
+  return gTextureStatistics;
+}
+
+GLTexture loadTexture(string filename, string compiledFilename) {
+  auto start = chrono::steady_clock::now();
+  auto texture = GLTexture::create();
+  glBindTexture(GL_TEXTURE_2D, texture.get());
+  if (uploadCompiledTexture(compiledFilename, GL_TEXTURE_2D, 1)) {
+    glBindTexture(GL_TEXTURE_2D, 0);
+    ++gTextureStatistics.numTextures;
+    gTextureStatistics.loadSeconds += getSecondsSince(start);
+    return texture;
+  }
+
   int width, height;
   unsigned char *image = SOIL_load_image(filename.c_str(), &width, &height, 0, 
       SOIL_LOAD_RGB);
 
   if (image == nullptr) {
     std::cerr << "Cannot load texture \"" << filename << "\"." << std::endl;
-    return -1;
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return GLTexture();
   }
 
-  GLuint texture;
-  glGenTextures(1, &texture);
-  glBindTexture(GL_TEXTURE_2D, texture);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, 
       GL_UNSIGNED_BYTE, image);
   glGenerateMipmap(GL_TEXTURE_2D);
   SOIL_free_image_data(image);
   glBindTexture(GL_TEXTURE_2D, 0);
 
+  auto size = getUncompressedSize(width, height, 1,
+      getFullMipCount(width, height));
+  ++gTextureStatistics.numTextures;
+  gTextureStatistics.memoryBytes += size;
+  gTextureStatistics.uncompressedBytes += size;
+  gTextureStatistics.loadSeconds += getSecondsSince(start);
   return texture;
 }
 
-GLuint loadCubemap(std::vector<std::string> faces) {
-	GLuint textureID;
-	glGenTextures(1, &textureID);
+GLTexture loadCubemap(std::vector<std::string> faces,
+    string compiledFilename) {
+  auto start = chrono::steady_clock::now();
+	auto texture = GLTexture::create();
 	glActiveTexture(GL_TEXTURE0);
 
-	int width, height;
+	int width = 0, height = 0;
 	unsigned char *image;
 
-	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-	for(GLuint i = 0; i < faces.size(); i++) {
-		image = SOIL_load_image(faces[i].c_str(), &width, &height, 
-			0, SOIL_LOAD_RGB);
-    if (!image) cerr << "cannot load image " << faces[i] << "reason: " 
-      << SOIL_last_result() << endl;
-		glTexImage2D(
-			GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-			GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-		);
-	}
+	glBindTexture(GL_TEXTURE_CUBE_MAP, texture.get());
+  if (!uploadCompiledTexture(compiledFilename, GL_TEXTURE_CUBE_MAP, 6)) {
+    for(GLuint i = 0; i < faces.size(); i++) {
+      image = SOIL_load_image(faces[i].c_str(), &width, &height, 
+        0, SOIL_LOAD_RGB);
+      if (!image) cerr << "cannot load image " << faces[i] << "reason: " 
+        << SOIL_last_result() << endl;
+      glTexImage2D(
+        GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
+        GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
+      );
+      SOIL_free_image_data(image);
+    }
+    auto size = getUncompressedSize(width, height, 6, 1);
+    gTextureStatistics.memoryBytes += size;
+    gTextureStatistics.uncompressedBytes += size;
+  }
 
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -158,5 +353,7 @@ GLuint loadCubemap(std::vector<std::string> faces) {
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
 
-	return textureID;
+  ++gTextureStatistics.numTextures;
+  gTextureStatistics.loadSeconds += getSecondsSince(start);
+	return texture;
 }  
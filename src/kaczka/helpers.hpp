@@ -1,17 +1,46 @@
 #ifndef __HELPERS_HPP__
 #define __HELPERS_HPP__
 
+#include "glHandles.hpp"
+
 #include <gl/glew.h>
 #include <string>
 #include <vector>
 
-void createPlane(float width, float length, GLuint &vao, GLuint &vbo,
-    GLuint &ebo);
-void createSkybox(float size, GLuint &vao, GLuint &vbo, GLuint &ebo, 
-    GLuint &numIndices);
+struct GridLod {
+  GLuint firstIndex;
+  GLuint numIndices;
+};
+
+// Names already held by the handles are deleted and replaced.
+void createPlane(float width, float length, GLVertexArray &vao,
+    GLBuffer &vbo, GLBuffer &ebo);
+void createGridChunk(int resolution, int numLods, GLVertexArray &vao,
+    GLBuffer &vbo, GLBuffer &ebo, std::vector<GridLod> &lods);
+void createSkybox(float size, GLVertexArray &vao, GLBuffer &vbo,
+    GLBuffer &ebo, GLuint &numIndices);
+
+// Textures come from the KTX file compiled by kaczka-texture when there is
+// one, uploaded as it is, or decompressed when the driver lacks the
+// format. Without it the source images are loaded and converted.
+// An empty handle when nothing can be loaded.
+GLTexture loadTexture(std::string filename,
+    std::string compiledFilename = "");
+GLTexture loadCubemap(std::vector<std::string> faces,
+    std::string compiledFilename = "");
+
+struct TextureStatistics {
+  int numTextures;
+  int numCompressed;
+  // Estimates, with RGB8 texels taking 4 bytes as they do with most
+  // drivers.
+  std::size_t memoryBytes;
+  std::size_t uncompressedBytes;
+  double loadSeconds;
+};
 
-GLuint loadTexture(std::string filename);
-GLuint loadCubemap(std::vector<std::string> faces);
+// Totals of every texture loaded above.
+const TextureStatistics &getTextureStatistics();
 
 GLenum glCheckError_(const char *file, int line);
 #define glCheckError() glCheckError_(__FILE__, __LINE__) 
@@ -0,0 +1,156 @@
+#include "jobScheduler.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+// Jobs that do not fit into a full queue run right away instead.
+static const int cQueueCapacity = 4096;
+
+static JobScheduler *gGlobalScheduler = nullptr;
+static thread_local JobScheduler *tCurrentScheduler = nullptr;
+static thread_local int tQueueIndex = 0;
+
+JobScheduler::JobScheduler(int numWorkers) : _running(true), _queuedJobs(0) {
+  if (numWorkers < 0) {
+    numWorkers = max(1u, thread::hardware_concurrency()) - 1;
+  }
+
+  // Queue 0 is shared by all threads outside of the pool.
+  for (auto i = 0; i <= numWorkers; ++i) {
+    unique_ptr<JobQueue> queue(new JobQueue());
+    queue->jobs.resize(cQueueCapacity);
+    queue->first = 0;
+    queue->count = 0;
+    _queues.push_back(move(queue));
+  }
+
+  for (auto i = 1; i <= numWorkers; ++i) {
+    _workers.push_back(thread(&JobScheduler::workerLoop, this, i));
+  }
+}
+
+JobScheduler::~JobScheduler() {
+  _running.store(false);
+  _wakeCondition.notify_all();
+  for (auto &worker : _workers) {
+    worker.join();
+  }
+
+  if (gGlobalScheduler == this) {
+    gGlobalScheduler = nullptr;
+  }
+}
+
+void JobScheduler::setGlobal(JobScheduler *scheduler) {
+  gGlobalScheduler = scheduler;
+}
+
+JobScheduler *JobScheduler::getGlobal() {
+  return gGlobalScheduler;
+}
+
+void JobScheduler::submit(JobFunction function, void *context, int begin,
+    int end, JobCounter &counter) {
+  Job job = { function, context, begin, end, &counter };
+  counter.remaining.fetch_add(1, memory_order_relaxed);
+
+  if (!pushJob(getQueueIndex(), job)) {
+    runJob(job);
+    return;
+  }
+  _wakeCondition.notify_one();
+}
+
+void JobScheduler::wait(JobCounter &counter) {
+  auto queueIndex = getQueueIndex();
+  while (counter.remaining.load(memory_order_acquire) > 0) {
+    Job job;
+    if (findJob(queueIndex, job)) {
+      runJob(job);
+    } else {
+      this_thread::yield();
+    }
+  }
+}
+
+void JobScheduler::workerLoop(int queueIndex) {
+  tCurrentScheduler = this;
+  tQueueIndex = queueIndex;
+
+  while (_running.load(memory_order_acquire)) {
+    Job job;
+    if (findJob(queueIndex, job)) {
+      runJob(job);
+      continue;
+    }
+
+    // Submitting does not take the sleep mutex, so a wake up can be
+    // missed; the timeout bounds how long that delays a job.
+    unique_lock<mutex> lock(_sleepMutex);
+    _wakeCondition.wait_for(lock, chrono::milliseconds(1), [this]() {
+      return _queuedJobs.load() > 0 || !_running.load();
+    });
+  }
+}
+
+int JobScheduler::getQueueIndex() {
+  return tCurrentScheduler == this ? tQueueIndex : 0;
+}
+
+bool JobScheduler::pushJob(int queueIndex, const Job &job) {
+  auto &queue = *_queues[queueIndex];
+  lock_guard<mutex> lock(queue.mutex);
+  if (queue.count == cQueueCapacity) {
+    return false;
+  }
+  queue.jobs[(queue.first + queue.count) % cQueueCapacity] = job;
+  ++queue.count;
+  _queuedJobs.fetch_add(1, memory_order_release);
+  return true;
+}
+
+bool JobScheduler::popJob(int queueIndex, Job &job) {
+  auto &queue = *_queues[queueIndex];
+  lock_guard<mutex> lock(queue.mutex);
+  if (queue.count == 0) {
+    return false;
+  }
+  --queue.count;
+  job = queue.jobs[(queue.first + queue.count) % cQueueCapacity];
+  _queuedJobs.fetch_sub(1, memory_order_relaxed);
+  return true;
+}
+
+bool JobScheduler::stealJob(int queueIndex, Job &job) {
+  auto &queue = *_queues[queueIndex];
+  lock_guard<mutex> lock(queue.mutex);
+  if (queue.count == 0) {
+    return false;
+  }
+  job = queue.jobs[queue.first];
+  queue.first = (queue.first + 1) % cQueueCapacity;
+  --queue.count;
+  _queuedJobs.fetch_sub(1, memory_order_relaxed);
+  return true;
+}
+
+bool JobScheduler::findJob(int queueIndex, Job &job) {
+  if (popJob(queueIndex, job)) {
+    return true;
+  }
+
+  int numQueues = _queues.size();
+  for (auto i = 1; i < numQueues; ++i) {
+    if (stealJob((queueIndex + i) % numQueues, job)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void JobScheduler::runJob(const Job &job) {
+  job.function(job.context, job.begin, job.end);
+  job.counter->remaining.fetch_sub(1, memory_order_release);
+}
@@ -0,0 +1,73 @@
+#ifndef __JOB_SCHEDULER_HPP__
+#define __JOB_SCHEDULER_HPP__
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void (*JobFunction)(void *context, int begin, int end);
+
+// Counts submitted jobs that have not finished yet.
+struct JobCounter {
+  std::atomic<int> remaining;
+  JobCounter() : remaining(0) {}
+};
+
+struct Job {
+  JobFunction function;
+  void *context;
+  int begin, end;
+  JobCounter *counter;
+};
+
+// Work stealing thread pool. Every worker pops the newest job of its own
+// queue and steals the oldest ones of the others when it runs dry; jobs
+// from threads outside of the pool go to a shared queue. Waiting for a
+// counter runs queued jobs meanwhile, so jobs may submit and wait for
+// jobs of their own.
+class JobScheduler {
+public:
+  // A negative count starts one worker less than there are cores, which
+  // leaves one for the thread that submits and waits.
+  explicit JobScheduler(int numWorkers = -1);
+  ~JobScheduler();
+
+  void submit(JobFunction function, void *context, int begin, int end,
+      JobCounter &counter);
+  void wait(JobCounter &counter);
+
+  // Workers plus the waiting thread.
+  inline int getNumThreads() const { return (int)_workers.size() + 1; }
+
+  // Scheduler used by parallelFor, none by default.
+  static void setGlobal(JobScheduler *scheduler);
+  static JobScheduler *getGlobal();
+
+protected:
+  struct JobQueue {
+    std::mutex mutex;
+    std::vector<Job> jobs;
+    int first, count;
+  };
+
+  void workerLoop(int queueIndex);
+  int getQueueIndex();
+  bool pushJob(int queueIndex, const Job &job);
+  bool popJob(int queueIndex, Job &job);
+  bool stealJob(int queueIndex, Job &job);
+  bool findJob(int queueIndex, Job &job);
+  void runJob(const Job &job);
+
+private:
+  std::vector<std::unique_ptr<JobQueue>> _queues;
+  std::vector<std::thread> _workers;
+  std::atomic<bool> _running;
+  std::atomic<int> _queuedJobs;
+  std::mutex _sleepMutex;
+  std::condition_variable _wakeCondition;
+};
+
+#endif
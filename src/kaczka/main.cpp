@@ -1,7 +1,9 @@
 #include <algorithm>
+#include <cassert>
 #include <random>
 #include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
@@ -9,27 +11,142 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/constants.hpp>
 
+#include "allocationCounter.hpp"
+#include "allocators.hpp"
+#include "checkpoint.hpp"
 #include "config.hpp"
+#include "duckBatch.hpp"
+#include "environmentMap.hpp"
+#include "frameGovernor.hpp"
+#include "glHandles.hpp"
+#include "gpuTimer.hpp"
 #include "helpers.hpp"
 #include "mesh.hpp"
+#include "metrics.hpp"
 #include "orbitingCamera.hpp"
+#include "renderQueue.hpp"
 #include "shaders.hpp"
 #include "splines.hpp"
+#include "transformBatch.hpp"
 #include "waterSurface.hpp"
+#include "waterWorld.hpp"
 
 using namespace std;
 
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
 
+struct DuckScene {
+  GLuint program;
+  Mesh *mesh;
+  DuckBatch *ducks;
+  TransformBatch *transforms;
+  float scale;
+  // Screen radius of a unit sphere at unit distance.
+  float pixelsPerUnit;
+  float lodError;
+};
+
+struct Skybox {
+  GLuint program;
+  GLuint vao;
+  GLuint numIndices;
+};
+
+// Everything besides the water that a checkpoint needs to continue the
+// scene as it was.
+struct SceneState {
+  WaterWorld *waterWorld;
+  std::mt19937 *generator;
+  BSpline2D *spline;
+  DuckBatch *ducks;
+  double *duckParameter;
+  float *dropSinceLastTime;
+  const FrameGovernor *governor;
+};
+
+void applyQualityLevel(const QualityLevel &level, WaterSurface &surface,
+    DuckScene &duckScene, RenderQueue &renderQueue,
+    const std::vector<int> &duckObjects);
+void logGovernorDecision(const FrameGovernor &governor);
+void updateMetrics(MetricsSnapshot &metrics, WaterWorld &waterWorld,
+    const FrameGovernor &governor, int numDucks, int drawCalls,
+    double frameTime);
+
+bool saveCheckpoint(const char *path, SceneState &scene);
+// The quality level has to be applied before the rest is restored, so the
+// restored grid and ducks are not resampled or cut to another level.
+int getCheckpointQualityLevel(const Checkpoint &checkpoint, int fallback);
+bool restoreCheckpoint(const char *path, const Checkpoint &checkpoint,
+    SceneState &scene);
+
+void setupDuckProgram(void *context, int index, const RenderView &view);
+void drawDuck(void *context, int index, const RenderView &view);
+void setupSkyboxProgram(void *context, int index, const RenderView &view);
+void drawSkybox(void *context, int index, const RenderView &view);
+void drawWaterSurface(void *context, int index, const RenderView &view);
+
 const GLuint WIDTH = 800, HEIGHT = 600;
+const bool cQuantizeDuckAttributes = true;
+const WaterSimulationMode cWaterSimulationMode =
+  WaterSimulationMode::FiniteDifference;
+const float cWaterRefinementRadius = 3.0f;
+const int cWaterSubsteps = 1;
+const bool cWaterSimulationThread = true;
+// Heights of every cWaterCaptureInterval-th step go to this file when set,
+// read it with kaczka-capture.
+const char *const cWaterCapturePath = nullptr;
+const int cWaterCaptureInterval = 4;
+// F5 saves the scene here; it is restored on start when the file exists.
+const char *const cCheckpointPath = "pool.checkpoint";
+const bool cWarmStartFromCheckpoint = true;
+const HeightFieldPrecision cWaterHeightPrecision =
+  HeightFieldPrecision::Float16;
+const NormalMapFormat cWaterNormalMapFormat = NormalMapFormat::RG8;
+const bool cPrefilteredWaterReflections = true;
+const float cWaterRoughness = 0.05f;
+const int cNumDucks = 8;
+const float cDuckHullRadius = 0.3f;
+const float cDuckFootprintStrength = 0.01f;
+const size_t cFrameArenaSize = 256 * 1024;
+const int cAllocationWarmupFrames = 120;
+// [ and ] change the pool resolution by hand while the governor is off.
+const int cMinPoolResolution = 64;
+const int cMaxPoolResolution = 1024;
+const bool cFrameBudgetGovernor = true;
+const float cTargetFrameTime = 1.0f / 60.0f;
+// Finer grids take more substeps, so waves cross the pool at about the
+// same speed. The second level is the one the scene starts at, unless it
+// warm starts from a checkpoint saved at another.
+const std::vector<QualityLevel> cQualityLevels = {
+  { 512, 2, 0.5f, cNumDucks },
+  { 256, 1, 1.0f, cNumDucks },
+  { 256, 1, 2.0f, 6 },
+  { 128, 1, 4.0f, 6 },
+  { 128, 1, 8.0f, 4 }
+};
+const int cStartQualityLevel = 1;
+// Counters of the running scene are published here every frame, read
+// them with kaczka-metrics. Null turns publishing off.
+const char *const cMetricsSegmentName = "/kaczka-metrics";
 
 OrbitingCamera camera;
 
 int main()
 {
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  // Declared before any GL object, so it goes last, once every handle was
+  // deleted while the context still existed.
+  struct GlfwSession {
+    ~GlfwSession() {
+      checkGLHandleLeaks();
+      glfwTerminate();
+    }
+  } glfwSession;
+  // Gpu water needs compute shaders. Without a 4.3 context the water
+  // falls back to the CPU solver.
+  auto gpuWater = cWaterSimulationMode == WaterSimulationMode::Gpu;
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, gpuWater ? 4 : 3);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
   glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
   glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -37,6 +154,10 @@ int main()
 
   GLFWwindow *window = glfwCreateWindow(WIDTH, HEIGHT, "Kaczka", 
       nullptr, nullptr);
+  if (!window && gpuWater) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    window = glfwCreateWindow(WIDTH, HEIGHT, "Kaczka", nullptr, nullptr);
+  }
   glfwMakeContextCurrent(window);
 
   glfwSetKeyCallback(window, key_callback);
@@ -45,13 +166,15 @@ int main()
   glewExperimental = GL_TRUE;
   glewInit();
 
-  GLuint woodTexture = loadTexture(ASSETS_PATH_PREFIX"textures/ducktex.jpg");
+  auto woodTexture = loadTexture(ASSETS_PATH_PREFIX"textures/ducktex.jpg",
+      COMPILED_ASSETS_PATH_PREFIX"textures/ducktex.ktx");
 
   int framebufferWidth, framebufferHeight;
   glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);  
   glViewport(0, 0, framebufferWidth, framebufferHeight);
 
-  VertexShader vertexShader(SHADER_PATH_PREFIX"duck.vert");
+  VertexShader vertexShader(cQuantizeDuckAttributes
+      ? SHADER_PATH_PREFIX"duckPacked.vert" : SHADER_PATH_PREFIX"duck.vert");
   FragmentShader fragmentShader(SHADER_PATH_PREFIX"duck.frag");
   ShaderProgram program;
   program.attach(&vertexShader);
@@ -65,9 +188,22 @@ int main()
   cubeProgram.attach(&cubeFragmentShader);
   cubeProgram.link();
 
-  Mesh duck(ASSETS_PATH_PREFIX"meshes/duck.mesh");
-  WaterSurface waterSurface;
+  JobScheduler jobScheduler;
+  JobScheduler::setGlobal(&jobScheduler);
+  Mesh duck(ASSETS_PATH_PREFIX"meshes/duck.mesh", cQuantizeDuckAttributes);
+  WaterWorld waterWorld(jobScheduler);
+  auto &waterSurface = waterWorld.addSurface();
+  waterSurface.setStorageFormat(cWaterHeightPrecision, cWaterNormalMapFormat);
   waterSurface.create(10.0f, 10.0f, 256, 256);
+  waterSurface.setSimulationMode(cWaterSimulationMode);
+  waterSurface.setSubsteps(cWaterSubsteps);
+  if (cWaterCapturePath) {
+    waterSurface.startCapture(cWaterCapturePath, cWaterCaptureInterval);
+  }
+  if (cWaterSimulationThread &&
+      waterSurface.getSimulationMode() != WaterSimulationMode::Gpu) {
+    waterSurface.startSimulationThread();
+  }
 
   double previousTime = glfwGetTime();
   double currentTime = glfwGetTime();
@@ -80,6 +216,7 @@ int main()
 
   glEnable(GL_DEPTH_TEST);
   glEnable(GL_CULL_FACE);
+  glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
   const float cDropTime = 0.05f;
   float dropSinceLastTime = 0.0f;
@@ -89,7 +226,9 @@ int main()
   uniform_real_distribution<float> randomReal(-1, 1);
   uniform_real_distribution<float> randomDropPower(0.05f, 0.5f);
 
-  GLuint cubeVAO, cubeVBO, cubeEBO, numIndices;
+  GLVertexArray cubeVAO;
+  GLBuffer cubeVBO, cubeEBO;
+  GLuint numIndices;
   createSkybox(10.0f, cubeVAO, cubeVBO, cubeEBO, numIndices);
 
 	std::vector<std::string> cubeMapFilenames;
@@ -99,9 +238,26 @@ int main()
 	cubeMapFilenames.push_back(ASSETS_PATH_PREFIX"textures/fullbluetiles.png");
 	cubeMapFilenames.push_back(ASSETS_PATH_PREFIX"textures/halftiles.png");
 	cubeMapFilenames.push_back(ASSETS_PATH_PREFIX"textures/halftiles.png");
-  loadTexture(cubeMapFilenames[0]);
-	GLuint cubemap = loadCubemap(cubeMapFilenames);
-  waterSurface.setCubemap(cubemap);
+	auto cubemap = loadCubemap(cubeMapFilenames,
+      COMPILED_ASSETS_PATH_PREFIX"textures/pool.ktx");
+  auto &textureStatistics = getTextureStatistics();
+  cout << "Loaded " << textureStatistics.numTextures << " textures ("
+    << textureStatistics.numCompressed << " compressed) in "
+    << textureStatistics.loadSeconds * 1000.0 << " ms, "
+    << textureStatistics.memoryBytes / 1024 << " KiB of texture memory, "
+    << textureStatistics.uncompressedBytes / 1024 << " KiB uncompressed."
+    << endl;
+  waterSurface.setCubemap(cubemap.get());
+  waterSurface.setRoughness(cWaterRoughness);
+  GLTexture environment;
+  if (cPrefilteredWaterReflections) {
+    int environmentLevels;
+    environment = createPrefilteredCubemap(cubeMapFilenames,
+        ASSETS_PATH_PREFIX"textures/skybox.prefiltered", environmentLevels);
+    if (environment) {
+      waterSurface.setCubemap(environment.get(), environmentLevels);
+    }
+  }
 
   BSpline2D spline;
   vector<glm::vec2> controlPoints;
@@ -113,12 +269,91 @@ int main()
   }
   spline.setLoopedControlPoints(controlPoints);
 
+  DuckBatch ducks;
+  ducks.resize(cNumDucks);
+  ducks.hullRadius = cDuckHullRadius;
+  TransformBatch duckTransforms;
+  duckTransforms.resize(cNumDucks);
+
   camera.rotate(glm::radians(30.0f), glm::radians(45.0f));
   camera.setDist(7.0f);
 
+  auto projMatrix = glm::perspective(glm::radians(90.0f), 
+      (float)WIDTH/HEIGHT, 0.1f, 100.0f);
+
+  DuckScene duckScene;
+  duckScene.program = program.getId();
+  duckScene.mesh = &duck;
+  duckScene.ducks = &ducks;
+  duckScene.transforms = &duckTransforms;
+  duckScene.scale = 0.005f;
+  duckScene.pixelsPerUnit = projMatrix[1][1] * 0.5f * framebufferHeight;
+  duckScene.lodError = 1.0f;
+
+  Skybox skybox = { cubeProgram.getId(), cubeVAO.get(), numIndices };
+
+  RenderQueue renderQueue;
+  renderQueue.setProgramSetup(program.getId(), setupDuckProgram, &duckScene);
+  renderQueue.setProgramSetup(cubeProgram.getId(), setupSkyboxProgram,
+      &skybox);
+  vector<int> duckObjects;
+  for (auto i = 0; i < cNumDucks; ++i) {
+    duckObjects.push_back(renderQueue.add({RenderLayer::Opaque,
+          program.getId(), GL_TEXTURE_2D, woodTexture.get(), drawDuck,
+          &duckScene, i}));
+  }
+  renderQueue.add({RenderLayer::Sky, cubeProgram.getId(),
+      GL_TEXTURE_CUBE_MAP, cubemap.get(), drawSkybox, &skybox, 0});
+  for (auto i = 0; i < waterWorld.getNumSurfaces(); ++i) {
+    auto &surface = waterWorld.getSurface(i);
+    auto id = renderQueue.add({RenderLayer::Opaque, 0, 0, 0,
+        drawWaterSurface, &surface, 0});
+    glm::vec3 minimum, maximum;
+    surface.getBounds(minimum, maximum);
+    renderQueue.setBounds(id, minimum, maximum);
+  }
+
+  LinearArena frameArena(cFrameArenaSize);
+  auto frame = 0;
+
+  Checkpoint checkpoint;
+  auto warmStart = cWarmStartFromCheckpoint &&
+    checkpoint.open(cCheckpointPath);
+  FrameGovernor governor;
+  GpuTimer renderTimer;
+  if (cFrameBudgetGovernor) {
+    auto startLevel = warmStart
+      ? getCheckpointQualityLevel(checkpoint, cStartQualityLevel)
+      : cStartQualityLevel;
+    governor.create(cQualityLevels, startLevel, cTargetFrameTime);
+    applyQualityLevel(governor.getLevel(), waterSurface, duckScene,
+        renderQueue, duckObjects);
+    renderTimer.create();
+  }
+
   double duckParameter = 0.0f;
+  SceneState scene = {
+    &waterWorld, &generator, &spline, &ducks, &duckParameter,
+    &dropSinceLastTime, &governor
+  };
+  if (warmStart) {
+    restoreCheckpoint(cCheckpointPath, checkpoint, scene);
+    checkpoint.close();
+  }
+
+  MetricsPublisher metricsPublisher;
+  MetricsSnapshot metrics = {};
+  if (cMetricsSegmentName) {
+    metricsPublisher.open(cMetricsSegmentName);
+  }
+
+  auto savePressed = false;
+  auto shrinkPressed = false, growPressed = false;
   while (!glfwWindowShouldClose(window))
   {
+      frameArena.reset();
+      auto frameAllocations = getAllocationCount();
+
       previousTime = currentTime;
       currentTime = glfwGetTime();
       double deltaTime = currentTime - previousTime;
@@ -149,85 +384,313 @@ int main()
         dropSinceLastTime -= cDropTime;
       }
       
-      waterSurface.update(deltaTime);
+      // Ducks follow each other along the spline, evenly spaced, the gaps
+      // of the ducks a lower quality level leaves out stay empty.
+      for (auto i = 0; i < ducks.size(); ++i) {
+        auto parameter = duckParameter + (double)i / cNumDucks;
+        parameter -= (int)parameter;
+        auto splinePosition = spline.evaluate(parameter);
+        auto splineDerivative = spline.derivative(parameter);
+        ducks.x[i] = splinePosition.x;
+        ducks.z[i] = splinePosition.y;
+        // Ducks face down the tangent, their x axis points back along it.
+        auto tangentLength = glm::length(splineDerivative);
+        if (tangentLength > 1e-6f) {
+          ducks.headingX[i] = -splineDerivative.x / tangentLength;
+          ducks.headingZ[i] = -splineDerivative.y / tangentLength;
+        }
+      }
+
+      FrameTimings timings;
+      auto phaseStart = glfwGetTime();
+      waterSurface.sampleDucks(ducks, frameArena);
+      updateDuckBuoyancy(ducks, deltaTime);
+      waterSurface.splatDucks(ducks, cDuckFootprintStrength);
+
+      waterSurface.setRefinementFocus(camera.getPosition(),
+          cWaterRefinementRadius);
+      waterWorld.update(deltaTime);
+      auto phaseEnd = glfwGetTime();
+      timings.simulation = (float)(phaseEnd - phaseStart);
       
       glfwPollEvents();
+      phaseStart = glfwGetTime();
+      renderTimer.begin();
       glClearColor(0.2f, 0.3f, 0.3f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-      glUseProgram(program.getId());
-
       if (glfwGetMouseButton(window, GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS) {
         camera.rotate(-mouseDeltaY, mouseDeltaX);
       }
 
-      float duckScale = 0.005f;
-
-      auto viewMatrix = camera.getViewMatrix();
-      auto projMatrix = glm::perspective(glm::radians(90.0f), 
-          (float)WIDTH/HEIGHT, 0.1f, 100.0f);
+      buildDuckTransforms(ducks, duckScene.scale, duckTransforms);
+      for (auto i = 0; i < ducks.size(); ++i) {
+        auto center = transformPoint(duckTransforms.getMatrix(i),
+            duck.getBoundingCenter());
+        renderQueue.setBoundingSphere(duckObjects[i], center,
+            duck.getBoundingRadius() * duckScene.scale);
+      }
 
-      auto splinePosition = spline.evaluate(duckParameter);
-      auto splineDerivative = spline.derivative(duckParameter);
-      auto duckPosition = glm::vec3(splinePosition.x, 0.0f, splinePosition.y);
-      float rotation = atan2f(-splineDerivative.y, splineDerivative.x)
-        + glm::pi<float>();
-      waterSurface.applyDisturbaceInWorldSpace(duckPosition, 0.5f);
-      
-      auto modelMatrix = glm::translate(glm::mat4(1.0f), duckPosition); 
-      modelMatrix = glm::scale(modelMatrix, 
-          glm::vec3(duckScale, duckScale, duckScale));
-      modelMatrix = glm::rotate(modelMatrix, rotation,
-          glm::vec3(0.0f, 1.0f, 0.0f));
-      
-      auto viewProj = projMatrix * viewMatrix;
+      RenderView view;
+      view.viewProj = projMatrix * camera.getViewMatrix();
+      view.cameraPosition = camera.getPosition();
+      view.frameArena = &frameArena;
+      auto drawCalls = 0;
+      view.drawCalls = &drawCalls;
+      renderQueue.draw(view);
+      renderTimer.end();
+      timings.render = (float)(glfwGetTime() - phaseStart);
+      if (!renderTimer.read(timings.gpu)) {
+        timings.gpu = 0.0f;
+      }
 
-      GLuint transformLoc = glGetUniformLocation(program.getId(), "viewProj");
-      GLuint modelMatrixLocation = glGetUniformLocation(program.getId(),
-          "modelMatrix");
+      glfwSwapBuffers(window);
 
-      glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(viewProj));
-      glUniformMatrix4fv(modelMatrixLocation, 1, GL_FALSE,
-          glm::value_ptr(modelMatrix));
+      if (metricsPublisher.isOpen()) {
+        updateMetrics(metrics, waterWorld, governor, ducks.size(), drawCalls,
+            deltaTime);
+        metricsPublisher.publish(metrics);
+      }
 
-      glUniform3fv(
-          glGetUniformLocation(program.getId(), "cameraPosition"),
-          1, 
-          glm::value_ptr(camera.getPosition())
-      );
+      // Once warmed up, the frame loop must not touch the heap. Always zero
+      // unless built with KACZKA_COUNT_ALLOCATIONS.
+      frameAllocations = getAllocationCount() - frameAllocations;
+      if (frame >= cAllocationWarmupFrames && frameAllocations > 0) {
+        cerr << "Frame " << frame << " made " << frameAllocations
+          << " heap allocations." << endl;
+        assert(frameAllocations == 0);
+      }
+      ++frame;
 
-      glUniform3fv(
-          glGetUniformLocation(program.getId(), "lightPosition"),
-          1,
-          glm::value_ptr(glm::vec3(0.0f, 0.0f, 0.0f))
-      );
+      // Saving allocates, so it happens after the frame was counted.
+      auto saveKey = glfwGetKey(window, GLFW_KEY_F5) == GLFW_PRESS;
+      if (saveKey && !savePressed) {
+        saveCheckpoint(cCheckpointPath, scene);
+      }
+      savePressed = saveKey;
 
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, woodTexture);
-      duck.draw();
-
-			glUseProgram(cubeProgram.getId());
-      transformLoc = glGetUniformLocation(cubeProgram.getId(), "viewProj");
-      modelMatrixLocation = glGetUniformLocation(cubeProgram.getId(),
-          "modelMatrix");
-      glUniformMatrix4fv(transformLoc, 1, GL_FALSE, glm::value_ptr(viewProj));
-      glUniformMatrix4fv(modelMatrixLocation, 1, GL_FALSE, 
-          glm::value_ptr(glm::mat4(1.0f)));
-      glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemap);
-      glBindVertexArray(cubeVAO);
-      glDrawElements(GL_TRIANGLES, numIndices, GL_UNSIGNED_INT, 0);
-      glBindVertexArray(0);
-
-      waterSurface.draw(viewProj, camera.getPosition());
+      // Resizing the pool allocates too.
+      if (cFrameBudgetGovernor && governor.update(frame, timings)) {
+        logGovernorDecision(governor);
+        applyQualityLevel(governor.getLevel(), waterSurface, duckScene,
+            renderQueue, duckObjects);
+      }
 
-      glfwSwapBuffers(window);
+      // [ and ] halve and double the pool resolution in place.
+      auto shrinkKey = glfwGetKey(window, GLFW_KEY_LEFT_BRACKET) == GLFW_PRESS;
+      auto growKey = glfwGetKey(window, GLFW_KEY_RIGHT_BRACKET) == GLFW_PRESS;
+      auto resolution = waterSurface.getSamplesTextureWidth();
+      if (cFrameBudgetGovernor) {
+        shrinkKey = growKey = false;
+      }
+      if (shrinkKey && !shrinkPressed && resolution > cMinPoolResolution) {
+        waterSurface.resize(10.0f, 10.0f, resolution / 2, resolution / 2);
+      }
+      if (growKey && !growPressed && resolution < cMaxPoolResolution) {
+        waterSurface.resize(10.0f, 10.0f, resolution * 2, resolution * 2);
+      }
+      shrinkPressed = shrinkKey;
+      growPressed = growKey;
   }
 
-  glfwTerminate();
   return 0;
 }
 
+// Ducks past the level's count are dropped from the batch, so they are
+// neither sampled nor splatted, and come back at rest on the surface.
+void applyQualityLevel(const QualityLevel &level, WaterSurface &surface,
+    DuckScene &duckScene, RenderQueue &renderQueue,
+    const vector<int> &duckObjects) {
+  if (surface.getSamplesTextureWidth() != level.gridResolution ||
+      surface.getSamplesTextureHeight() != level.gridResolution) {
+    surface.resize(10.0f, 10.0f, level.gridResolution, level.gridResolution);
+  }
+  surface.setSubsteps(level.substeps);
+  duckScene.lodError = level.duckLodError;
+  duckScene.ducks->resize(level.numDucks);
+  duckScene.transforms->resize(level.numDucks);
+  for (auto i = 0; i < (int)duckObjects.size(); ++i) {
+    renderQueue.setEnabled(duckObjects[i], i < level.numDucks);
+  }
+}
+
+void updateMetrics(MetricsSnapshot &metrics, WaterWorld &waterWorld,
+    const FrameGovernor &governor, int numDucks, int drawCalls,
+    double frameTime) {
+  uint64_t steps = 0, uploadedBytes = 0;
+  auto activeTiles = 0;
+  metrics.stepTime = MetricsHistogram();
+  for (auto i = 0; i < waterWorld.getNumSurfaces(); ++i) {
+    const auto &stats = waterWorld.getStats(i);
+    auto &surface = waterWorld.getSurface(i);
+    steps += surface.getSolverSteps();
+    activeTiles += stats.activeTiles;
+    uploadedBytes += surface.getUploadedBytes();
+    addMetricsHistogram(metrics.stepTime, stats.stepTime);
+  }
+  if (metrics.frames > 0) {
+    addMetricsSample(metrics.frameTime, frameTime);
+  }
+
+  ++metrics.frames;
+  metrics.simulationSteps = steps;
+  metrics.uploadedBytes = uploadedBytes;
+  metrics.drawCalls += drawCalls;
+  metrics.allocations = getAllocationCount();
+  metrics.countsAllocations = isCountingAllocations();
+  metrics.activeTiles = activeTiles;
+  metrics.qualityLevel = governor.getNumLevels() > 0
+    ? governor.getLevelIndex() : -1;
+  metrics.gridResolution =
+    waterWorld.getSurface(0).getSamplesTextureWidth();
+  metrics.numDucks = numDucks;
+}
+
+void logGovernorDecision(const FrameGovernor &governor) {
+  const auto &decision = governor.getLastDecision();
+  const auto &level = governor.getLevel();
+  cout << "Frame " << decision.frame << ": quality level "
+    << decision.fromLevel << " -> " << decision.toLevel << ", "
+    << decision.reason << " at " << decision.frameTime * 1000.0f
+    << " ms of " << governor.getTargetFrameTime() * 1000.0f << " ms. Grid "
+    << level.gridResolution << ", " << level.substeps << " substeps, duck "
+    << "LOD error " << level.duckLodError << " px, " << level.numDucks
+    << " ducks." << endl;
+}
+
+static const uint32_t cGeneratorTag = makeCheckpointTag('S','R','N','G');
+static const uint32_t cSplineTag = makeCheckpointTag('S','S','P','L');
+static const uint32_t cSceneTimeTag = makeCheckpointTag('S','T','I','M');
+static const uint32_t cDuckHeightTag = makeCheckpointTag('S','D','K','Y');
+static const uint32_t cDuckVelocityTag = makeCheckpointTag('S','D','K','V');
+static const uint32_t cQualityLevelTag = makeCheckpointTag('S','Q','L','V');
+
+struct SceneTime {
+  double duckParameter;
+  float dropSinceLastTime;
+};
+
+bool saveCheckpoint(const char *path, SceneState &scene) {
+  CheckpointWriter writer;
+  scene.waterWorld->saveCheckpoint(writer);
+
+  // The standard only defines the generator state in its text form.
+  ostringstream generatorState;
+  generatorState << *scene.generator;
+  auto generatorText = generatorState.str();
+  writer.add(cGeneratorTag, 0, generatorText.data(), generatorText.size());
+
+  writer.add(cSplineTag, 0, scene.spline->getControlPoints());
+  SceneTime time = { *scene.duckParameter, *scene.dropSinceLastTime };
+  writer.add(cSceneTimeTag, 0, &time, sizeof(time));
+  writer.add(cDuckHeightTag, 0, scene.ducks->y);
+  writer.add(cDuckVelocityTag, 0, scene.ducks->verticalVelocity);
+  int32_t qualityLevel = scene.governor->getNumLevels() > 0
+    ? scene.governor->getLevelIndex() : -1;
+  writer.add(cQualityLevelTag, 0, &qualityLevel, sizeof(qualityLevel));
+
+  if (!writer.save(path)) {
+    return false;
+  }
+  cout << "Saved checkpoint " << path << "." << endl;
+  return true;
+}
+
+// Checkpoints saved with the governor off keep the fallback.
+int getCheckpointQualityLevel(const Checkpoint &checkpoint, int fallback) {
+  int32_t qualityLevel;
+  if (!checkpoint.read(cQualityLevelTag, 0, qualityLevel) ||
+      qualityLevel < 0 || qualityLevel >= (int32_t)cQualityLevels.size()) {
+    return fallback;
+  }
+  return qualityLevel;
+}
+
+bool restoreCheckpoint(const char *path, const Checkpoint &checkpoint,
+    SceneState &scene) {
+  size_t generatorSize;
+  auto generatorText = (const char*)checkpoint.find(cGeneratorTag, 0,
+      generatorSize);
+  vector<glm::vec2> controlPoints;
+  vector<float> duckHeights, duckVelocities;
+  SceneTime time;
+  auto numDucks = (size_t)scene.ducks->size();
+  if (!generatorText || !checkpoint.read(cSceneTimeTag, 0, time)
+      || !checkpoint.read(cSplineTag, 0, controlPoints)
+      || controlPoints.size() < 4
+      || !checkpoint.read(cDuckHeightTag, 0, duckHeights)
+      || !checkpoint.read(cDuckVelocityTag, 0, duckVelocities)
+      || duckHeights.size() > numDucks
+      || duckVelocities.size() != duckHeights.size()) {
+    cerr << "Checkpoint " << path << " does not match the scene." << endl;
+    return false;
+  }
+  if (!scene.waterWorld->restoreCheckpoint(checkpoint)) {
+    return false;
+  }
+
+  istringstream generatorState(string(generatorText, generatorSize));
+  generatorState >> *scene.generator;
+  scene.spline->setControlPoints(controlPoints);
+  *scene.duckParameter = time.duckParameter;
+  *scene.dropSinceLastTime = time.dropSinceLastTime;
+  // A checkpoint saved at a lower quality level holds fewer ducks.
+  copy(duckHeights.begin(), duckHeights.end(), scene.ducks->y.begin());
+  copy(duckVelocities.begin(), duckVelocities.end(),
+      scene.ducks->verticalVelocity.begin());
+  cout << "Restored checkpoint " << path << "." << endl;
+  return true;
+}
+
+void setupDuckProgram(void *context, int index, const RenderView &view) {
+  auto scene = (DuckScene*)context;
+  glUniformMatrix4fv(glGetUniformLocation(scene->program, "viewProj"), 1,
+      GL_FALSE, glm::value_ptr(view.viewProj));
+  glUniform3fv(glGetUniformLocation(scene->program, "cameraPosition"), 1,
+      glm::value_ptr(view.cameraPosition));
+  glUniform3fv(glGetUniformLocation(scene->program, "lightPosition"), 1,
+      glm::value_ptr(glm::vec3(0.0f, 0.0f, 0.0f)));
+}
+
+void drawDuck(void *context, int index, const RenderView &view) {
+  auto scene = (DuckScene*)context;
+  auto &ducks = *scene->ducks;
+  // Rows of the 3x4 matrix are the columns of the shader's mat4x3.
+  glUniformMatrix4x3fv(glGetUniformLocation(scene->program, "modelMatrix"),
+      1, GL_TRUE, scene->transforms->getMatrix(index));
+
+  auto duckPosition = glm::vec3(ducks.x[index], ducks.y[index],
+      ducks.z[index]);
+  auto duckDistance = glm::distance(view.cameraPosition, duckPosition);
+  auto duckScreenRadius = scene->mesh->getBoundingRadius() * scene->scale
+    * scene->pixelsPerUnit / max(duckDistance, 0.001f);
+  scene->mesh->draw(scene->mesh->selectLod(duckScreenRadius,
+        scene->lodError));
+  ++*view.drawCalls;
+}
+
+void setupSkyboxProgram(void *context, int index, const RenderView &view) {
+  auto skybox = (Skybox*)context;
+  glUniformMatrix4fv(glGetUniformLocation(skybox->program, "viewProj"), 1,
+      GL_FALSE, glm::value_ptr(view.viewProj));
+  glUniformMatrix4fv(glGetUniformLocation(skybox->program, "modelMatrix"), 1,
+      GL_FALSE, glm::value_ptr(glm::mat4(1.0f)));
+}
+
+void drawSkybox(void *context, int index, const RenderView &view) {
+  auto skybox = (Skybox*)context;
+  glBindVertexArray(skybox->vao);
+  glDrawElements(GL_TRIANGLES, skybox->numIndices, GL_UNSIGNED_INT, 0);
+  glBindVertexArray(0);
+  ++*view.drawCalls;
+}
+
+void drawWaterSurface(void *context, int index, const RenderView &view) {
+  auto surface = (WaterSurface*)context;
+  surface->draw(view.viewProj, view.cameraPosition, *view.frameArena);
+  *view.drawCalls += surface->getNumDrawCalls();
+}
+
 void key_callback(
     GLFWwindow* window, 
     int key, 
@@ -1,21 +1,30 @@
 #include "mesh.hpp"
+#include "meshOptimization.hpp"
+#include "meshSimplification.hpp"
+#include "parallel.hpp"
+#include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
+#include <glm/gtc/packing.hpp>
 
 using namespace std;
 
-Mesh::Mesh() : _vbo(0), _vao(0), _ebo(0) {
+static const int cMaxLods = 4;
+static const float cLodTriangleRatio = 0.5f;
+
+Mesh::Mesh() : _boundingRadius(0.0f) {
 }
 
-Mesh::Mesh(const string &filename) : Mesh() {
-  load(filename);
+Mesh::Mesh(const string &filename, bool quantizeAttributes) : Mesh() {
+  load(filename, quantizeAttributes);
 }
 
 Mesh::~Mesh() {
   free();
 }
 
-void Mesh::load(const string &filename) {
+void Mesh::load(const string &filename, bool quantizeAttributes) {
   // todo: Split this multipurpose method into smaller methods.
   // todo: Catch and handle exceptions.
   ifstream file;
@@ -35,7 +44,7 @@ void Mesh::load(const string &filename) {
       >> vertices[i].texCoord.y;
   }
 
-  calculateTangentVector(vertices);
+  calculateBoundingSphere(vertices);
 
   file >> _numTriangles;
   _numIndices = _numTriangles * 3;
@@ -45,20 +54,42 @@ void Mesh::load(const string &filename) {
     file >> indices[3*i] >> indices[3*i+1] >> indices[3*i+2];
   }
 
-  glGenVertexArrays(1, &_vao);
-  glGenBuffers(1, &_vbo);
-  glGenBuffers(1, &_ebo);
+  calculateTangentFrames(vertices, indices);
+
+  vector<glm::vec3> positions(_numVertices);
+  for (auto i = 0; i < _numVertices; ++i) {
+    positions[i] = vertices[i].position;
+  }
+
+  auto lodIndices = buildLods(positions, indices);
+  optimizeLods(vertices, positions, lodIndices);
+
+  _vao = GLVertexArray::create();
+  _vbo = GLBuffer::create();
+  _ebo = GLBuffer::create();
+
+  glBindVertexArray(_vao.get());
+  if (quantizeAttributes) {
+    uploadPackedVertices(vertices);
+  } else {
+    uploadVertices(vertices);
+  }
 
-  glBindVertexArray(_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, _vbo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo.get());
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, lodIndices.size() * sizeof(GLuint),
+      &lodIndices[0], GL_STATIC_DRAW);
+
+  glBindVertexArray(0);
+}
+
+void Mesh::uploadVertices(
+    const std::vector<VertexNormalTangentTex> &vertices
+) {
+  glBindBuffer(GL_ARRAY_BUFFER, _vbo.get());
   glBufferData(GL_ARRAY_BUFFER, 
       vertices.size() * sizeof(VertexNormalTangentTex),
       &vertices[0], GL_STATIC_DRAW);
 
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _ebo);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint),
-      &indices[0], GL_STATIC_DRAW);
-
   glEnableVertexAttribArray(0);
   glEnableVertexAttribArray(1);
   glEnableVertexAttribArray(2);
@@ -76,35 +107,221 @@ void Mesh::load(const string &filename) {
   glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 
       sizeof(VertexNormalTangentTex),
       (GLvoid*)offsetof(VertexNormalTangentTex, texCoord));
+}
 
-  glBindVertexArray(0);
+void Mesh::uploadPackedVertices(
+    const std::vector<VertexNormalTangentTex> &vertices
+) {
+  // Vertices are packed straight into the mapped buffer.
+  auto bufferSize = vertices.size() * sizeof(PackedVertexNormalTangentTex);
+  glBindBuffer(GL_ARRAY_BUFFER, _vbo.get());
+  glBufferData(GL_ARRAY_BUFFER, bufferSize, nullptr, GL_STATIC_DRAW);
+  auto packed = (PackedVertexNormalTangentTex*)glMapBufferRange(
+      GL_ARRAY_BUFFER, 0, bufferSize,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  for (auto i = 0; i < vertices.size(); ++i) {
+    packed[i].position = vertices[i].position;
+    packed[i].tangentFrame = packTangentFrame(vertices[i].normal,
+        vertices[i].tangent);
+    packed[i].texCoord[0] = glm::packHalf1x16(vertices[i].texCoord.x);
+    packed[i].texCoord[1] = glm::packHalf1x16(vertices[i].texCoord.y);
+  }
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+
+  glEnableVertexAttribArray(0);
+  glEnableVertexAttribArray(1);
+  glEnableVertexAttribArray(3);
+
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 
+      sizeof(PackedVertexNormalTangentTex), 
+      (GLvoid*)offsetof(PackedVertexNormalTangentTex, position));
+  glVertexAttribIPointer(1, 1, GL_UNSIGNED_INT,
+      sizeof(PackedVertexNormalTangentTex), 
+      (GLvoid*)offsetof(PackedVertexNormalTangentTex, tangentFrame));
+  glVertexAttribPointer(3, 2, GL_HALF_FLOAT, GL_FALSE, 
+      sizeof(PackedVertexNormalTangentTex),
+      (GLvoid*)offsetof(PackedVertexNormalTangentTex, texCoord));
 }
 
 void Mesh::free() {
-  // todo: Free allocated resources.
+  _vao.reset();
+  _vbo.reset();
+  _ebo.reset();
+  _lods.clear();
 }
 
-void Mesh::draw() {
-  glBindVertexArray(_vbo);
-  glDrawElements(GL_TRIANGLES, _numIndices, GL_UNSIGNED_INT, 0);
+void Mesh::draw(int lod) {
+  const auto &level = _lods[lod];
+  glBindVertexArray(_vao.get());
+  glDrawElements(GL_TRIANGLES, level.numIndices, GL_UNSIGNED_INT,
+      (GLvoid*)(level.firstIndex * sizeof(GLuint)));
   glBindVertexArray(0);
 }
 
-void Mesh::calculateTangentVector(
-    std::vector<VertexNormalTangentTex> &vertices
+int Mesh::selectLod(float screenRadius, float maxScreenError) {
+  // Level error is in object space, screenRadius maps bounding radius to
+  // pixels, so both give the on-screen deviation of a simplified level.
+  auto pixelsPerUnit = screenRadius / max(_boundingRadius, 1e-6f);
+  auto lod = 0;
+  while (lod + 1 < _lods.size() &&
+      _lods[lod + 1].error * pixelsPerUnit <= maxScreenError) {
+    ++lod;
+  }
+  return lod;
+}
+
+void Mesh::calculateTangentFrames(
+    std::vector<VertexNormalTangentTex> &vertices,
+    const std::vector<GLuint> &indices
 ) {
-  glm::vec3 tangentPlaneNormal(0.0f, 1.0f, 0.0f);
-  glm::vec3 idealTangentVector(1.0f, 0.0f, 0.0f);
+  // MikkTSpace style: every corner projects the texture space directions of
+  // its triangle onto the tangent plane of its vertex, and vertices sum
+  // them weighted by corner angle, so the result depends neither on the
+  // triangle sizes nor on how the surface is split into triangles.
+  // Triangles and then vertices are processed in parallel, vertices read
+  // the corners around them, which keeps the sums in a fixed order.
+  auto numCorners = (int)indices.size();
+  vector<glm::vec3> cornerTangents(numCorners);
+
+  parallelFor(0, numCorners / 3, [&](int firstTriangle, int lastTriangle) {
+    for (auto triangle = firstTriangle; triangle < lastTriangle; ++triangle) {
+      const GLuint *corner = &indices[3 * triangle];
+      const auto &v0 = vertices[corner[0]];
+      const auto &v1 = vertices[corner[1]];
+      const auto &v2 = vertices[corner[2]];
+      auto edge1 = v1.position - v0.position;
+      auto edge2 = v2.position - v0.position;
+      auto uv1 = v1.texCoord - v0.texCoord;
+      auto uv2 = v2.texCoord - v0.texCoord;
+
+      auto area = uv1.x * uv2.y - uv2.x * uv1.y;
+      auto sign = area < 0.0f ? -1.0f : 1.0f;
+      auto tangent = sign * (edge1 * uv2.y - edge2 * uv1.y);
+
+      for (auto i = 0; i < 3; ++i) {
+        const auto &vertex = vertices[corner[i]];
+        auto toNext = vertices[corner[(i + 1) % 3]].position - vertex.position;
+        auto toPrevious =
+          vertices[corner[(i + 2) % 3]].position - vertex.position;
+        auto lengths = glm::length(toNext) * glm::length(toPrevious);
+        auto angle = lengths > 0.0f ? acosf(max(-1.0f, min(1.0f,
+                glm::dot(toNext, toPrevious) / lengths))) : 0.0f;
+
+        auto normal = glm::normalize(vertex.normal);
+        auto projectedTangent = tangent - glm::dot(tangent, normal) * normal;
+        auto tangentLength = glm::length(projectedTangent);
+        cornerTangents[3 * triangle + i] = tangentLength > 1e-12f
+          ? angle / tangentLength * projectedTangent : glm::vec3(0.0f);
+      }
+    }
+  });
+
+  vector<int> firstCorner(vertices.size() + 1, 0);
+  for (auto index : indices) {
+    ++firstCorner[index + 1];
+  }
   for (auto i = 0; i < vertices.size(); ++i) {
-    glm::vec3 tangent;
-    const auto &normal = vertices[i].normal;
-    float cosa = glm::dot(tangentPlaneNormal, normal);
-    if (fabs(cosa) > 0.95f) {
-      tangent = idealTangentVector;
-    } else {
-      tangent = glm::cross(normal, tangentPlaneNormal);
+    firstCorner[i + 1] += firstCorner[i];
+  }
+  vector<int> vertexCorners(numCorners);
+  vector<int> filled(firstCorner.begin(), firstCorner.end() - 1);
+  for (auto i = 0; i < numCorners; ++i) {
+    vertexCorners[filled[indices[i]]++] = i;
+  }
+
+  parallelFor(0, (int)vertices.size(), [&](int firstVertex, int lastVertex) {
+    for (auto i = firstVertex; i < lastVertex; ++i) {
+      auto normal = glm::normalize(vertices[i].normal);
+      auto tangent = glm::vec3(0.0f);
+      for (auto c = firstCorner[i]; c < firstCorner[i + 1]; ++c) {
+        tangent += cornerTangents[vertexCorners[c]];
+      }
+
+      tangent -= glm::dot(tangent, normal) * normal;
+      if (glm::length(tangent) < 1e-6f) {
+        // No texture space around the vertex, any direction in the tangent
+        // plane will do.
+        auto axis = fabs(normal.x) < 0.9f
+          ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        tangent = axis - glm::dot(axis, normal) * normal;
+      }
+      vertices[i].normal = normal;
+      vertices[i].tangent = glm::normalize(tangent);
     }
-    
-    vertices[i].tangent = tangent;
+  });
+}
+
+void Mesh::calculateBoundingSphere(
+    const std::vector<VertexNormalTangentTex> &vertices
+) {
+  glm::vec3 minimum = vertices[0].position, maximum = vertices[0].position;
+  for (const auto &vertex : vertices) {
+    minimum = glm::min(minimum, vertex.position);
+    maximum = glm::max(maximum, vertex.position);
+  }
+
+  _boundingCenter = 0.5f * (minimum + maximum);
+  _boundingRadius = 0.0f;
+  for (const auto &vertex : vertices) {
+    _boundingRadius = max(_boundingRadius,
+        glm::length(vertex.position - _boundingCenter));
+  }
+}
+
+std::vector<GLuint> Mesh::buildLods(
+    const std::vector<glm::vec3> &positions,
+    const std::vector<GLuint> &indices
+) {
+  _lods.clear();
+  _lods.push_back({0, (int)indices.size(), 0.0f});
+  vector<GLuint> lodIndices(indices);
+  vector<GLuint> levelIndices(indices);
+
+  while (_lods.size() < cMaxLods) {
+    auto previousTriangles = levelIndices.size() / 3;
+    int targetTriangles = (int)(cLodTriangleRatio * previousTriangles);
+    float levelError = 0.0f;
+    levelIndices = simplifyMesh(positions, levelIndices, targetTriangles,
+        &levelError);
+
+    // Simplification stalls once only locked vertices remain.
+    if (levelIndices.size() / 3 > 0.9f * previousTriangles) {
+      break;
+    }
+
+    MeshLod lod;
+    lod.firstIndex = lodIndices.size();
+    lod.numIndices = levelIndices.size();
+    lod.error = max(levelError, _lods.back().error);
+    _lods.push_back(lod);
+    lodIndices.insert(lodIndices.end(), levelIndices.begin(),
+        levelIndices.end());
+  }
+
+  return lodIndices;
+}
+
+void Mesh::optimizeLods(
+    std::vector<VertexNormalTangentTex> &vertices,
+    const std::vector<glm::vec3> &positions,
+    std::vector<GLuint> &lodIndices
+) {
+  for (auto i = 0; i < _lods.size(); ++i) {
+    GLuint *indices = &lodIndices[_lods[i].firstIndex];
+    auto numIndices = _lods[i].numIndices;
+    auto acmrBefore = calculateACMR(indices, numIndices, vertices.size());
+    optimizeVertexCache(indices, numIndices, vertices.size());
+    optimizeOverdraw(indices, numIndices, positions);
+    auto acmrAfter = calculateACMR(indices, numIndices, vertices.size());
+    cout << "Mesh LOD " << i << ": " << numIndices / 3 << " triangles, ACMR "
+      << acmrBefore << " -> " << acmrAfter << endl;
+  }
+
+  // Vertex order follows first use in the finest level.
+  auto newToOld = optimizeVertexFetch(lodIndices, vertices.size());
+  vector<VertexNormalTangentTex> reordered(vertices.size());
+  for (auto i = 0; i < newToOld.size(); ++i) {
+    reordered[i] = vertices[newToOld[i]];
   }
+  vertices.swap(reordered);
 }
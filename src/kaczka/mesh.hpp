@@ -1,6 +1,8 @@
 #ifndef __MESH_HPP__
 #define __MESH_HPP__
 
+#include "glHandles.hpp"
+
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <string>
@@ -19,30 +21,71 @@ struct VertexNormalTangentTex {
   glm::vec2 texCoord;
 };
 
+// Normal and tangent are one packed quaternion, see
+// packTangentFrame.
+struct PackedVertexNormalTangentTex {
+  glm::vec3 position;
+  GLuint tangentFrame;
+  GLushort texCoord[2];
+};
+
+struct MeshLod {
+  int firstIndex;
+  int numIndices;
+  float error;
+};
+
 class Mesh {
 public:
   Mesh();
-  Mesh(const std::string &filename);
+  Mesh(const std::string &filename, bool quantizeAttributes = false);
   virtual ~Mesh();
 
-  void load(const std::string &filename);
+  void load(const std::string &filename, bool quantizeAttributes = false);
   void free();
-  void draw();
+  void draw(int lod = 0);
 
-  inline GLuint getVBO() { return _vbo; }
+  int selectLod(float screenRadius, float maxScreenError = 1.0f);
+
+  inline GLuint getVBO() { return _vbo.get(); }
 
   inline int getNumVertices() { return _numVertices; }
   inline int getNumIndices() { return _numIndices; }
   inline int getNumTriangles() { return _numTriangles; }
+  inline int getNumLods() { return _lods.size(); }
+  inline const MeshLod &getLod(int lod) { return _lods[lod]; }
+  inline const glm::vec3 &getBoundingCenter() { return _boundingCenter; }
+  inline float getBoundingRadius() { return _boundingRadius; }
 
 protected:
-  void calculateTangentVector(
-      std::vector<VertexNormalTangentTex> &vertices
+  void calculateTangentFrames(
+      std::vector<VertexNormalTangentTex> &vertices,
+      const std::vector<GLuint> &indices
+  );
+  void calculateBoundingSphere(
+      const std::vector<VertexNormalTangentTex> &vertices
+  );
+  std::vector<GLuint> buildLods(
+      const std::vector<glm::vec3> &positions,
+      const std::vector<GLuint> &indices
+  );
+  void optimizeLods(
+      std::vector<VertexNormalTangentTex> &vertices,
+      const std::vector<glm::vec3> &positions,
+      std::vector<GLuint> &lodIndices
+  );
+  void uploadVertices(const std::vector<VertexNormalTangentTex> &vertices);
+  void uploadPackedVertices(
+      const std::vector<VertexNormalTangentTex> &vertices
   );
 
 private:  
   int _numVertices, _numTriangles, _numIndices;
-  GLuint _vbo, _vao, _ebo;
+  GLBuffer _vbo, _ebo;
+  GLVertexArray _vao;
+  std::vector<MeshLod> _lods;
+  glm::vec3 _boundingCenter;
+  float _boundingRadius;
 };        
           
 #endif    
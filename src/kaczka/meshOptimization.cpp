@@ -0,0 +1,294 @@
+#include "meshOptimization.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+namespace {
+
+const int cForsythCacheSize = 32;
+
+float forsythVertexScore(int cachePosition, int remainingTriangles) {
+  if (remainingTriangles == 0) {
+    return -1.0f;
+  }
+
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      score = 0.75f;
+    } else {
+      float scaler = 1.0f / (cForsythCacheSize - 3);
+      score = powf(1.0f - (cachePosition - 3) * scaler, 1.5f);
+    }
+  }
+
+  score += 2.0f * powf((float)remainingTriangles, -0.5f);
+  return score;
+}
+
+}
+
+float calculateACMR(const GLuint *indices, int numIndices, int numVertices,
+    int cacheSize) {
+  if (numIndices == 0) {
+    return 0.0f;
+  }
+
+  vector<int> insertedAt(numVertices, -cacheSize - 1);
+  int misses = 0;
+  for (auto i = 0; i < numIndices; ++i) {
+    auto vertex = indices[i];
+    if (misses - insertedAt[vertex] > cacheSize) {
+      insertedAt[vertex] = misses++;
+    }
+  }
+  return (float)misses / (numIndices / 3);
+}
+
+void optimizeVertexCache(GLuint *indices, int numIndices, int numVertices) {
+  int numTriangles = numIndices / 3;
+
+  vector<int> remaining(numVertices, 0);
+  for (auto i = 0; i < numIndices; ++i) {
+    remaining[indices[i]]++;
+  }
+
+  vector<int> offsets(numVertices + 1, 0);
+  for (auto i = 0; i < numVertices; ++i) {
+    offsets[i + 1] = offsets[i] + remaining[i];
+  }
+  vector<int> vertexTriangles(numIndices);
+  vector<int> fill(offsets.begin(), offsets.end() - 1);
+  for (auto i = 0; i < numIndices; ++i) {
+    vertexTriangles[fill[indices[i]]++] = i / 3;
+  }
+
+  vector<int> cachePosition(numVertices, -1);
+  vector<float> vertexScore(numVertices);
+  for (auto i = 0; i < numVertices; ++i) {
+    vertexScore[i] = forsythVertexScore(-1, remaining[i]);
+  }
+
+  vector<bool> emitted(numTriangles, false);
+
+  vector<GLuint> output;
+  output.reserve(numIndices);
+  vector<GLuint> cache, newCache;
+  cache.reserve(cForsythCacheSize + 3);
+  newCache.reserve(cForsythCacheSize + 3);
+
+  int bestTriangle = -1;
+  int scanPosition = 0;
+  for (auto emittedCount = 0; emittedCount < numTriangles; ++emittedCount) {
+    if (bestTriangle < 0) {
+      // Nothing adjacent to the cache, continue with the next unused one.
+      while (emitted[scanPosition]) {
+        ++scanPosition;
+      }
+      bestTriangle = scanPosition;
+    }
+
+    const GLuint *corners = &indices[3 * bestTriangle];
+    emitted[bestTriangle] = true;
+    newCache.clear();
+    for (auto j = 0; j < 3; ++j) {
+      auto vertex = corners[j];
+      output.push_back(vertex);
+      newCache.push_back(vertex);
+
+      auto first = vertexTriangles.begin() + offsets[vertex];
+      auto last = first + remaining[vertex];
+      *find(first, last, bestTriangle) = *(last - 1);
+      remaining[vertex]--;
+    }
+    for (auto vertex : cache) {
+      if (vertex != corners[0] && vertex != corners[1] &&
+          vertex != corners[2]) {
+        newCache.push_back(vertex);
+      }
+    }
+    swap(cache, newCache);
+
+    for (auto i = 0; i < cache.size(); ++i) {
+      auto vertex = cache[i];
+      cachePosition[vertex] = i < cForsythCacheSize ? i : -1;
+      vertexScore[vertex] =
+        forsythVertexScore(cachePosition[vertex], remaining[vertex]);
+    }
+
+    bestTriangle = -1;
+    float bestScore = -1.0f;
+    for (auto vertex : cache) {
+      for (auto k = 0; k < remaining[vertex]; ++k) {
+        auto triangle = vertexTriangles[offsets[vertex] + k];
+        float score = vertexScore[indices[3*triangle]]
+          + vertexScore[indices[3*triangle+1]]
+          + vertexScore[indices[3*triangle+2]];
+        if (score > bestScore) {
+          bestScore = score;
+          bestTriangle = triangle;
+        }
+      }
+    }
+
+    if (cache.size() > cForsythCacheSize) {
+      cache.resize(cForsythCacheSize);
+    }
+  }
+
+  copy(output.begin(), output.end(), indices);
+}
+
+void optimizeOverdraw(GLuint *indices, int numIndices,
+    const vector<glm::vec3> &positions) {
+  int numTriangles = numIndices / 3;
+  if (numTriangles == 0) {
+    return;
+  }
+
+  // Clusters start wherever the cache optimizer restarted with a triangle
+  // whose three vertices all miss, so moving them around costs little.
+  vector<int> clusterStarts;
+  vector<int> insertedAt(positions.size(), -cForsythCacheSize - 1);
+  int misses = 0;
+  for (auto i = 0; i < numTriangles; ++i) {
+    int triangleMisses = 0;
+    for (auto j = 0; j < 3; ++j) {
+      auto vertex = indices[3*i+j];
+      if (misses - insertedAt[vertex] > cForsythCacheSize) {
+        insertedAt[vertex] = misses++;
+        ++triangleMisses;
+      }
+    }
+    if (i == 0 || triangleMisses == 3) {
+      clusterStarts.push_back(i);
+    }
+  }
+  clusterStarts.push_back(numTriangles);
+
+  glm::vec3 meshCenter(0.0f);
+  for (auto i = 0; i < numIndices; ++i) {
+    meshCenter += positions[indices[i]];
+  }
+  meshCenter /= (float)numIndices;
+
+  int numClusters = clusterStarts.size() - 1;
+  vector<float> sortKeys(numClusters);
+  vector<int> order(numClusters);
+  for (auto c = 0; c < numClusters; ++c) {
+    glm::vec3 centroid(0.0f), normal(0.0f);
+    float totalArea = 0.0f;
+    for (auto i = clusterStarts[c]; i < clusterStarts[c+1]; ++i) {
+      const auto &p0 = positions[indices[3*i]];
+      const auto &p1 = positions[indices[3*i+1]];
+      const auto &p2 = positions[indices[3*i+2]];
+      auto areaNormal = glm::cross(p1 - p0, p2 - p0);
+      float area = glm::length(areaNormal);
+      centroid += area * (p0 + p1 + p2) / 3.0f;
+      normal += areaNormal;
+      totalArea += area;
+    }
+    float normalLength = glm::length(normal);
+    sortKeys[c] = 0.0f;
+    if (normalLength > 0.0f && totalArea > 0.0f) {
+      centroid /= totalArea;
+      sortKeys[c] = glm::dot(centroid - meshCenter, normal / normalLength);
+    }
+    order[c] = c;
+  }
+
+  stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return sortKeys[a] > sortKeys[b];
+  });
+
+  vector<GLuint> sorted;
+  sorted.reserve(numIndices);
+  for (auto c : order) {
+    sorted.insert(sorted.end(), indices + 3 * clusterStarts[c],
+        indices + 3 * clusterStarts[c+1]);
+  }
+  copy(sorted.begin(), sorted.end(), indices);
+}
+
+vector<GLuint> optimizeVertexFetch(vector<GLuint> &indices,
+    int numVertices) {
+  const GLuint unused = ~0u;
+  vector<GLuint> oldToNew(numVertices, unused);
+  vector<GLuint> newToOld;
+  newToOld.reserve(numVertices);
+
+  for (auto &index : indices) {
+    if (oldToNew[index] == unused) {
+      oldToNew[index] = newToOld.size();
+      newToOld.push_back(index);
+    }
+    index = oldToNew[index];
+  }
+
+  for (auto i = 0; i < numVertices; ++i) {
+    if (oldToNew[i] == unused) {
+      newToOld.push_back(i);
+    }
+  }
+  return newToOld;
+}
+
+GLuint packTangentFrame(const glm::vec3 &normal, const glm::vec3 &tangent) {
+  const auto &t = tangent;
+  auto b = glm::cross(normal, t);
+  const auto &n = normal;
+
+  float q[4];
+  auto trace = t.x + b.y + n.z;
+  if (trace > 0.0f) {
+    auto s = 2.0f * sqrtf(trace + 1.0f);
+    q[0] = (b.z - n.y) / s;
+    q[1] = (n.x - t.z) / s;
+    q[2] = (t.y - b.x) / s;
+    q[3] = 0.25f * s;
+  } else if (t.x > b.y && t.x > n.z) {
+    auto s = 2.0f * sqrtf(1.0f + t.x - b.y - n.z);
+    q[0] = 0.25f * s;
+    q[1] = (b.x + t.y) / s;
+    q[2] = (n.x + t.z) / s;
+    q[3] = (b.z - n.y) / s;
+  } else if (b.y > n.z) {
+    auto s = 2.0f * sqrtf(1.0f + b.y - t.x - n.z);
+    q[0] = (b.x + t.y) / s;
+    q[1] = 0.25f * s;
+    q[2] = (n.y + b.z) / s;
+    q[3] = (n.x - t.z) / s;
+  } else {
+    auto s = 2.0f * sqrtf(1.0f + n.z - t.x - b.y);
+    q[0] = (n.x + t.z) / s;
+    q[1] = (n.y + b.z) / s;
+    q[2] = 0.25f * s;
+    q[3] = (t.y - b.x) / s;
+  }
+
+  auto length = sqrtf(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+  auto largest = 0;
+  for (auto i = 1; i < 4; ++i) {
+    if (fabs(q[i]) > fabs(q[largest])) {
+      largest = i;
+    }
+  }
+  auto sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+
+  // The three smaller components lie within +-1/sqrt(2).
+  GLuint packed = 0;
+  auto shift = 0;
+  for (auto i = 0; i < 4; ++i) {
+    if (i == largest) {
+      continue;
+    }
+    auto value = sign * q[i] / length * sqrtf(2.0f);
+    value = max(-1.0f, min(1.0f, value));
+    packed |= (GLuint)roundf((0.5f * value + 0.5f) * 511.0f) << shift;
+    shift += 9;
+  }
+  packed |= (GLuint)largest << 27;
+  return packed;
+}
@@ -0,0 +1,36 @@
+#ifndef __MESH_OPTIMIZATION_HPP__
+#define __MESH_OPTIMIZATION_HPP__
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Average cache miss ratio (transformed vertices per triangle) of a FIFO
+// post-transform cache with cacheSize entries.
+float calculateACMR(const GLuint *indices, int numIndices, int numVertices,
+    int cacheSize = 16);
+
+// Reorders triangles in place for post-transform cache locality using
+// Tom Forsyth's linear-speed vertex cache optimisation.
+void optimizeVertexCache(GLuint *indices, int numIndices, int numVertices);
+
+// Reorders cache-coherent triangle clusters front-to-back from the mesh
+// center so that outward facing clusters are drawn first, reducing
+// overdraw without noticeably changing ACMR.
+void optimizeOverdraw(GLuint *indices, int numIndices,
+    const std::vector<glm::vec3> &positions);
+
+// Renumbers vertices in order of first use. Indices are rewritten in
+// place; returned table maps new vertex index to old vertex index.
+std::vector<GLuint> optimizeVertexFetch(std::vector<GLuint> &indices,
+    int numVertices);
+
+// Packs the frame with columns tangent, cross(normal, tangent) and normal
+// as the quaternion rotating the axes onto it. The sign of one component
+// is free, the largest is kept positive and rebuilt from the other three,
+// which take 9 bits each. Bits 27-28 hold the index of the largest. The
+// shading only needs the normal and the tangent, so the handedness of the
+// bitangent is not kept. The tangent has to be orthonormal to the normal.
+GLuint packTangentFrame(const glm::vec3 &normal, const glm::vec3 &tangent);
+
+#endif
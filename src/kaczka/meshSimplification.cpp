@@ -0,0 +1,245 @@
+#include "meshSimplification.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+struct CollapseCandidate {
+  GLuint from, to;
+  double cost;
+
+  bool operator<(const CollapseCandidate &other) const {
+    return cost < other.cost;
+  }
+};
+
+struct VertexTriangles {
+  vector<GLuint> offsets;
+  vector<GLuint> triangles;
+};
+
+void buildVertexTriangles(int numVertices, const vector<GLuint> &indices,
+    VertexTriangles &adjacency) {
+  adjacency.offsets.assign(numVertices + 1, 0);
+  for (auto i = 0; i < indices.size(); ++i) {
+    adjacency.offsets[indices[i] + 1]++;
+  }
+  for (auto i = 0; i < numVertices; ++i) {
+    adjacency.offsets[i + 1] += adjacency.offsets[i];
+  }
+
+  vector<GLuint> fill(adjacency.offsets.begin(), adjacency.offsets.end() - 1);
+  adjacency.triangles.resize(indices.size());
+  for (auto i = 0; i < indices.size(); ++i) {
+    adjacency.triangles[fill[indices[i]]++] = i / 3;
+  }
+}
+
+vector<bool> findLockedVertices(int numVertices,
+    const vector<GLuint> &indices) {
+  vector<pair<GLuint, GLuint>> edges;
+  edges.reserve(indices.size());
+  for (auto i = 0; i < indices.size(); i += 3) {
+    for (auto j = 0; j < 3; ++j) {
+      auto a = indices[i + j], b = indices[i + (j + 1) % 3];
+      edges.push_back(make_pair(min(a, b), max(a, b)));
+    }
+  }
+  sort(edges.begin(), edges.end());
+
+  vector<bool> locked(numVertices, false);
+  for (auto i = 0; i < edges.size();) {
+    auto j = i + 1;
+    while (j < edges.size() && edges[j] == edges[i]) {
+      ++j;
+    }
+    if (j - i == 1) {
+      locked[edges[i].first] = true;
+      locked[edges[i].second] = true;
+    }
+    i = j;
+  }
+  return locked;
+}
+
+bool collapseFlipsTriangles(const vector<glm::vec3> &positions,
+    const vector<GLuint> &indices, const VertexTriangles &adjacency,
+    GLuint from, GLuint to) {
+  for (auto i = adjacency.offsets[from]; i < adjacency.offsets[from+1]; ++i) {
+    auto triangle = adjacency.triangles[i];
+    const GLuint *corners = &indices[3 * triangle];
+    if (corners[0] == to || corners[1] == to || corners[2] == to) {
+      continue;
+    }
+
+    glm::vec3 before[3], after[3];
+    for (auto j = 0; j < 3; ++j) {
+      before[j] = positions[corners[j]];
+      after[j] = corners[j] == from ? positions[to] : before[j];
+    }
+
+    auto normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+    auto normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+    if (glm::dot(normalBefore, normalAfter) <=
+        0.25f * glm::dot(normalBefore, normalBefore)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}
+
+Quadric::Quadric() :
+  a00(0), a01(0), a02(0), a03(0),
+  a11(0), a12(0), a13(0),
+  a22(0), a23(0),
+  a33(0),
+  weight(0) {
+}
+
+Quadric::Quadric(const glm::vec3 &normal, float distance, float weight) :
+  a00(weight * normal.x * normal.x),
+  a01(weight * normal.x * normal.y),
+  a02(weight * normal.x * normal.z),
+  a03(weight * normal.x * distance),
+  a11(weight * normal.y * normal.y),
+  a12(weight * normal.y * normal.z),
+  a13(weight * normal.y * distance),
+  a22(weight * normal.z * normal.z),
+  a23(weight * normal.z * distance),
+  a33(weight * distance * distance),
+  weight(weight) {
+}
+
+Quadric &Quadric::operator+=(const Quadric &other) {
+  a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+  a11 += other.a11; a12 += other.a12; a13 += other.a13;
+  a22 += other.a22; a23 += other.a23;
+  a33 += other.a33;
+  weight += other.weight;
+  return *this;
+}
+
+double Quadric::evaluate(const glm::vec3 &point) const {
+  double x = point.x, y = point.y, z = point.z;
+  return a00*x*x + 2*a01*x*y + 2*a02*x*z + 2*a03*x
+    + a11*y*y + 2*a12*y*z + 2*a13*y
+    + a22*z*z + 2*a23*z
+    + a33;
+}
+
+vector<GLuint> simplifyMesh(const vector<glm::vec3> &positions,
+    const vector<GLuint> &indices, int targetNumTriangles, float *error) {
+  int numVertices = positions.size();
+  vector<GLuint> result(indices);
+  vector<Quadric> quadrics(numVertices);
+  double maxError = 0.0;
+
+  for (auto i = 0; i < result.size(); i += 3) {
+    const auto &p0 = positions[result[i]];
+    const auto &p1 = positions[result[i+1]];
+    const auto &p2 = positions[result[i+2]];
+    auto normal = glm::cross(p1 - p0, p2 - p0);
+    float area = glm::length(normal);
+    if (area <= 0.0f) {
+      continue;
+    }
+    normal /= area;
+    Quadric plane(normal, -glm::dot(normal, p0), 0.5f * area);
+    for (auto j = 0; j < 3; ++j) {
+      quadrics[result[i+j]] += plane;
+    }
+  }
+
+  auto locked = findLockedVertices(numVertices, result);
+  VertexTriangles adjacency;
+  vector<CollapseCandidate> candidates;
+  vector<bool> touched(numVertices);
+  vector<GLuint> remap(numVertices);
+
+  while (result.size() / 3 > targetNumTriangles) {
+    buildVertexTriangles(numVertices, result, adjacency);
+
+    candidates.clear();
+    for (auto i = 0; i < result.size(); i += 3) {
+      for (auto j = 0; j < 3; ++j) {
+        auto a = result[i + j], b = result[i + (j + 1) % 3];
+        Quadric combined = quadrics[a];
+        combined += quadrics[b];
+        if (!locked[a]) {
+          candidates.push_back({a, b, combined.evaluate(positions[b])});
+        }
+        if (!locked[b]) {
+          candidates.push_back({b, a, combined.evaluate(positions[a])});
+        }
+      }
+    }
+    sort(candidates.begin(), candidates.end());
+
+    for (auto i = 0; i < numVertices; ++i) {
+      remap[i] = i;
+    }
+    fill(touched.begin(), touched.end(), false);
+
+    int trianglesToRemove = result.size() / 3 - targetNumTriangles;
+    int collapses = 0;
+    for (const auto &candidate : candidates) {
+      if (trianglesToRemove <= 0) {
+        break;
+      }
+
+      auto from = candidate.from, to = candidate.to;
+      if (touched[from] || touched[to]) {
+        continue;
+      }
+      if (collapseFlipsTriangles(positions, result, adjacency, from, to)) {
+        continue;
+      }
+
+      for (auto i = adjacency.offsets[from]; i < adjacency.offsets[from+1];
+          ++i) {
+        const GLuint *corners = &result[3 * adjacency.triangles[i]];
+        if (corners[0] == to || corners[1] == to || corners[2] == to) {
+          --trianglesToRemove;
+        }
+        for (auto j = 0; j < 3; ++j) {
+          touched[corners[j]] = true;
+        }
+      }
+
+      remap[from] = to;
+      quadrics[to] += quadrics[from];
+      auto weight = max(quadrics[to].weight, 1e-12);
+      maxError = max(maxError, candidate.cost / weight);
+      ++collapses;
+    }
+
+    if (collapses == 0) {
+      break;
+    }
+
+    auto write = 0;
+    for (auto i = 0; i < result.size(); i += 3) {
+      auto a = remap[result[i]];
+      auto b = remap[result[i+1]];
+      auto c = remap[result[i+2]];
+      if (a == b || b == c || c == a) {
+        continue;
+      }
+      result[write++] = a;
+      result[write++] = b;
+      result[write++] = c;
+    }
+    result.resize(write);
+  }
+
+  if (error) {
+    *error = (float)sqrt(max(maxError, 0.0));
+  }
+  return result;
+}
@@ -0,0 +1,33 @@
+#ifndef __MESH_SIMPLIFICATION_HPP__
+#define __MESH_SIMPLIFICATION_HPP__
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <vector>
+
+// Quadric error metric (Garland-Heckbert) stored as the upper triangle of
+// a symmetric 4x4 matrix. Weight is used to normalize accumulated area.
+struct Quadric {
+  Quadric();
+  Quadric(const glm::vec3 &normal, float distance, float weight);
+
+  Quadric &operator+=(const Quadric &other);
+  double evaluate(const glm::vec3 &point) const;
+
+  double a00, a01, a02, a03;
+  double a11, a12, a13;
+  double a22, a23;
+  double a33;
+  double weight;
+};
+
+// Simplifies triangle list using half-edge collapses. Vertices are never
+// moved or created, so the result indexes the same vertex buffer as the
+// input. Vertices lying on open edges (mesh borders and attribute seams)
+// are locked. Returns simplified indices; error receives the largest
+// collapse error expressed as a distance in object space units.
+std::vector<GLuint> simplifyMesh(const std::vector<glm::vec3> &positions,
+    const std::vector<GLuint> &indices, int targetNumTriangles,
+    float *error = nullptr);
+
+#endif
@@ -0,0 +1,236 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define USE_SHARED_MEMORY
+#endif
+
+using namespace std;
+
+static const uint32_t cMetricsMagic = 0x4d4b434b;
+static const uint32_t cMetricsVersion = 2;
+static const double cFirstBucketBound = 0.00025;
+static const int cMaxReadTries = 64;
+
+// The sequence is odd while the snapshot is being written. Readers only
+// map the segment, so it holds nothing but plain data and lock free
+// atomics, which work across processes.
+struct MetricsSegment {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t snapshotSize;
+  atomic<uint32_t> published;
+  alignas(64) atomic<uint32_t> sequence;
+  MetricsSnapshot snapshot;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2,
+    "metrics need lock free atomics to share them between processes");
+
+double getMetricsBucketBound(int bucket) {
+  if (bucket >= cMetricsNumBuckets - 1) {
+    return INFINITY;
+  }
+  return cFirstBucketBound * pow(2.0, 0.5 * bucket);
+}
+
+void addMetricsSample(MetricsHistogram &histogram, double seconds) {
+  auto bucket = 0;
+  if (seconds > cFirstBucketBound) {
+    auto steps = ceil(2.0 * log2(seconds / cFirstBucketBound));
+    bucket = (int)min(steps, (double)cMetricsNumBuckets - 1);
+    // Rounding may put a sample on a bound one bucket too high.
+    if (seconds <= getMetricsBucketBound(bucket - 1)) {
+      --bucket;
+    }
+  }
+  ++histogram.buckets[bucket];
+  ++histogram.count;
+  histogram.sum += seconds;
+}
+
+void addMetricsHistogram(MetricsHistogram &histogram,
+    const MetricsHistogram &samples) {
+  for (auto bucket = 0; bucket < cMetricsNumBuckets; ++bucket) {
+    histogram.buckets[bucket] += samples.buckets[bucket];
+  }
+  histogram.count += samples.count;
+  histogram.sum += samples.sum;
+}
+
+double getMetricsPercentile(const MetricsHistogram &histogram,
+    double fraction) {
+  if (histogram.count == 0) {
+    return 0.0;
+  }
+  auto target = fraction * histogram.count;
+  uint64_t below = 0;
+  for (auto bucket = 0; bucket < cMetricsNumBuckets; ++bucket) {
+    auto count = histogram.buckets[bucket];
+    if (count > 0 && below + count >= target) {
+      auto lower = bucket == 0 ? 0.0 : getMetricsBucketBound(bucket - 1);
+      if (bucket == cMetricsNumBuckets - 1) {
+        return lower;
+      }
+      auto upper = getMetricsBucketBound(bucket);
+      return lower + (upper - lower) * (target - below) / count;
+    }
+    below += count;
+  }
+  return getMetricsBucketBound(cMetricsNumBuckets - 2);
+}
+
+MetricsPublisher::MetricsPublisher() : _segment(nullptr) {
+}
+
+MetricsPublisher::~MetricsPublisher() {
+  close();
+}
+
+bool MetricsPublisher::open(const string &name) {
+  close();
+#ifdef USE_SHARED_MEMORY
+  auto descriptor = shm_open(name.c_str(), O_CREAT | O_RDWR, 0644);
+  if (descriptor < 0) {
+    cerr << "Cannot create metrics segment " << name << "." << endl;
+    return false;
+  }
+  void *mapping = MAP_FAILED;
+  if (ftruncate(descriptor, sizeof(MetricsSegment)) == 0) {
+    mapping = mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE,
+        MAP_SHARED, descriptor, 0);
+  }
+  ::close(descriptor);
+  if (mapping == MAP_FAILED) {
+    cerr << "Cannot map metrics segment " << name << "." << endl;
+    shm_unlink(name.c_str());
+    return false;
+  }
+
+  // A segment left behind by a scene that crashed is taken over.
+  _segment = new (mapping) MetricsSegment();
+  _segment->magic = cMetricsMagic;
+  _segment->version = cMetricsVersion;
+  _segment->snapshotSize = sizeof(MetricsSnapshot);
+  _segment->sequence.store(0, memory_order_relaxed);
+  memset(&_segment->snapshot, 0, sizeof(MetricsSnapshot));
+  _segment->published.store(1, memory_order_release);
+  _name = name;
+  return true;
+#else
+  cerr << "Metrics need POSIX shared memory, not publishing " << name
+    << "." << endl;
+  return false;
+#endif
+}
+
+void MetricsPublisher::close() {
+#ifdef USE_SHARED_MEMORY
+  if (_segment) {
+    _segment->published.store(0, memory_order_release);
+    munmap(_segment, sizeof(MetricsSegment));
+    shm_unlink(_name.c_str());
+  }
+#endif
+  _segment = nullptr;
+}
+
+// Plain copies between the sequence stores, the fence keeps them after
+// the first one.
+void MetricsPublisher::publish(const MetricsSnapshot &snapshot) {
+  if (!_segment) {
+    return;
+  }
+  auto sequence = _segment->sequence.load(memory_order_relaxed);
+  _segment->sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  memcpy(&_segment->snapshot, &snapshot, sizeof(snapshot));
+  _segment->sequence.store(sequence + 2, memory_order_release);
+}
+
+MetricsReader::MetricsReader() : _segment(nullptr) {
+}
+
+MetricsReader::~MetricsReader() {
+  close();
+}
+
+bool MetricsReader::open(const string &name) {
+  close();
+#ifdef USE_SHARED_MEMORY
+  auto descriptor = shm_open(name.c_str(), O_RDONLY, 0);
+  if (descriptor < 0) {
+    cerr << "No metrics segment " << name << ", is the scene running?"
+      << endl;
+    return false;
+  }
+  struct stat status;
+  void *mapping = MAP_FAILED;
+  if (fstat(descriptor, &status) == 0 &&
+      status.st_size >= (off_t)sizeof(MetricsSegment)) {
+    mapping = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED,
+        descriptor, 0);
+  }
+  ::close(descriptor);
+  if (mapping == MAP_FAILED) {
+    cerr << "Cannot map metrics segment " << name << "." << endl;
+    return false;
+  }
+
+  _segment = (const MetricsSegment*)mapping;
+  if (_segment->magic != cMetricsMagic ||
+      _segment->version != cMetricsVersion ||
+      _segment->snapshotSize != sizeof(MetricsSnapshot)) {
+    cerr << "Metrics segment " << name << " is of another version." << endl;
+    close();
+    return false;
+  }
+  return true;
+#else
+  cerr << "Metrics need POSIX shared memory, cannot read " << name << "."
+    << endl;
+  return false;
+#endif
+}
+
+void MetricsReader::close() {
+#ifdef USE_SHARED_MEMORY
+  if (_segment) {
+    munmap((void*)_segment, sizeof(MetricsSegment));
+  }
+#endif
+  _segment = nullptr;
+}
+
+bool MetricsReader::read(MetricsSnapshot &snapshot) {
+  if (!_segment) {
+    return false;
+  }
+  for (auto i = 0; i < cMaxReadTries; ++i) {
+    if (!_segment->published.load(memory_order_acquire)) {
+      return false;
+    }
+    auto before = _segment->sequence.load(memory_order_acquire);
+    if (before & 1) {
+      this_thread::yield();
+      continue;
+    }
+    memcpy(&snapshot, &_segment->snapshot, sizeof(snapshot));
+    atomic_thread_fence(memory_order_acquire);
+    if (_segment->sequence.load(memory_order_relaxed) == before) {
+      return true;
+    }
+  }
+  return false;
+}
@@ -0,0 +1,91 @@
+#ifndef __METRICS_HPP__
+#define __METRICS_HPP__
+
+#include <cstdint>
+#include <string>
+
+// Durations are counted in buckets whose upper bounds grow by sqrt(2)
+// from a quarter of a millisecond, the last one unbounded.
+const int cMetricsNumBuckets = 24;
+double getMetricsBucketBound(int bucket);
+
+struct MetricsHistogram {
+  std::uint64_t buckets[cMetricsNumBuckets];
+  std::uint64_t count;
+  double sum;
+};
+
+void addMetricsSample(MetricsHistogram &histogram, double seconds);
+void addMetricsHistogram(MetricsHistogram &histogram,
+    const MetricsHistogram &samples);
+// Interpolated within the bucket the fraction falls in.
+double getMetricsPercentile(const MetricsHistogram &histogram,
+    double fraction);
+
+// Everything a monitor sees of a running scene. Counters only grow from
+// the start of the process, gauges hold the latest frame.
+// Simulation steps count every substep of every surface. Allocations are
+// only counted in builds that count them, see countsAllocations.
+struct MetricsSnapshot {
+  std::uint64_t frames;
+  std::uint64_t simulationSteps;
+  std::uint64_t uploadedBytes;
+  std::uint64_t drawCalls;
+  std::uint64_t allocations;
+  std::int32_t countsAllocations;
+  std::int32_t activeTiles;
+  std::int32_t qualityLevel;
+  std::int32_t gridResolution;
+  std::int32_t numDucks;
+  MetricsHistogram frameTime;
+  MetricsHistogram stepTime;
+};
+
+struct MetricsSegment;
+
+// A named shared memory segment holding one snapshot behind a sequence
+// lock. The scene writes it once a frame without waiting for anyone;
+// readers copy it and try again when a write overlapped their copy, so a
+// slow or stopped reader never holds up the frame. Only the scene's
+// process writes, readers map it read only.
+class MetricsPublisher {
+public:
+  MetricsPublisher();
+  ~MetricsPublisher();
+
+  // Names are POSIX shared memory names such as "/kaczka-metrics". The
+  // segment is removed again by close.
+  bool open(const std::string &name);
+  void close();
+  inline bool isOpen() const { return _segment != nullptr; }
+
+  void publish(const MetricsSnapshot &snapshot);
+
+private:
+  MetricsPublisher(const MetricsPublisher &) = delete;
+  MetricsPublisher &operator=(const MetricsPublisher &) = delete;
+
+  MetricsSegment *_segment;
+  std::string _name;
+};
+
+class MetricsReader {
+public:
+  MetricsReader();
+  ~MetricsReader();
+
+  bool open(const std::string &name);
+  void close();
+
+  // False when no consistent copy could be taken after a number of tries
+  // or the segment was closed by its scene.
+  bool read(MetricsSnapshot &snapshot);
+
+private:
+  MetricsReader(const MetricsReader &) = delete;
+  MetricsReader &operator=(const MetricsReader &) = delete;
+
+  const MetricsSegment *_segment;
+};
+
+#endif
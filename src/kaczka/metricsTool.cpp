@@ -0,0 +1,128 @@
+#include "metrics.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+static void printCounter(const char *name, const char *help,
+    uint64_t value) {
+  cout << "# HELP kaczka_" << name << "_total " << help << endl
+    << "# TYPE kaczka_" << name << "_total counter" << endl
+    << "kaczka_" << name << "_total " << value << endl;
+}
+
+static void printGauge(const char *name, const char *help, int value) {
+  cout << "# HELP kaczka_" << name << " " << help << endl
+    << "# TYPE kaczka_" << name << " gauge" << endl
+    << "kaczka_" << name << " " << value << endl;
+}
+
+static void printHistogram(const char *name, const char *help,
+    const MetricsHistogram &histogram) {
+  cout << "# HELP kaczka_" << name << "_seconds " << help << endl
+    << "# TYPE kaczka_" << name << "_seconds histogram" << endl;
+  uint64_t cumulative = 0;
+  for (auto bucket = 0; bucket < cMetricsNumBuckets; ++bucket) {
+    cumulative += histogram.buckets[bucket];
+    auto bound = getMetricsBucketBound(bucket);
+    cout << "kaczka_" << name << "_seconds_bucket{le=\"";
+    if (std::isinf(bound)) {
+      cout << "+Inf";
+    } else {
+      cout << bound;
+    }
+    cout << "\"} " << cumulative << endl;
+  }
+  cout << "kaczka_" << name << "_seconds_sum " << histogram.sum << endl
+    << "kaczka_" << name << "_seconds_count " << histogram.count << endl;
+}
+
+static void printPercentiles(const char *name,
+    const MetricsHistogram &histogram) {
+  cout << name << " ms: p50 " << 1000.0 * getMetricsPercentile(histogram, 0.5)
+    << ", p90 " << 1000.0 * getMetricsPercentile(histogram, 0.9)
+    << ", p99 " << 1000.0 * getMetricsPercentile(histogram, 0.99)
+    << ", mean "
+    << (histogram.count ? 1000.0 * histogram.sum / histogram.count : 0.0)
+    << " over " << histogram.count << endl;
+}
+
+// Prints the metrics a running scene publishes, readably or in the
+// Prometheus text format for a scraper to collect.
+int main(int argc, char **argv) {
+  auto prometheus = false;
+  string name = "/kaczka-metrics";
+  auto usage = false;
+  for (auto i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--prometheus") == 0) {
+      prometheus = true;
+    } else if (argv[i][0] == '/') {
+      name = argv[i];
+    } else {
+      usage = true;
+    }
+  }
+  if (usage) {
+    cerr << "usage: " << argv[0] << " [--prometheus] [/segment]" << endl
+      << "Reads the metrics of the scene publishing /segment, by default"
+      << endl << "/kaczka-metrics." << endl;
+    return 1;
+  }
+
+  MetricsReader reader;
+  if (!reader.open(name)) {
+    return 1;
+  }
+  MetricsSnapshot snapshot;
+  if (!reader.read(snapshot)) {
+    cerr << "Cannot read the metrics, the scene closed them or keeps"
+      << " writing." << endl;
+    return 1;
+  }
+
+  if (prometheus) {
+    printCounter("frames", "Frames rendered.", snapshot.frames);
+    printCounter("simulation_steps",
+        "Water solver steps, every substep of every pool.",
+        snapshot.simulationSteps);
+    printCounter("uploaded_bytes", "Bytes uploaded to the GPU by the water.",
+        snapshot.uploadedBytes);
+    printCounter("draw_calls", "GL draw calls issued.", snapshot.drawCalls);
+    // Left out of scenes not built to count them rather than reported as
+    // a counter stuck at zero.
+    if (snapshot.countsAllocations) {
+      printCounter("allocations", "Heap allocations.", snapshot.allocations);
+    }
+    printGauge("active_tiles", "Water tiles simulated in the last step.",
+        snapshot.activeTiles);
+    printGauge("quality_level", "Quality level of the frame governor.",
+        snapshot.qualityLevel);
+    printGauge("grid_resolution", "Water grid resolution.",
+        snapshot.gridResolution);
+    printGauge("ducks", "Ducks in the pool.", snapshot.numDucks);
+    printHistogram("frame_time", "Time between frames.", snapshot.frameTime);
+    printHistogram("step_time",
+        "Time of a water update with all its substeps.", snapshot.stepTime);
+    return 0;
+  }
+
+  cout << "frames " << snapshot.frames << endl
+    << "simulation steps " << snapshot.simulationSteps << endl
+    << "uploaded bytes " << snapshot.uploadedBytes << endl
+    << "draw calls " << snapshot.drawCalls << endl;
+  if (snapshot.countsAllocations) {
+    cout << "allocations " << snapshot.allocations << endl;
+  } else {
+    cout << "allocations not counted" << endl;
+  }
+  cout << "active tiles " << snapshot.activeTiles << endl
+    << "quality level " << snapshot.qualityLevel << endl
+    << "grid resolution " << snapshot.gridResolution << endl
+    << "ducks " << snapshot.numDucks << endl;
+  printPercentiles("frame time", snapshot.frameTime);
+  printPercentiles("step time", snapshot.stepTime);
+  return 0;
+}
@@ -0,0 +1,114 @@
+#include "oceanSpectrum.hpp"
+#include "parallel.hpp"
+
+#include <cmath>
+#include <random>
+
+using namespace std;
+
+static const float cGravity = 9.81f;
+
+OceanSpectrum::OceanSpectrum() : _width(0), _height(0), _amplitude(0.0f) {
+}
+
+void OceanSpectrum::create(int width, int height, float patchWidth,
+    float patchLength, glm::vec2 wind, float amplitude, unsigned int seed) {
+  _width = width;
+  _height = height;
+  _wind = wind;
+  _amplitude = amplitude;
+  _fft.create(width, height);
+
+  auto total = width * height;
+  _waveVectors.resize(total);
+  _angularFrequencies.resize(total);
+  _h0.resize(total);
+  _h0MinusConjugate.resize(total);
+  _heightSlopeX.resize(total);
+  _slopeXImaginary.resize(total);
+  _slopeZ.resize(total);
+  _slopeZImaginary.resize(total);
+
+  mt19937 generator(seed);
+  normal_distribution<float> gaussian(0.0f, 1.0f);
+
+  // Index n holds frequency n below the Nyquist index and n - size above,
+  // so the inverse transform yields samples at multiples of size/patch.
+  for (auto y = 0; y < height; ++y) {
+    for (auto x = 0; x < width; ++x) {
+      auto nx = x < width / 2 ? x : x - width;
+      auto ny = y < height / 2 ? y : y - height;
+      glm::vec2 k(2.0f * (float)M_PI * nx / patchWidth,
+          2.0f * (float)M_PI * ny / patchLength);
+      auto index = y * width + x;
+      _waveVectors[index] = k;
+      _angularFrequencies[index] = sqrtf(cGravity * glm::length(k));
+
+      float amplitudeScale = sqrtf(0.5f * phillips(k));
+      _h0[index] = glm::vec2(gaussian(generator), gaussian(generator))
+        * amplitudeScale;
+    }
+  }
+
+  for (auto y = 0; y < height; ++y) {
+    for (auto x = 0; x < width; ++x) {
+      auto mirrored = ((height - y) % height) * width + (width - x) % width;
+      auto h0 = _h0[mirrored];
+      _h0MinusConjugate[y * width + x] = glm::vec2(h0.x, -h0.y);
+    }
+  }
+}
+
+void OceanSpectrum::evaluate(float time) {
+  parallelFor(0, _height, [this, time](int first, int last) {
+    evaluateRows(time, first, last);
+  });
+
+  _fft.inverse(_heightSlopeX, _slopeXImaginary);
+  _fft.inverse(_slopeZ, _slopeZImaginary);
+}
+
+void OceanSpectrum::evaluateRows(float time, int firstRow, int lastRow) {
+  for (auto y = firstRow; y < lastRow; ++y) {
+    for (auto x = 0; x < _width; ++x) {
+      auto index = y * _width + x;
+      float phase = _angularFrequencies[index] * time;
+      float c = cosf(phase), s = sinf(phase);
+      const auto &a = _h0[index];
+      const auto &b = _h0MinusConjugate[index];
+
+      // h(k, t) = h0(k) e^(iwt) + conj(h0(-k)) e^(-iwt)
+      float hr = (a.x + b.x) * c - (a.y - b.y) * s;
+      float hi = (a.y + b.y) * c + (a.x - b.x) * s;
+
+      // Slopes i*k*h lose their conjugate symmetry on the Nyquist row
+      // and column, so those frequencies do not contribute to them.
+      auto k = _waveVectors[index];
+      if (x == _width / 2) k.x = 0.0f;
+      if (y == _height / 2) k.y = 0.0f;
+
+      // Real outputs h and dh/dx are packed as h + i*dh/dx.
+      _heightSlopeX[index] = hr - k.x * hr;
+      _slopeXImaginary[index] = hi - k.x * hi;
+      _slopeZ[index] = -k.y * hi;
+      _slopeZImaginary[index] = k.y * hr;
+    }
+  }
+}
+
+float OceanSpectrum::phillips(glm::vec2 k) {
+  float kLength = glm::length(k);
+  if (kLength < 1e-6f) {
+    return 0.0f;
+  }
+
+  float windSpeed = glm::length(_wind);
+  float largestWave = windSpeed * windSpeed / cGravity;
+  float kDotWind = glm::dot(k / kLength, _wind / max(windSpeed, 1e-6f));
+  float k2 = kLength * kLength;
+
+  // Waves much shorter than the grid resolution are damped out.
+  float smallWave = 0.001f * largestWave;
+  return _amplitude * expf(-1.0f / (k2 * largestWave * largestWave))
+    / (k2 * k2) * kDotWind * kDotWind * expf(-k2 * smallWave * smallWave);
+}
@@ -0,0 +1,46 @@
+#ifndef __OCEAN_SPECTRUM_HPP__
+#define __OCEAN_SPECTRUM_HPP__
+
+#include "fft.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Tessendorf style ocean patch. Initial amplitudes follow the Phillips
+// spectrum for the given wind; every evaluation advances them with the
+// deep water dispersion relation and brings heights and slopes back to
+// the spatial domain with two inverse FFTs.
+class OceanSpectrum {
+public:
+  OceanSpectrum();
+
+  void create(int width, int height, float patchWidth, float patchLength,
+      glm::vec2 wind, float amplitude, unsigned int seed);
+  void evaluate(float time);
+
+  inline const std::vector<float> &getHeights() { return _heightSlopeX; }
+  inline const std::vector<float> &getSlopesX() { return _slopeXImaginary; }
+  inline const std::vector<float> &getSlopesZ() { return _slopeZ; }
+
+protected:
+  float phillips(glm::vec2 k);
+  void evaluateRows(float time, int firstRow, int lastRow);
+
+private:
+  int _width, _height;
+  glm::vec2 _wind;
+  float _amplitude;
+
+  std::vector<glm::vec2> _waveVectors;
+  std::vector<float> _angularFrequencies;
+  std::vector<glm::vec2> _h0, _h0MinusConjugate;
+
+  // Heights and x slopes share one transform as its real and imaginary
+  // parts; z slopes use a second one.
+  std::vector<float> _heightSlopeX, _slopeXImaginary;
+  std::vector<float> _slopeZ, _slopeZImaginary;
+
+  FFT2D _fft;
+};
+
+#endif
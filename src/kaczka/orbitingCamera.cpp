@@ -11,6 +11,12 @@ OrbitingCamera::OrbitingCamera() :
   _xMin(-0.5f*M_PI), _xMax(0.5f*M_PI),
   _dist(1.0f),
   _rotationX(0.0f), _rotationY(0.0f) {
+  updateView();
+}
+
+void OrbitingCamera::setDist(float dist) {
+  _dist = dist;
+  updateView();
 }
 
 void OrbitingCamera::rotate(float dx, float dy) {
@@ -29,22 +35,17 @@ void OrbitingCamera::rotate(float dx, float dy) {
     _rotationY -= 2.0f*M_PI;
   while (_rotationY < -2.0f*M_PI)
     _rotationY += 2.0f*M_PI;
- 
-}
 
-glm::mat4 OrbitingCamera::getViewMatrix() {
-  return glm::lookAt(
-      glm::vec3(getPosition()),
-      glm::vec3(0.0f, 0.0f, 0.0f),
-      glm::vec3(0.0f, 1.0f, 0.0f)
-    );
+  updateView();
 }
 
-glm::vec3 OrbitingCamera::getPosition() {
-  glm::vec4 cameraStartPosition(0.0f, 0.0f, -_dist, 1.0f);
-  glm::mat4 cameraPositionTransform = glm::rotate(glm::mat4(1.0f),
-    _rotationY, glm::vec3(0.0f, 1.0f, 0.0f));
-  cameraPositionTransform = glm::rotate(cameraPositionTransform,
-    _rotationX, glm::vec3(1.0f, 0.0f, 0.0f));
-  return cameraPositionTransform * cameraStartPosition;
+// The start position (0, 0, -dist) turned about x, then about y.
+void OrbitingCamera::updateView() {
+  auto horizontalDist = _dist * cosf(_rotationX);
+  _position = glm::vec3(
+      -horizontalDist * sinf(_rotationY),
+      _dist * sinf(_rotationX),
+      -horizontalDist * cosf(_rotationY));
+  _viewMatrix = glm::lookAt(_position, glm::vec3(0.0f, 0.0f, 0.0f),
+      glm::vec3(0.0f, 1.0f, 0.0f));
 }
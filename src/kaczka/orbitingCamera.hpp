@@ -2,6 +2,7 @@
 #define __ORBITING_CAMERA_HPP__
 
 #include <glm/mat4x4.hpp>
+#include <glm/vec3.hpp>
 
 class OrbitingCamera {
 public:
@@ -11,17 +12,22 @@ public:
   inline void setMaxXRotation(float max) { _xMax = max; }
 
   inline float getDist() { return _dist; }
-  inline void setDist(float dist) { _dist = dist; }
+  void setDist(float dist);
 
   void rotate(float dx, float dy);
 
-  glm::mat4 getViewMatrix();
-  glm::vec3 getPosition();
+  // Both are kept up to date by rotate and setDist, reading them is free.
+  inline const glm::mat4 &getViewMatrix() const { return _viewMatrix; }
+  inline const glm::vec3 &getPosition() const { return _position; }
 
 private:
+  void updateView();
+
   float _xMin, _xMax;
   float _dist;
   float _rotationX, _rotationY;
+  glm::vec3 _position;
+  glm::mat4 _viewMatrix;
 };
 
 #endif
@@ -0,0 +1,58 @@
+#ifndef __PARALLEL_HPP__
+#define __PARALLEL_HPP__
+
+#include "jobScheduler.hpp"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+template <typename Body>
+void runParallelForRange(void *context, int first, int last) {
+  (*(Body*)context)(first, last);
+}
+
+// Splits [begin, end) into one contiguous range per hardware thread and
+// calls body(first, last) for each of them, the calling thread included.
+// Ranges run as jobs of the global scheduler when there is one.
+template <typename Body>
+void parallelFor(int begin, int end, Body body) {
+  auto scheduler = JobScheduler::getGlobal();
+  int numThreads = scheduler ? scheduler->getNumThreads()
+    : std::max(1u, std::thread::hardware_concurrency());
+  int count = end - begin;
+  numThreads = std::min(numThreads, count);
+  if (numThreads <= 1) {
+    if (count > 0) {
+      body(begin, end);
+    }
+    return;
+  }
+
+  if (scheduler) {
+    JobCounter counter;
+    for (auto i = 1; i < numThreads; ++i) {
+      int first = begin + (long long)count * i / numThreads;
+      int last = begin + (long long)count * (i + 1) / numThreads;
+      scheduler->submit(runParallelForRange<Body>, &body, first, last,
+          counter);
+    }
+    body(begin, begin + count / numThreads);
+    scheduler->wait(counter);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+  for (auto i = 1; i < numThreads; ++i) {
+    int first = begin + (long long)count * i / numThreads;
+    int last = begin + (long long)count * (i + 1) / numThreads;
+    threads.push_back(std::thread(body, first, last));
+  }
+  body(begin, begin + count / numThreads);
+  for (auto &thread : threads) {
+    thread.join();
+  }
+}
+
+#endif
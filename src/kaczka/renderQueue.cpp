@@ -0,0 +1,211 @@
+#include "renderQueue.hpp"
+
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define USE_SSE_CULLING
+#endif
+
+using namespace std;
+
+static const float cUnbounded = 1e30f;
+
+static glm::vec4 getRow(const glm::mat4 &matrix, int row) {
+  return glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row],
+      matrix[3][row]);
+}
+
+void extractFrustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6]) {
+  auto w = getRow(viewProj, 3);
+  for (auto i = 0; i < 3; ++i) {
+    auto row = getRow(viewProj, i);
+    planes[2 * i] = w + row;
+    planes[2 * i + 1] = w - row;
+  }
+}
+
+// A box is outside a plane when its corner furthest along the normal is,
+// max(a * minX, a * maxX) picks that corner's term without branches.
+void cullBoxes(const glm::vec4 planes[6], const BoxBatch &boxes,
+    unsigned char *visible) {
+#ifdef USE_SSE_CULLING
+  auto zero = _mm_setzero_ps();
+  for (auto i = 0; i < boxes.count; i += 4) {
+    auto minX = _mm_loadu_ps(boxes.minX + i);
+    auto minY = _mm_loadu_ps(boxes.minY + i);
+    auto minZ = _mm_loadu_ps(boxes.minZ + i);
+    auto maxX = _mm_loadu_ps(boxes.maxX + i);
+    auto maxY = _mm_loadu_ps(boxes.maxY + i);
+    auto maxZ = _mm_loadu_ps(boxes.maxZ + i);
+
+    auto outside = zero;
+    for (auto p = 0; p < 6; ++p) {
+      auto a = _mm_set1_ps(planes[p].x);
+      auto b = _mm_set1_ps(planes[p].y);
+      auto c = _mm_set1_ps(planes[p].z);
+      auto d = _mm_set1_ps(planes[p].w);
+      auto distance = _mm_add_ps(
+          _mm_add_ps(_mm_max_ps(_mm_mul_ps(a, minX), _mm_mul_ps(a, maxX)),
+            _mm_max_ps(_mm_mul_ps(b, minY), _mm_mul_ps(b, maxY))),
+          _mm_add_ps(_mm_max_ps(_mm_mul_ps(c, minZ), _mm_mul_ps(c, maxZ)),
+            d));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+    }
+
+    auto mask = _mm_movemask_ps(outside);
+    auto last = min(4, boxes.count - i);
+    for (auto j = 0; j < last; ++j) {
+      visible[i + j] = ((mask >> j) & 1) == 0;
+    }
+  }
+#else
+  for (auto i = 0; i < boxes.count; ++i) {
+    auto inside = true;
+    for (auto p = 0; p < 6 && inside; ++p) {
+      const auto &plane = planes[p];
+      auto distance = max(plane.x * boxes.minX[i], plane.x * boxes.maxX[i])
+        + max(plane.y * boxes.minY[i], plane.y * boxes.maxY[i])
+        + max(plane.z * boxes.minZ[i], plane.z * boxes.maxZ[i])
+        + plane.w;
+      inside = distance >= 0.0f;
+    }
+    visible[i] = inside;
+  }
+#endif
+}
+
+RenderQueue::RenderQueue() {
+  _stats = RenderQueueStats();
+}
+
+int RenderQueue::add(const RenderObject &object) {
+  auto id = (int)_objects.size();
+  _objects.push_back(object);
+  _enabled.push_back(1);
+
+  // Bounds stay padded to whole groups of 4 for cullBoxes.
+  auto padded = (id + 4) & ~3;
+  _minX.resize(padded, 0.0f);
+  _minY.resize(padded, 0.0f);
+  _minZ.resize(padded, 0.0f);
+  _maxX.resize(padded, 0.0f);
+  _maxY.resize(padded, 0.0f);
+  _maxZ.resize(padded, 0.0f);
+  setBounds(id, glm::vec3(-cUnbounded), glm::vec3(cUnbounded));
+  return id;
+}
+
+void RenderQueue::setBounds(int id, const glm::vec3 &minimum,
+    const glm::vec3 &maximum) {
+  _minX[id] = minimum.x;
+  _minY[id] = minimum.y;
+  _minZ[id] = minimum.z;
+  _maxX[id] = maximum.x;
+  _maxY[id] = maximum.y;
+  _maxZ[id] = maximum.z;
+}
+
+void RenderQueue::setBoundingSphere(int id, const glm::vec3 &center,
+    float radius) {
+  setBounds(id, center - glm::vec3(radius), center + glm::vec3(radius));
+}
+
+void RenderQueue::setEnabled(int id, bool enabled) {
+  _enabled[id] = enabled;
+}
+
+void RenderQueue::setProgramSetup(GLuint program, RenderFunction setup,
+    void *context) {
+  for (auto &programSetup : _programSetups) {
+    if (programSetup.program == program) {
+      programSetup.setup = setup;
+      programSetup.context = context;
+      return;
+    }
+  }
+  _programSetups.push_back({program, setup, context});
+}
+
+void RenderQueue::setupProgram(GLuint program, const RenderView &view) {
+  for (const auto &programSetup : _programSetups) {
+    if (programSetup.program == program) {
+      programSetup.setup(programSetup.context, 0, view);
+      return;
+    }
+  }
+}
+
+void RenderQueue::draw(const RenderView &view) {
+  _stats = RenderQueueStats();
+  auto count = (int)_objects.size();
+  if (count == 0) {
+    return;
+  }
+
+  glm::vec4 planes[6];
+  extractFrustumPlanes(view.viewProj, planes);
+  auto visible = view.frameArena->allocate<unsigned char>(count);
+  BoxBatch boxes = { &_minX[0], &_minY[0], &_minZ[0],
+    &_maxX[0], &_maxY[0], &_maxZ[0], count };
+  cullBoxes(planes, boxes, visible);
+
+  // Layer, program and texture in the high bits, truncated names only
+  // cost some grouping. The object index takes the low half.
+  auto keys = view.frameArena->allocate<uint64_t>(count);
+  auto numVisible = 0;
+  for (auto i = 0; i < count; ++i) {
+    if (!visible[i] || !_enabled[i]) {
+      continue;
+    }
+    const auto &object = _objects[i];
+    keys[numVisible++] = (uint64_t)object.layer << 60
+      | (uint64_t)(object.program & 0xfff) << 48
+      | (uint64_t)(object.texture & 0xffff) << 32
+      | (uint64_t)i;
+  }
+  sort(keys, keys + numVisible);
+  _stats.visible = numVisible;
+  _stats.culled = count - numVisible;
+
+  GLuint boundProgram = 0, boundTexture = 0;
+  GLenum boundTarget = 0;
+  auto inSky = false;
+  for (auto k = 0; k < numVisible; ++k) {
+    const auto &object = _objects[keys[k] & 0xffffffffu];
+    if (object.layer == RenderLayer::Sky && !inSky) {
+      glDepthFunc(GL_LEQUAL);
+      glDepthMask(GL_FALSE);
+      inSky = true;
+    }
+
+    if (object.program != 0) {
+      if (object.program != boundProgram) {
+        glUseProgram(object.program);
+        setupProgram(object.program, view);
+        boundProgram = object.program;
+        ++_stats.programChanges;
+      }
+      if (object.texture != 0 && (object.texture != boundTexture
+            || object.textureTarget != boundTarget)) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(object.textureTarget, object.texture);
+        boundTexture = object.texture;
+        boundTarget = object.textureTarget;
+        ++_stats.textureChanges;
+      }
+    }
+
+    object.draw(object.context, object.index, view);
+
+    if (object.program == 0) {
+      boundProgram = 0;
+      boundTexture = 0;
+    }
+  }
+
+  if (inSky) {
+    glDepthFunc(GL_LESS);
+    glDepthMask(GL_TRUE);
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef __RENDER_QUEUE_HPP__
+#define __RENDER_QUEUE_HPP__
+
+#include "allocators.hpp"
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <vector>
+
+struct RenderView {
+  glm::mat4 viewProj;
+  glm::vec3 cameraPosition;
+  LinearArena *frameArena;
+  // Draw functions add the GL draw calls they issue.
+  int *drawCalls;
+};
+
+typedef void (*RenderFunction)(void *context, int index,
+    const RenderView &view);
+
+// Layers are drawn in order. The sky goes last with depth writes off and
+// a less-or-equal test, so only pixels nothing else covered are shaded;
+// its shader puts it on the far plane.
+enum class RenderLayer {
+  Opaque,
+  Sky
+};
+
+struct RenderObject {
+  RenderLayer layer;
+  // Objects that bind their own program and textures leave program at 0.
+  GLuint program;
+  GLenum textureTarget;
+  GLuint texture;
+  RenderFunction draw;
+  void *context;
+  int index;
+};
+
+// Axis aligned boxes as one array per coordinate, readable up to count
+// rounded up to a multiple of 4.
+struct BoxBatch {
+  const float *minX, *minY, *minZ;
+  const float *maxX, *maxY, *maxZ;
+  int count;
+};
+
+// Planes point inwards, ax + by + cz + d >= 0 inside.
+void extractFrustumPlanes(const glm::mat4 &viewProj, glm::vec4 planes[6]);
+
+// Sets visible[i] unless box i is entirely outside one of the planes.
+// Boxes crossing a corner of the frustum outside of it are kept.
+void cullBoxes(const glm::vec4 planes[6], const BoxBatch &boxes,
+    unsigned char *visible);
+
+struct RenderQueueStats {
+  int visible;
+  int culled;
+  int programChanges;
+  int textureChanges;
+};
+
+// Objects are registered once and their bounds updated when they move.
+// Every frame the visible ones are sorted by layer, program and texture,
+// and drawn with a state change only where these differ.
+class RenderQueue {
+public:
+  RenderQueue();
+
+  // Objects start unbounded, they are never culled.
+  int add(const RenderObject &object);
+  void setBounds(int id, const glm::vec3 &minimum, const glm::vec3 &maximum);
+  void setBoundingSphere(int id, const glm::vec3 &center, float radius);
+  // Disabled objects are skipped and counted as culled.
+  void setEnabled(int id, bool enabled);
+
+  // Called after the program is bound, for uniforms shared by its objects.
+  void setProgramSetup(GLuint program, RenderFunction setup, void *context);
+
+  // Scratch arrays of the frame come from the arena of the view.
+  void draw(const RenderView &view);
+
+  inline const RenderQueueStats &getStats() { return _stats; }
+
+private:
+  struct ProgramSetup {
+    GLuint program;
+    RenderFunction setup;
+    void *context;
+  };
+
+  void setupProgram(GLuint program, const RenderView &view);
+
+  std::vector<RenderObject> _objects;
+  std::vector<float> _minX, _minY, _minZ, _maxX, _maxY, _maxZ;
+  std::vector<unsigned char> _enabled;
+  std::vector<ProgramSetup> _programSetups;
+  RenderQueueStats _stats;
+};
+
+#endif
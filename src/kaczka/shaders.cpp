@@ -2,17 +2,14 @@
 #include "config.hpp"
 #include <cstdio>
 #include <iostream>
+#include <utility>
 
 using namespace std;
 
-Shader::Shader() : _shaderType(0), _shaderId(0) {
+Shader::Shader() : _shaderType(0) {
 }
 
 Shader::~Shader() {
-  if (!_shaderId) {
-    glDeleteShader(_shaderId);
-    _shaderId = 0;
-  }
 }
 
 void Shader::loadShaderFromFile(GLenum shaderType, string filename) {
@@ -30,23 +27,23 @@ void Shader::loadShaderFromFile(GLenum shaderType, string filename) {
   shaderCode[size] = 0;
   fclose(f);
 
-  GLuint shader = glCreateShader(shaderType);
-  glShaderSource(shader, 1, &shaderCode, nullptr); 
-  glCompileShader(shader);
+  GLShader shader(glCreateShader(shaderType));
+  glShaderSource(shader.get(), 1, &shaderCode, nullptr); 
+  glCompileShader(shader.get());
   delete[] shaderCode;
 
   GLint success;
   GLchar infoLog[512];
-  glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+  glGetShaderiv(shader.get(), GL_COMPILE_STATUS, &success);
   if (!success) {
-    glGetShaderInfoLog(shader, 512, nullptr, infoLog);
+    glGetShaderInfoLog(shader.get(), 512, nullptr, infoLog);
     std::cout << "Error: Shader compilation failed" << std::endl 
       << infoLog << std::endl;
     return; // todo: throw exception
   }
 
   _shaderType = shaderType;
-  _shaderId = shader;
+  _shader = move(shader);
 }
 
 VertexShader::VertexShader(const char *filename) {
@@ -63,29 +60,30 @@ FragmentShader::FragmentShader(const char *filename) {
 FragmentShader::~FragmentShader() {
 }
 
-ShaderProgram::ShaderProgram() {
-  _program = glCreateProgram();
+ComputeShader::ComputeShader(const char *filename) {
+  loadShaderFromFile(GL_COMPUTE_SHADER, filename);
 }
 
-ShaderProgram::~ShaderProgram() {
-  if (_program) {
-    glDeleteProgram(_program);
-    _program = 0;
-  }
+ComputeShader::~ComputeShader() {
+}
+
+ShaderProgram::ShaderProgram() :
+  _program(GLProgram::create()), _linked(false) {
 }
 
 void ShaderProgram::attach(Shader *shader) {
-  glAttachShader(_program, shader->getId());
+  glAttachShader(_program.get(), shader->getId());
 }
 
 void ShaderProgram::link() {
-  glLinkProgram(_program);
+  glLinkProgram(_program.get());
 
   GLint success;
   GLchar infoLog[512];
-  glGetProgramiv(_program, GL_LINK_STATUS, &success);
+  glGetProgramiv(_program.get(), GL_LINK_STATUS, &success);
+  _linked = success != 0;
   if (!success) {
-      glGetProgramInfoLog(_program, 512, NULL, infoLog);
+      glGetProgramInfoLog(_program.get(), 512, NULL, infoLog);
       std::cout << "Error: Shader link" << std::endl << infoLog << std::endl;
   }
 }
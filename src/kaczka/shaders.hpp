@@ -1,24 +1,25 @@
 #ifndef __SHADER_HPP__
 #define __SHADER_HPP__
 
+#include "glHandles.hpp"
+
 #include <GL/glew.h>
 #include <string>
 
 class Shader {
 public:
   Shader();
-  Shader(const Shader &shader) = default;
   virtual ~Shader();
 
   GLenum getType() { return _shaderType; }
-  GLuint getId() { return _shaderId; }
+  GLuint getId() { return _shader.get(); }
 
 protected:
   void loadShaderFromFile(GLenum shaderType, std::string filename);
 
 private:
   GLenum _shaderType;
-  GLuint _shaderId;
+  GLShader _shader;
 };
 
 class VertexShader : public Shader {
@@ -33,17 +34,25 @@ public:
   virtual ~FragmentShader();
 };
 
+// Needs a GL 4.3 context.
+class ComputeShader : public Shader {
+public:
+  ComputeShader(const char *filename);
+  virtual ~ComputeShader();
+};
+
 class ShaderProgram {
 public:
   ShaderProgram();
-  ~ShaderProgram();
 
   void attach(Shader *shader);
   void link();
-  GLuint getId() { return _program; }
+  GLuint getId() { return _program.get(); }
+  inline bool isLinked() { return _linked; }
 
 private:
-  GLuint _program;
+  GLProgram _program;
+  bool _linked;
 };
 
 #endif
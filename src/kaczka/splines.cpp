@@ -1,17 +1,17 @@
 #include "splines.hpp"
+#include <cassert>
 #include <cmath>
 #include <iostream>
 
 using namespace std;
 
-vector<float> buildEquidistantKnotVector(int numControlPoints, 
-    int degree) {
+void buildEquidistantKnotVector(int numControlPoints, int degree,
+    vector<float> &knots) {
   auto intervals = numControlPoints + degree;
-  vector<float> knots(intervals + 1);
+  knots.resize(intervals + 1);
   for (auto i = 0; i < intervals + 1; ++i) {
     knots[i] = ((float)i)/intervals;
   }
-  return knots;
 }
 
 float bsplineBasis(int i, int degree, const vector<float> &knots, 
@@ -49,17 +49,15 @@ BSpline2D::~BSpline2D() {
 void BSpline2D::setControlPoints(const vector<glm::vec2> &controlPoints) {
   assert(controlPoints.size() >= 4);
   _controlPoints = controlPoints;
-  _knots = buildEquidistantKnotVector(controlPoints.size(), 3);
-  calculateDerivativeControlPoints();
+  updateControlPoints();
 }
 
 void BSpline2D::setLoopedControlPoints(const vector<glm::vec2> &controlPoints) {
   assert(controlPoints.size() >= 3);
-  vector<glm::vec2> loopedControlPoints(controlPoints);
-  for (auto i = 0; i < 3; ++i) {
-    loopedControlPoints.push_back(loopedControlPoints[i]);
-  }
-  setControlPoints(loopedControlPoints);
+  _controlPoints.assign(controlPoints.begin(), controlPoints.end());
+  _controlPoints.insert(_controlPoints.end(), controlPoints.begin(),
+      controlPoints.begin() + 3);
+  updateControlPoints();
 }
 
 glm::vec2 BSpline2D::evaluate(float t) {
@@ -82,6 +80,13 @@ glm::vec2 BSpline2D::derivative(float t) {
   return evaluated;
 }
 
+// Knots and derivative points are rebuilt in place, so setting control
+// points again reuses the storage of the previous ones.
+void BSpline2D::updateControlPoints() {
+  buildEquidistantKnotVector(_controlPoints.size(), _degree, _knots);
+  calculateDerivativeControlPoints();
+}
+
 void BSpline2D::calculateDerivativeControlPoints() {
   _derivativeControlPoints.clear();
   for (auto i = 0; i < _controlPoints.size() - 1; ++i) {
@@ -4,7 +4,8 @@
 #include <vector>
 #include <glm/glm.hpp>
 
-std::vector<float> buildEquidistantKnotVector(int numControlPoints, int degree);
+void buildEquidistantKnotVector(int numControlPoints, int degree,
+    std::vector<float> &knots);
 float bsplineBasis(int i, int degree, const std::vector<float> &knots, float t);
 
 class BSpline2D {
@@ -14,10 +15,16 @@ public:
 
   void setControlPoints(const std::vector<glm::vec2> &controlPoints);
   void setLoopedControlPoints(const std::vector<glm::vec2> &controlPoints);
+  // Looped splines give their points back with the first three repeated
+  // at the end, which setControlPoints takes as they are.
+  inline const std::vector<glm::vec2> &getControlPoints() {
+    return _controlPoints;
+  }
   glm::vec2 evaluate(float t);
   glm::vec2 derivative(float t);
 
 protected:
+  void updateControlPoints();
   void calculateDerivativeControlPoints();
   float nonVanishingIntervalCorrection(float t);
 
@@ -0,0 +1,54 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <atomic>
+
+// Fixed size lock free queue for exactly one producer and one consumer
+// thread. Push fails when the queue is full and pop when it is empty.
+template <typename T, unsigned int Capacity>
+class SpscQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0,
+      "SpscQueue capacity must be a power of two");
+
+public:
+  SpscQueue() : _head(0), _tail(0) {
+  }
+
+  bool push(const T &value) {
+    auto tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == Capacity) {
+      return false;
+    }
+    _items[tail % Capacity] = value;
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool pop(T &value) {
+    auto head = _head.load(std::memory_order_relaxed);
+    if (head == _tail.load(std::memory_order_acquire)) {
+      return false;
+    }
+    value = _items[head % Capacity];
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Only safe while neither side is using the queue.
+  void clear() {
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  T _items[Capacity];
+
+  // Indices grow without wrapping to a slot, so full and empty differ. A
+  // power of two capacity keeps slots in order when the counters overflow.
+  // Each one sits on its own cache line to keep the threads from
+  // invalidating each other's writes.
+  alignas(64) std::atomic<unsigned int> _head;
+  alignas(64) std::atomic<unsigned int> _tail;
+};
+
+#endif
@@ -0,0 +1,462 @@
+#include "textureCompression.hpp"
+#include "parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+namespace {
+
+const int cBC1BlockSize = 8;
+const int cRefinementPasses = 2;
+
+// The images are stored with gamma, levels are averaged over linear
+// intensities.
+const float cGamma = 2.2f;
+
+const unsigned char cKtxIdentifier[12] = {
+  0xab, 0x4b, 0x54, 0x58, 0x20, 0x31, 0x31, 0xbb, 0x0d, 0x0a, 0x1a, 0x0a
+};
+const uint32_t cKtxEndianness = 0x04030201;
+const uint32_t cGLRGB = 0x1907;
+
+struct KtxHeader {
+  unsigned char identifier[12];
+  uint32_t endianness;
+  uint32_t glType;
+  uint32_t glTypeSize;
+  uint32_t glFormat;
+  uint32_t glInternalFormat;
+  uint32_t glBaseInternalFormat;
+  uint32_t pixelWidth;
+  uint32_t pixelHeight;
+  uint32_t pixelDepth;
+  uint32_t numberOfArrayElements;
+  uint32_t numberOfFaces;
+  uint32_t numberOfMipmapLevels;
+  uint32_t bytesOfKeyValueData;
+};
+
+void unpackColor565(uint16_t color, int rgb[3]) {
+  auto r = (color >> 11) & 31;
+  auto g = (color >> 5) & 63;
+  auto b = color & 31;
+  rgb[0] = (r << 3) | (r >> 2);
+  rgb[1] = (g << 2) | (g >> 4);
+  rgb[2] = (b << 3) | (b >> 2);
+}
+
+uint16_t packColor565(const glm::vec3 &color) {
+  auto r = min(max((int)(color.x * 31.0f / 255.0f + 0.5f), 0), 31);
+  auto g = min(max((int)(color.y * 63.0f / 255.0f + 0.5f), 0), 63);
+  auto b = min(max((int)(color.z * 31.0f / 255.0f + 0.5f), 0), 31);
+  return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+// Four colors when c0 > c1, otherwise three and black.
+void buildPalette(uint16_t c0, uint16_t c1, int palette[4][3]) {
+  unpackColor565(c0, palette[0]);
+  unpackColor565(c1, palette[1]);
+  for (auto c = 0; c < 3; ++c) {
+    auto a = palette[0][c], b = palette[1][c];
+    if (c0 > c1) {
+      palette[2][c] = (2 * a + b) / 3;
+      palette[3][c] = (a + 2 * b) / 3;
+    } else {
+      palette[2][c] = (a + b) / 2;
+      palette[3][c] = 0;
+    }
+  }
+}
+
+// Orders the endpoints for four colors and picks the closest of them for
+// every texel, returning the squared error of the block.
+int fitIndices(const unsigned char *texels, uint16_t &c0, uint16_t &c1,
+    uint32_t &indices) {
+  if (c0 < c1) {
+    swap(c0, c1);
+  }
+  int palette[4][3];
+  buildPalette(c0, c1, palette);
+
+  indices = 0;
+  auto error = 0;
+  for (auto i = 0; i < 16; ++i) {
+    auto texel = texels + 3 * i;
+    auto best = 0, bestError = 0;
+    // With equal endpoints every entry but the black one is that color.
+    auto numEntries = c0 == c1 ? 1 : 4;
+    for (auto p = 0; p < numEntries; ++p) {
+      auto dr = texel[0] - palette[p][0];
+      auto dg = texel[1] - palette[p][1];
+      auto db = texel[2] - palette[p][2];
+      auto distance = dr * dr + dg * dg + db * db;
+      if (p == 0 || distance < bestError) {
+        best = p;
+        bestError = distance;
+      }
+    }
+    indices |= (uint32_t)best << (2 * i);
+    error += bestError;
+  }
+  return error;
+}
+
+// Endpoints minimizing the squared error for the chosen indices.
+bool solveEndpoints(const unsigned char *texels, uint32_t indices,
+    glm::vec3 &e0, glm::vec3 &e1) {
+  const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+  auto aa = 0.0f, ab = 0.0f, bb = 0.0f;
+  auto ax = glm::vec3(0.0f), bx = glm::vec3(0.0f);
+  for (auto i = 0; i < 16; ++i) {
+    auto w = weights[(indices >> (2 * i)) & 3];
+    auto x = glm::vec3(texels[3 * i], texels[3 * i + 1], texels[3 * i + 2]);
+    aa += w * w;
+    ab += w * (1.0f - w);
+    bb += (1.0f - w) * (1.0f - w);
+    ax += w * x;
+    bx += (1.0f - w) * x;
+  }
+  auto determinant = aa * bb - ab * ab;
+  if (fabsf(determinant) < 1e-6f) {
+    return false;
+  }
+  e0 = (bb * ax - ab * bx) / determinant;
+  e1 = (aa * bx - ab * ax) / determinant;
+  return true;
+}
+
+void writeBlock(uint16_t c0, uint16_t c1, uint32_t indices,
+    unsigned char *block) {
+  block[0] = (unsigned char)c0;
+  block[1] = (unsigned char)(c0 >> 8);
+  block[2] = (unsigned char)c1;
+  block[3] = (unsigned char)(c1 >> 8);
+  for (auto i = 0; i < 4; ++i) {
+    block[4 + i] = (unsigned char)(indices >> (8 * i));
+  }
+}
+
+}
+
+void encodeBC1Block(const unsigned char *texels, unsigned char *block) {
+  glm::vec3 colors[16];
+  auto mean = glm::vec3(0.0f);
+  auto minimum = glm::vec3(255.0f), maximum = glm::vec3(0.0f);
+  for (auto i = 0; i < 16; ++i) {
+    colors[i] = glm::vec3(texels[3 * i], texels[3 * i + 1],
+        texels[3 * i + 2]);
+    mean += colors[i];
+    minimum = glm::min(minimum, colors[i]);
+    maximum = glm::max(maximum, colors[i]);
+  }
+  mean /= 16.0f;
+
+  // The endpoints start at the ends of the principal axis of the colors,
+  // found by a few power iterations from the diagonal of their bounds.
+  auto axis = maximum - minimum;
+  if (glm::dot(axis, axis) > 0.0f) {
+    float covariance[6] = {};
+    for (auto &color : colors) {
+      auto d = color - mean;
+      covariance[0] += d.x * d.x;
+      covariance[1] += d.x * d.y;
+      covariance[2] += d.x * d.z;
+      covariance[3] += d.y * d.y;
+      covariance[4] += d.y * d.z;
+      covariance[5] += d.z * d.z;
+    }
+    for (auto i = 0; i < 4; ++i) {
+      auto next = glm::vec3(
+          covariance[0] * axis.x + covariance[1] * axis.y
+            + covariance[2] * axis.z,
+          covariance[1] * axis.x + covariance[3] * axis.y
+            + covariance[4] * axis.z,
+          covariance[2] * axis.x + covariance[4] * axis.y
+            + covariance[5] * axis.z);
+      auto length = glm::length(next);
+      if (length < 1e-6f) {
+        break;
+      }
+      axis = next / length;
+    }
+    axis = glm::normalize(axis);
+  }
+
+  auto lowest = 0.0f, highest = 0.0f;
+  for (auto &color : colors) {
+    auto t = glm::dot(color - mean, axis);
+    lowest = min(lowest, t);
+    highest = max(highest, t);
+  }
+
+  auto c0 = packColor565(mean + highest * axis);
+  auto c1 = packColor565(mean + lowest * axis);
+  uint32_t indices;
+  auto error = fitIndices(texels, c0, c1, indices);
+
+  for (auto pass = 0; pass < cRefinementPasses && error > 0; ++pass) {
+    glm::vec3 e0, e1;
+    if (!solveEndpoints(texels, indices, e0, e1)) {
+      break;
+    }
+    auto r0 = packColor565(e0), r1 = packColor565(e1);
+    uint32_t refinedIndices;
+    auto refinedError = fitIndices(texels, r0, r1, refinedIndices);
+    if (refinedError >= error) {
+      break;
+    }
+    c0 = r0;
+    c1 = r1;
+    indices = refinedIndices;
+    error = refinedError;
+  }
+
+  writeBlock(c0, c1, indices, block);
+}
+
+void decodeBC1Block(const unsigned char *block, unsigned char *texels) {
+  auto c0 = (uint16_t)(block[0] | block[1] << 8);
+  auto c1 = (uint16_t)(block[2] | block[3] << 8);
+  uint32_t indices = block[4] | block[5] << 8 | block[6] << 16
+    | (uint32_t)block[7] << 24;
+
+  int palette[4][3];
+  buildPalette(c0, c1, palette);
+  for (auto i = 0; i < 16; ++i) {
+    auto entry = palette[(indices >> (2 * i)) & 3];
+    texels[3 * i] = (unsigned char)entry[0];
+    texels[3 * i + 1] = (unsigned char)entry[1];
+    texels[3 * i + 2] = (unsigned char)entry[2];
+  }
+}
+
+CompressedTexture::CompressedTexture() :
+  width(0), height(0), numFaces(0), numLevels(0), format(cTextureFormatBC1) {
+}
+
+size_t CompressedTexture::getFaceSize(int level) const {
+  auto blocksX = (getLevelWidth(level) + 3) / 4;
+  auto blocksY = (getLevelHeight(level) + 3) / 4;
+  return (size_t)blocksX * blocksY * cBC1BlockSize;
+}
+
+size_t CompressedTexture::getTotalSize() const {
+  size_t size = 0;
+  for (auto &level : levels) {
+    size += level.size();
+  }
+  return size;
+}
+
+void compressTexture(const vector<const unsigned char*> &faces,
+    int width, int height, bool mipmaps, CompressedTexture &result) {
+  result.width = width;
+  result.height = height;
+  result.numFaces = (int)faces.size();
+  result.format = cTextureFormatBC1;
+  result.numLevels = 1;
+  while (mipmaps && (result.getLevelWidth(result.numLevels - 1) > 1
+        || result.getLevelHeight(result.numLevels - 1) > 1)) {
+    ++result.numLevels;
+  }
+  result.levels.assign(result.numLevels, vector<unsigned char>());
+
+  float toLinear[256];
+  for (auto i = 0; i < 256; ++i) {
+    toLinear[i] = powf(i / 255.0f, cGamma);
+  }
+
+  // Texels of the level being compressed, with gamma, and in linear space
+  // for the next level to be filtered from.
+  vector<unsigned char> texels((size_t)result.numFaces * width * height * 3);
+  vector<glm::vec3> linear, finer;
+  for (auto face = 0; face < result.numFaces; ++face) {
+    copy(faces[face], faces[face] + (size_t)3 * width * height,
+        &texels[(size_t)face * 3 * width * height]);
+  }
+  if (result.numLevels > 1) {
+    linear.resize((size_t)result.numFaces * width * height);
+    for (size_t i = 0; i < linear.size(); ++i) {
+      linear[i] = glm::vec3(toLinear[texels[3 * i]],
+          toLinear[texels[3 * i + 1]], toLinear[texels[3 * i + 2]]);
+    }
+  }
+
+  for (auto level = 0; level < result.numLevels; ++level) {
+    auto levelWidth = result.getLevelWidth(level);
+    auto levelHeight = result.getLevelHeight(level);
+
+    if (level > 0) {
+      auto finerWidth = result.getLevelWidth(level - 1);
+      auto finerHeight = result.getLevelHeight(level - 1);
+      finer.swap(linear);
+      linear.resize((size_t)result.numFaces * levelWidth * levelHeight);
+      texels.resize(linear.size() * 3);
+      parallelFor(0, result.numFaces * levelHeight,
+          [&](int firstRow, int lastRow) {
+        for (auto row = firstRow; row < lastRow; ++row) {
+          auto face = row / levelHeight;
+          auto y = row % levelHeight;
+          auto source = &finer[(size_t)face * finerWidth * finerHeight];
+          auto row0 = source + min(2 * y, finerHeight - 1) * finerWidth;
+          auto row1 = source + min(2 * y + 1, finerHeight - 1) * finerWidth;
+          for (auto x = 0; x < levelWidth; ++x) {
+            auto x0 = min(2 * x, finerWidth - 1);
+            auto x1 = min(2 * x + 1, finerWidth - 1);
+            auto color = 0.25f * (row0[x0] + row0[x1] + row1[x0] + row1[x1]);
+            auto index = (size_t)row * levelWidth + x;
+            linear[index] = color;
+            for (auto c = 0; c < 3; ++c) {
+              auto value = powf(min(max(color[c], 0.0f), 1.0f), 1.0f / cGamma);
+              texels[3 * index + c] = (unsigned char)(255.0f * value + 0.5f);
+            }
+          }
+        }
+      });
+    }
+
+    auto blocksX = (levelWidth + 3) / 4;
+    auto blocksY = (levelHeight + 3) / 4;
+    auto faceSize = result.getFaceSize(level);
+    auto &blocks = result.levels[level];
+    blocks.resize(faceSize * result.numFaces);
+    parallelFor(0, result.numFaces * blocksY, [&](int firstRow, int lastRow) {
+      unsigned char blockTexels[16 * 3];
+      for (auto row = firstRow; row < lastRow; ++row) {
+        auto face = row / blocksY;
+        auto by = row % blocksY;
+        auto source = &texels[(size_t)face * 3 * levelWidth * levelHeight];
+        for (auto bx = 0; bx < blocksX; ++bx) {
+          // Blocks over the edge of small levels repeat the last texels.
+          for (auto i = 0; i < 16; ++i) {
+            auto x = min(4 * bx + i % 4, levelWidth - 1);
+            auto y = min(4 * by + i / 4, levelHeight - 1);
+            memcpy(blockTexels + 3 * i, source + 3 * (y * levelWidth + x), 3);
+          }
+          encodeBC1Block(blockTexels, &blocks[face * faceSize
+              + ((size_t)by * blocksX + bx) * cBC1BlockSize]);
+        }
+      }
+    });
+  }
+}
+
+void decompressTextureLevel(const CompressedTexture &texture, int level,
+    int face, vector<unsigned char> &texels) {
+  auto width = texture.getLevelWidth(level);
+  auto height = texture.getLevelHeight(level);
+  auto blocksX = (width + 3) / 4;
+  auto blocksY = (height + 3) / 4;
+  auto blocks = &texture.levels[level][face * texture.getFaceSize(level)];
+  texels.resize((size_t)3 * width * height);
+
+  unsigned char blockTexels[16 * 3];
+  for (auto by = 0; by < blocksY; ++by) {
+    for (auto bx = 0; bx < blocksX; ++bx) {
+      decodeBC1Block(blocks + ((size_t)by * blocksX + bx) * cBC1BlockSize,
+          blockTexels);
+      for (auto i = 0; i < 16; ++i) {
+        auto x = 4 * bx + i % 4;
+        auto y = 4 * by + i / 4;
+        if (x < width && y < height) {
+          memcpy(&texels[3 * ((size_t)y * width + x)], blockTexels + 3 * i, 3);
+        }
+      }
+    }
+  }
+}
+
+bool saveKtx(const string &path, const CompressedTexture &texture) {
+  ofstream file(path, ios::binary | ios::trunc);
+  if (!file) {
+    cerr << "cannot write texture " << path << endl;
+    return false;
+  }
+
+  KtxHeader header;
+  memcpy(header.identifier, cKtxIdentifier, sizeof(cKtxIdentifier));
+  header.endianness = cKtxEndianness;
+  header.glType = 0;
+  header.glTypeSize = 1;
+  header.glFormat = 0;
+  header.glInternalFormat = texture.format;
+  header.glBaseInternalFormat = cGLRGB;
+  header.pixelWidth = texture.width;
+  header.pixelHeight = texture.height;
+  header.pixelDepth = 0;
+  header.numberOfArrayElements = 0;
+  header.numberOfFaces = texture.numFaces;
+  header.numberOfMipmapLevels = texture.numLevels;
+  header.bytesOfKeyValueData = 0;
+  file.write((const char*)&header, sizeof(header));
+
+  // Block sizes are multiples of 4 bytes, so there is no padding after
+  // faces or levels.
+  for (auto level = 0; level < texture.numLevels; ++level) {
+    auto imageSize = (uint32_t)texture.getFaceSize(level);
+    file.write((const char*)&imageSize, sizeof(imageSize));
+    file.write((const char*)&texture.levels[level][0],
+        texture.levels[level].size());
+  }
+  if (!file) {
+    cerr << "cannot write texture " << path << endl;
+    return false;
+  }
+  return true;
+}
+
+bool loadKtx(const string &path, CompressedTexture &texture) {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    return false;
+  }
+
+  KtxHeader header;
+  if (!file.read((char*)&header, sizeof(header))
+      || memcmp(header.identifier, cKtxIdentifier, sizeof(cKtxIdentifier))
+      || header.endianness != cKtxEndianness) {
+    cerr << path << " is not a little endian KTX file" << endl;
+    return false;
+  }
+  if (header.glType != 0 || header.glInternalFormat != cTextureFormatBC1
+      || header.pixelWidth == 0 || header.pixelHeight == 0
+      || header.pixelDepth > 1 || header.numberOfArrayElements != 0
+      || (header.numberOfFaces != 1 && header.numberOfFaces != 6)
+      || header.numberOfMipmapLevels == 0
+      || header.numberOfMipmapLevels > 32) {
+    cerr << "texture " << path << " has an unsupported format" << endl;
+    return false;
+  }
+  file.seekg(header.bytesOfKeyValueData, ios::cur);
+
+  CompressedTexture result;
+  result.width = header.pixelWidth;
+  result.height = header.pixelHeight;
+  result.numFaces = header.numberOfFaces;
+  result.numLevels = header.numberOfMipmapLevels;
+  result.format = header.glInternalFormat;
+  result.levels.resize(result.numLevels);
+  for (auto level = 0; level < result.numLevels; ++level) {
+    uint32_t imageSize = 0;
+    file.read((char*)&imageSize, sizeof(imageSize));
+    if (!file || imageSize != result.getFaceSize(level)) {
+      cerr << "damaged texture " << path << " at level " << level << endl;
+      return false;
+    }
+    auto &blocks = result.levels[level];
+    blocks.resize((size_t)imageSize * result.numFaces);
+    if (!file.read((char*)&blocks[0], blocks.size())) {
+      cerr << "truncated texture " << path << endl;
+      return false;
+    }
+  }
+
+  texture = move(result);
+  return true;
+}
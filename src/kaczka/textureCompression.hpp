@@ -0,0 +1,51 @@
+#ifndef __TEXTURE_COMPRESSION_HPP__
+#define __TEXTURE_COMPRESSION_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// GL_COMPRESSED_RGB_S3TC_DXT1_EXT, without pulling GL into the tools.
+const std::uint32_t cTextureFormatBC1 = 0x83f0;
+
+// BC1 blocks hold 4x4 RGB texels, row by row, in 8 bytes.
+void encodeBC1Block(const unsigned char *texels, unsigned char *block);
+void decodeBC1Block(const unsigned char *block, unsigned char *texels);
+
+// A 2D texture or a cubemap with its mip chain, every level stored as the
+// blocks of each face one after another.
+struct CompressedTexture {
+  int width, height;
+  int numFaces;
+  int numLevels;
+  std::uint32_t format;
+  std::vector<std::vector<unsigned char>> levels;
+
+  CompressedTexture();
+
+  inline int getLevelWidth(int level) const {
+    return width >> level > 0 ? width >> level : 1;
+  }
+  inline int getLevelHeight(int level) const {
+    return height >> level > 0 ? height >> level : 1;
+  }
+  std::size_t getFaceSize(int level) const;
+  std::size_t getTotalSize() const;
+};
+
+// Faces are RGB8 images of one size, in GL order for cubemaps. Levels are
+// box filtered in linear space down to 1x1 when mipmaps are asked for,
+// and block rows of each level are compressed in parallel.
+void compressTexture(const std::vector<const unsigned char*> &faces,
+    int width, int height, bool mipmaps, CompressedTexture &result);
+// RGB8 texels of one face of a level, for drivers without the format.
+void decompressTextureLevel(const CompressedTexture &texture, int level,
+    int face, std::vector<unsigned char> &texels);
+
+// KTX 1.1 files, as read by the common KTX tools. Only little endian files
+// of the formats above are accepted.
+bool saveKtx(const std::string &path, const CompressedTexture &texture);
+bool loadKtx(const std::string &path, CompressedTexture &texture);
+
+#endif
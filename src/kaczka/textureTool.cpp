@@ -0,0 +1,91 @@
+#include "textureCompression.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <SOIL/SOIL.h>
+
+using namespace std;
+
+// Compresses images into KTX files at build time, with their mip chain,
+// so the game uploads them as they are instead of converting them.
+int main(int argc, char **argv) {
+  auto cube = argc > 1 && strcmp(argv[1], "--cube") == 0;
+  auto firstArgument = cube ? 2 : 1;
+  auto numFaces = cube ? 6 : 1;
+  if (argc != firstArgument + 1 + numFaces) {
+    cerr << "usage: " << argv[0] << " <output.ktx> <image>" << endl
+      << "       " << argv[0] << " --cube <output.ktx> <+x> <-x> <+y> <-y>"
+      << " <+z> <-z>" << endl
+      << "Writes BC1 with a full mip chain, cubemaps with the top level"
+      << " only." << endl;
+    return 1;
+  }
+
+  vector<unsigned char*> images(numFaces, nullptr);
+  int width = 0, height = 0;
+  auto loaded = true;
+  for (auto i = 0; i < numFaces && loaded; ++i) {
+    auto path = argv[firstArgument + 1 + i];
+    int faceWidth, faceHeight;
+    images[i] = SOIL_load_image(path, &faceWidth, &faceHeight, 0,
+        SOIL_LOAD_RGB);
+    if (!images[i]) {
+      cerr << "cannot load image " << path << " reason: "
+        << SOIL_last_result() << endl;
+      loaded = false;
+    } else if (i > 0 && (faceWidth != width || faceHeight != height)) {
+      cerr << "cubemap face " << path << " is " << faceWidth << "x"
+        << faceHeight << ", faces must be of one size" << endl;
+      loaded = false;
+    }
+    width = faceWidth;
+    height = faceHeight;
+  }
+
+  CompressedTexture texture;
+  auto start = chrono::steady_clock::now();
+  if (loaded) {
+    vector<const unsigned char*> faces(images.begin(), images.end());
+    compressTexture(faces, width, height, !cube, texture);
+  }
+  auto seconds = chrono::duration<double>(chrono::steady_clock::now()
+      - start).count();
+
+  // Error of the top level against the source, as a peak signal to noise
+  // ratio over all channels.
+  auto sumSquares = 0.0;
+  vector<unsigned char> decoded;
+  for (auto face = 0; loaded && face < numFaces; ++face) {
+    decompressTextureLevel(texture, 0, face, decoded);
+    for (size_t i = 0; i < decoded.size(); ++i) {
+      auto d = (double)decoded[i] - images[face][i];
+      sumSquares += d * d;
+    }
+  }
+
+  for (auto image : images) {
+    if (image) {
+      SOIL_free_image_data(image);
+    }
+  }
+  if (!loaded || !saveKtx(argv[firstArgument], texture)) {
+    return 1;
+  }
+
+  // Drivers keep RGB8 texels in 4 bytes.
+  size_t uncompressedSize = 0;
+  for (auto level = 0; level < texture.numLevels; ++level) {
+    uncompressedSize += (size_t)4 * numFaces
+      * texture.getLevelWidth(level) * texture.getLevelHeight(level);
+  }
+  auto meanSquare = sumSquares / ((double)numFaces * width * height * 3);
+  cout << argv[firstArgument] << ": " << width << "x" << height << ", "
+    << numFaces << (numFaces > 1 ? " faces, " : " face, ")
+    << texture.numLevels << (texture.numLevels > 1 ? " levels, " : " level, ")
+    << texture.getTotalSize() << " bytes instead of " << uncompressedSize
+    << ", PSNR " << 10.0 * log10(255.0 * 255.0 / max(meanSquare, 1e-12))
+    << " dB, " << seconds * 1000.0 << " ms" << endl;
+  return 0;
+}
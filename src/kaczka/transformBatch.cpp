@@ -0,0 +1,127 @@
+#include "transformBatch.hpp"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define USE_SSE_TRANSFORMS
+#endif
+
+using namespace std;
+
+TransformBatch::TransformBatch() : _count(0) {
+}
+
+void TransformBatch::resize(int count) {
+  _count = count;
+  auto padded = (count + 3) & ~3;
+  x.resize(padded, 0.0f);
+  y.resize(padded, 0.0f);
+  z.resize(padded, 0.0f);
+  upX.resize(padded, 0.0f);
+  upY.resize(padded, 1.0f);
+  upZ.resize(padded, 0.0f);
+  headingX.resize(padded, 1.0f);
+  headingZ.resize(padded, 0.0f);
+  scale.resize(padded, 1.0f);
+  matrices.resize(12 * padded, 0.0f);
+}
+
+// Tilting y onto the up axis n is the rotation about y x n, written out
+// with k = 1 / (1 + n.y) instead of its angle:
+//   | 1 - k nx^2   nx   -k nx nz  |
+//   | -nx          ny   -nz       |
+//   | -k nx nz     nz   1 - k nz^2 |
+// The heading turns x onto (hx, 0, hz) and z onto (-hz, 0, hx), so the
+// first and last columns are the tilt applied to those.
+void buildTransforms(TransformBatch &batch) {
+  auto count = batch.size();
+  auto i = 0;
+#ifdef USE_SSE_TRANSFORMS
+  auto one = _mm_set1_ps(1.0f);
+  for (; i < count; i += 4) {
+    auto nx = _mm_loadu_ps(&batch.upX[i]);
+    auto ny = _mm_loadu_ps(&batch.upY[i]);
+    auto nz = _mm_loadu_ps(&batch.upZ[i]);
+    auto hx = _mm_loadu_ps(&batch.headingX[i]);
+    auto hz = _mm_loadu_ps(&batch.headingZ[i]);
+    auto s = _mm_loadu_ps(&batch.scale[i]);
+
+    auto k = _mm_div_ps(one, _mm_add_ps(one, ny));
+    auto knx = _mm_mul_ps(k, nx);
+    auto a = _mm_sub_ps(one, _mm_mul_ps(knx, nx));
+    auto b = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(knx, nz));
+    auto d = _mm_sub_ps(one, _mm_mul_ps(_mm_mul_ps(k, nz), nz));
+
+    auto m00 = _mm_mul_ps(s,
+        _mm_add_ps(_mm_mul_ps(a, hx), _mm_mul_ps(b, hz)));
+    auto m01 = _mm_mul_ps(s, nx);
+    auto m02 = _mm_mul_ps(s,
+        _mm_sub_ps(_mm_mul_ps(b, hx), _mm_mul_ps(a, hz)));
+    auto m03 = _mm_loadu_ps(&batch.x[i]);
+    auto m10 = _mm_mul_ps(s,
+        _mm_sub_ps(_mm_setzero_ps(),
+          _mm_add_ps(_mm_mul_ps(nx, hx), _mm_mul_ps(nz, hz))));
+    auto m11 = _mm_mul_ps(s, ny);
+    auto m12 = _mm_mul_ps(s,
+        _mm_sub_ps(_mm_mul_ps(nx, hz), _mm_mul_ps(nz, hx)));
+    auto m13 = _mm_loadu_ps(&batch.y[i]);
+    auto m20 = _mm_mul_ps(s,
+        _mm_add_ps(_mm_mul_ps(b, hx), _mm_mul_ps(d, hz)));
+    auto m21 = _mm_mul_ps(s, nz);
+    auto m22 = _mm_mul_ps(s,
+        _mm_sub_ps(_mm_mul_ps(d, hx), _mm_mul_ps(b, hz)));
+    auto m23 = _mm_loadu_ps(&batch.z[i]);
+
+    // Lanes hold one object each, transposing turns them into rows.
+    _MM_TRANSPOSE4_PS(m00, m01, m02, m03);
+    _MM_TRANSPOSE4_PS(m10, m11, m12, m13);
+    _MM_TRANSPOSE4_PS(m20, m21, m22, m23);
+    auto out = &batch.matrices[12 * i];
+    _mm_storeu_ps(out + 0, m00);
+    _mm_storeu_ps(out + 4, m10);
+    _mm_storeu_ps(out + 8, m20);
+    _mm_storeu_ps(out + 12, m01);
+    _mm_storeu_ps(out + 16, m11);
+    _mm_storeu_ps(out + 20, m21);
+    _mm_storeu_ps(out + 24, m02);
+    _mm_storeu_ps(out + 28, m12);
+    _mm_storeu_ps(out + 32, m22);
+    _mm_storeu_ps(out + 36, m03);
+    _mm_storeu_ps(out + 40, m13);
+    _mm_storeu_ps(out + 44, m23);
+  }
+#endif
+  for (; i < count; ++i) {
+    auto nx = batch.upX[i], ny = batch.upY[i], nz = batch.upZ[i];
+    auto hx = batch.headingX[i], hz = batch.headingZ[i];
+    auto s = batch.scale[i];
+
+    auto k = 1.0f / (1.0f + ny);
+    auto a = 1.0f - k * nx * nx;
+    auto b = -k * nx * nz;
+    auto d = 1.0f - k * nz * nz;
+
+    auto out = &batch.matrices[12 * i];
+    out[0] = s * (a * hx + b * hz);
+    out[1] = s * nx;
+    out[2] = s * (b * hx - a * hz);
+    out[3] = batch.x[i];
+    out[4] = s * -(nx * hx + nz * hz);
+    out[5] = s * ny;
+    out[6] = s * (nx * hz - nz * hx);
+    out[7] = batch.y[i];
+    out[8] = s * (b * hx + d * hz);
+    out[9] = s * nz;
+    out[10] = s * (d * hx - b * hz);
+    out[11] = batch.z[i];
+  }
+}
+
+glm::vec3 transformPoint(const float *matrix, const glm::vec3 &point) {
+  return glm::vec3(
+      matrix[0] * point.x + matrix[1] * point.y + matrix[2] * point.z
+        + matrix[3],
+      matrix[4] * point.x + matrix[5] * point.y + matrix[6] * point.z
+        + matrix[7],
+      matrix[8] * point.x + matrix[9] * point.y + matrix[10] * point.z
+        + matrix[11]);
+}
@@ -0,0 +1,40 @@
+#ifndef __TRANSFORM_BATCH_HPP__
+#define __TRANSFORM_BATCH_HPP__
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Objects placed by a position, an up axis, a heading and a uniform scale,
+// one array per attribute. Up axes are unit length and not straight down.
+// Headings are unit directions in the xz plane that the object's x axis
+// is turned onto before tilting, so callers holding a tangent need no
+// trig. Arrays are padded to a multiple of 4 with identity transforms.
+struct TransformBatch {
+  std::vector<float> x, y, z;
+  std::vector<float> upX, upY, upZ;
+  std::vector<float> headingX, headingZ;
+  std::vector<float> scale;
+
+  // Row major 3x4 matrices, 12 floats each, the last column translating.
+  // Filled by buildTransforms.
+  std::vector<float> matrices;
+
+  TransformBatch();
+
+  void resize(int count);
+  inline int size() const { return _count; }
+  inline const float *getMatrix(int index) const {
+    return &matrices[12 * index];
+  }
+
+private:
+  int _count;
+};
+
+// Scales, turns by the heading, tilts y onto the up axis and translates
+// every object, 4 at a time with SSE when available.
+void buildTransforms(TransformBatch &batch);
+
+glm::vec3 transformPoint(const float *matrix, const glm::vec3 &point);
+
+#endif
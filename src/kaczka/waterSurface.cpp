@@ -1,5 +1,9 @@
 #include "waterSurface.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
 #include <iostream>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -7,127 +11,1769 @@
 
 #include "config.hpp"
 #include "helpers.hpp"
+#include "parallel.hpp"
 
 using namespace std;
 
+// Quads per chunk side at the finest level, which matches one quad per
+// height sample. Every further level doubles the quad size.
+static const int cChunkResolution = 32;
+static const int cChunkLods = 6;
+static const float cChunkLodDistance = 1.5f;
+static const float cSkirtDepth = 0.1f;
+
+// Heights are not tracked, bounds assume waves stay well below this.
+static const float cBoundsHeightMargin = 1.0f;
+
+// Simulation runs only in tiles that hold waves. A tile falls asleep once
+// both its heights and their change per step drop below the epsilon.
+static const int cTileSize = 32;
+static const float cTileSleepEpsilon = 1e-3f;
+
+// Hierarchical mode keeps the whole pool on a grid coarser by this factor.
+// Its spacing and time step are both scaled by the factor, so it runs at
+// the same Courant number and takes one step per cCoarseFactor fine steps.
+static const int cCoarseFactor = 4;
+static const float cDamping = 0.95f;
+
+// Fixed point heights, in sample spacings, clamp at this magnitude. It
+// leaves headroom over the strongest drops while keeping the quantization
+// step well below the tile sleep epsilon.
+static const float cFixedPointHeightRange = 2.0f;
+static const float cSpectralFixedPointHeightRange = 8.0f;
+
+// Spectral mode ocean, sizes in world units (meters).
+static const glm::vec2 cOceanWind(4.0f, 1.2f);
+static const float cOceanAmplitude = 0.0001f;
+static const unsigned int cOceanSeed = 1;
+
+// Checkpoint sections of a surface, see WaterSurface::saveCheckpoint.
+static const uint32_t cCheckpointHeaderTag = makeCheckpointTag('W','S','H','D');
+static const uint32_t cCheckpointSamplesTags[] = {
+  makeCheckpointTag('W','S','A','0'), makeCheckpointTag('W','S','A','1')
+};
+static const uint32_t cCheckpointCoarseTags[] = {
+  makeCheckpointTag('W','C','A','0'), makeCheckpointTag('W','C','A','1')
+};
+static const uint32_t cCheckpointTilesTag = makeCheckpointTag('W','T','A','C');
+static const uint32_t cCheckpointCoarseCalmTag =
+  makeCheckpointTag('W','T','C','C');
+static const uint32_t cCheckpointNormalsTag =
+  makeCheckpointTag('W','N','R','M');
+
+struct WaterCheckpointHeader {
+  int32_t width, height;
+  int32_t mode, precision;
+  int32_t substeps, stepCounter;
+  // Whether the second buffer of a pair holds the current samples.
+  int32_t samplesSwapped, coarseSwapped;
+  float refinementFocus[3];
+  float refinementRadius;
+  float spectralTime;
+};
+
+static float waveCoefficient() {
+  int N = 256;
+  float h = 2.0f / (N-1);
+  float c = 1.0f;
+  float dt = 1.0f / N;
+  return (c*c)*(dt*dt)/(h*h);
+}
+
+// Loads samples x0 - 1 to x1 of a row, zero outside of the field.
+static void loadPaddedRow(const HeightField &field, int y, int x0, int x1,
+    float *row) {
+  fill(row, row + x1 - x0 + 2, 0.0f);
+  if (y < 0 || y >= field.getHeight()) {
+    return;
+  }
+  auto first = max(0, x0 - 1);
+  auto last = min(field.getWidth(), x1 + 1);
+  field.loadRow(y, first, last, row + first - (x0 - 1));
+}
+
+// Damping ramps down to zero at the pool walls. The ramp only depends on
+// the distance to the nearest wall, so it is the smaller of a column and a
+// row term.
+static float wallRamp(int i, int size) {
+  float p = ((float)i) / (size-1);
+  return min(1.0f, min(p, 1.0f - p)/0.01f);
+}
+
+// Scratch holds 5 * (x1 - x0 + 2) floats.
+static void stepWaveEquation(const HeightField &current,
+    HeightField &previous, int x0, int y0, int x1, int y1,
+    float A, float dampingFactor, float *scratch) {
+  int width = current.getWidth(), height = current.getHeight();
+  float B = 2 - 4*A;
+
+  // Current rows y - 1, y and y + 1 roll through three padded buffers.
+  auto n = x1 - x0 + 2;
+  float *above = scratch, *center = above + n, *below = center + n;
+  float *result = below + n, *columnRamp = result + n;
+  for (auto i = 0; i < x1 - x0; ++i) {
+    columnRamp[i] = wallRamp(x0 + i, width);
+  }
+  loadPaddedRow(current, y0 - 1, x0, x1, above);
+  loadPaddedRow(current, y0, x0, x1, center);
+
+  for (auto y = y0; y < y1; ++y) {
+    loadPaddedRow(current, y + 1, x0, x1, below);
+    previous.loadRow(y, x0, x1, result);
+
+    float rowRamp = wallRamp(y, height);
+    for (auto i = 0; i < x1 - x0; ++i) {
+      float neighborsSum = center[i] + center[i+2] + above[i+1] + below[i+1];
+      float damping = dampingFactor * min(columnRamp[i], rowRamp);
+      result[i] = damping * (A*neighborsSum + B*center[i+1] - result[i]);
+    }
+    previous.storeRow(y, x0, x1, result);
+
+    auto rolled = above;
+    above = center;
+    center = below;
+    below = rolled;
+  }
+}
+
+// Counting sort of points, in sample coordinates, by the tile they fall
+// into. The points of tile t are order[tileStarts[t]] up to
+// order[tileStarts[t + 1] - 1].
+static void sortPointsByTile(const glm::vec4 *points, int count,
+    int tilesX, int tilesY, int *order, int *tileStarts) {
+  auto tileOf = [=](const glm::vec4 &point) {
+    auto tileX = max(0, min(tilesX - 1, (int)floorf(point.x) / cTileSize));
+    auto tileY = max(0, min(tilesY - 1, (int)floorf(point.y) / cTileSize));
+    return tileY * tilesX + tileX;
+  };
+
+  auto numTiles = tilesX * tilesY;
+  fill(tileStarts, tileStarts + numTiles + 1, 0);
+  for (auto i = 0; i < count; ++i) {
+    tileStarts[tileOf(points[i]) + 1]++;
+  }
+  for (auto tile = 0; tile < numTiles; ++tile) {
+    tileStarts[tile + 1] += tileStarts[tile];
+  }
+
+  for (auto i = 0; i < count; ++i) {
+    order[tileStarts[tileOf(points[i])]++] = i;
+  }
+
+  // Filling advanced every start to the start of the following tile.
+  for (auto tile = numTiles; tile > 0; --tile) {
+    tileStarts[tile] = tileStarts[tile - 1];
+  }
+  tileStarts[0] = 0;
+}
+
+static void loadWindow(const HeightField &field, int x0, int y0, int x1,
+    int y1, vector<float> &window) {
+  window.resize((x1 - x0) * (y1 - y0));
+  for (auto y = y0; y < y1; ++y) {
+    field.loadRow(y, x0, x1, &window[(y - y0) * (x1 - x0)]);
+  }
+}
+
+static void storeWindow(HeightField &field, int x0, int y0, int x1, int y1,
+    const vector<float> &window) {
+  for (auto y = y0; y < y1; ++y) {
+    field.storeRow(y, x0, x1, &window[(y - y0) * (x1 - x0)]);
+  }
+}
+
+static void getHeightTextureFormat(HeightFieldPrecision precision,
+    GLenum &internalFormat, GLenum &type) {
+  switch (precision) {
+    case HeightFieldPrecision::Float16:
+      internalFormat = GL_R16F;
+      type = GL_HALF_FLOAT;
+      break;
+    case HeightFieldPrecision::Fixed16:
+      internalFormat = GL_R16_SNORM;
+      type = GL_SHORT;
+      break;
+    default:
+      internalFormat = GL_R32F;
+      type = GL_FLOAT;
+      break;
+  }
+}
+
 WaterSurface::WaterSurface() : 
-  _vbo(0), _vao(0), _ebo(0),
-  _modelMatrix(1.0f), _planeWidth(0.0f),
-  _planeHeight(0.0f), _samplesTextureWidth(0), _samplesTextureHeight(0),
-  _normalMapTexture(0) {
+  _chunkInstanceCapacity(0), _cubemap(0), _cubemapLevels(0),
+  _roughness(0.0f), _chunksX(0), _chunksZ(0), _numDrawCalls(0),
+  _uploadedBytes(0), _planeWidth(0.0f), _planeHeight(0.0f),
+  _samplesTextureWidth(0), _samplesTextureHeight(0),
+  _heightPrecision(HeightFieldPrecision::Float32),
+  _normalMapFormat(NormalMapFormat::RG8), _normalMapTexelSize(2),
+  _tilesX(0), _tilesY(0), _substeps(1), _temporalBlocking(true),
+  _simulationMode(WaterSimulationMode::FiniteDifference),
+  _coarseWidth(0), _coarseHeight(0), _stepCounter(0),
+  _refinementFocus(0.0f), _refinementRadius(0.0f), _spectralTime(0.0f),
+  _captureInterval(1), _captureCountdown(0), _capturedSteps(0),
+  _simulationRunning(false), _pendingUpdates(0), _solverSteps(0),
+  _footprintWrite(0), _modelMatrix(1.0f) {
     _invModelMatrix = glm::inverse(_modelMatrix);
 }
 
-WaterSurface::~WaterSurface() {
-  free();
+WaterSurface::~WaterSurface() {
+  free();
+}
+
+void WaterSurface::create(float planeWidth, float planeHeight,
+    int samplesTextureWidth, int samplesTextureHeight) {
+  free();
+  _normalMapTexelSize = _normalMapFormat == NormalMapFormat::RG16 ? 4 : 2;
+
+  _normalMapTexture = GLTexture::create();
+  glBindTexture(GL_TEXTURE_2D, _normalMapTexture.get());
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  _heightMapTexture = GLTexture::create();
+  glBindTexture(GL_TEXTURE_2D, _heightMapTexture.get());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  createGridChunk(cChunkResolution, cChunkLods, _vao, _vbo, _ebo, _gridLods);
+
+  _chunkInstanceVbo = GLBuffer::create();
+  _chunkInstanceCapacity = 0;
+  glBindVertexArray(_vao.get());
+  glBindBuffer(GL_ARRAY_BUFFER, _chunkInstanceVbo.get());
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4),
+      (GLvoid*)0);
+  glVertexAttribDivisor(1, 1);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  glBindVertexArray(0);
+
+  // The program lives as long as the surface, created again it is kept.
+  if (!_shader.isLinked()) {
+    VertexShader vertexShader(SHADER_PATH_PREFIX"water.vert");
+    FragmentShader fragmentShader(SHADER_PATH_PREFIX"water.frag");
+    _shader.attach(&vertexShader);
+    _shader.attach(&fragmentShader);
+    _shader.link();
+  }
+
+  allocate(planeWidth, planeHeight, samplesTextureWidth,
+      samplesTextureHeight);
+}
+
+void WaterSurface::resize(float planeWidth, float planeHeight,
+    int samplesTextureWidth, int samplesTextureHeight) {
+  if (!_vao) {
+    create(planeWidth, planeHeight, samplesTextureWidth,
+        samplesTextureHeight);
+    return;
+  }
+
+  auto threaded = isSimulationThreadRunning();
+  stopSimulationThread();
+  stopCapture();
+
+  // Both buffers are carried over, so the waves keep their velocity.
+  auto width = _samplesTextureWidth, height = _samplesTextureHeight;
+  auto spectralTime = _spectralTime;
+  vector<float> states[2];
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    states[0].resize(width * height);
+    states[1].resize(width * height);
+    _gpuSolver->readState(&states[0][0], &states[1][0]);
+  } else if (_simulationMode != WaterSimulationMode::Spectral) {
+    const HeightField *fields[] = { _currentSamples, _previousSamples };
+    for (auto i = 0; i < 2; ++i) {
+      states[i].resize(width * height);
+      for (auto y = 0; y < height; ++y) {
+        fields[i]->loadRow(y, 0, width, &states[i][y * width]);
+      }
+    }
+  }
+
+  allocate(planeWidth, planeHeight, samplesTextureWidth,
+      samplesTextureHeight);
+
+  if (_simulationMode == WaterSimulationMode::Spectral) {
+    _spectralTime = spectralTime;
+    updateSpectral(0.0f);
+  } else {
+    vector<float> resampled[2];
+    for (auto i = 0; i < 2; ++i) {
+      resampleHeights(states[i], width, height, resampled[i],
+          _samplesTextureWidth, _samplesTextureHeight);
+    }
+    writeSamples(resampled[0], resampled[1]);
+  }
+
+  if (threaded) {
+    startSimulationThread();
+  }
+}
+
+// Sample centers of both grids span the same plane.
+void WaterSurface::resampleHeights(const vector<float> &source,
+    int sourceWidth, int sourceHeight, vector<float> &destination,
+    int width, int height) {
+  destination.resize(width * height);
+  auto scaleX = (float)sourceWidth / width;
+  auto scaleY = (float)sourceHeight / height;
+  for (auto y = 0; y < height; ++y) {
+    auto v = max(0.0f, min((float)(sourceHeight - 1),
+          (y + 0.5f) * scaleY - 0.5f));
+    int v0 = (int)v, v1 = min(v0 + 1, sourceHeight - 1);
+    auto fv = v - v0;
+    for (auto x = 0; x < width; ++x) {
+      auto u = max(0.0f, min((float)(sourceWidth - 1),
+            (x + 0.5f) * scaleX - 0.5f));
+      int u0 = (int)u, u1 = min(u0 + 1, sourceWidth - 1);
+      auto fu = u - u0;
+      auto top = (1.0f - fu) * source[v0 * sourceWidth + u0]
+        + fu * source[v0 * sourceWidth + u1];
+      auto bottom = (1.0f - fu) * source[v1 * sourceWidth + u0]
+        + fu * source[v1 * sourceWidth + u1];
+      destination[y * width + x] = (1.0f - fv) * top + fv * bottom;
+    }
+  }
+}
+
+// Every tile is woken, the activity check puts calm ones back to sleep.
+void WaterSurface::writeSamples(const vector<float> &current,
+    const vector<float> &previous) {
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    _gpuSolver->writeState(&current[0], &previous[0]);
+    _gpuSolver->updateNormals();
+    return;
+  }
+
+  for (auto y = 0; y < _samplesTextureHeight; ++y) {
+    _currentSamples->storeRow(y, 0, _samplesTextureWidth,
+        &current[y * _samplesTextureWidth]);
+    _previousSamples->storeRow(y, 0, _samplesTextureWidth,
+        &previous[y * _samplesTextureWidth]);
+  }
+
+  // The coarse level of both buffers is rebuilt from the fine samples.
+  if (_simulationMode == WaterSimulationMode::Hierarchical) {
+    for (auto i = 0; i < 2; ++i) {
+      for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+        for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+          restrictTile(tileX, tileY);
+        }
+      }
+      swap(_currentSamples, _previousSamples);
+      swap(_currentCoarseSamples, _previousCoarseSamples);
+    }
+  }
+
+  fill(_tileActive.begin(), _tileActive.end(), 1);
+  fill(_tileCoarseCalm.begin(), _tileCoarseCalm.end(), 0);
+  fill(_tileDirty.begin(), _tileDirty.end(), 1);
+  calculateNormalMap(0, 0, _samplesTextureWidth, _samplesTextureHeight);
+}
+
+void WaterSurface::allocate(float planeWidth, float planeHeight,
+    int samplesTextureWidth, int samplesTextureHeight) {
+  _planeWidth = planeWidth;
+  _planeHeight = planeHeight;
+  _samplesTextureWidth = samplesTextureWidth;
+  _samplesTextureHeight = samplesTextureHeight;
+  clearSamples();
+
+  // Storage is specified again on the same texture names.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindTexture(GL_TEXTURE_2D, _normalMapTexture.get());
+  if (_normalMapFormat == NormalMapFormat::RG16) {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, _samplesTextureWidth,
+        _samplesTextureHeight, 0, GL_RG, GL_UNSIGNED_SHORT,
+        &_normalMapData[0]);
+  } else {
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, _samplesTextureWidth,
+        _samplesTextureHeight, 0, GL_RG, GL_UNSIGNED_BYTE,
+        &_normalMapData[0]);
+  }
+
+  GLenum heightInternalFormat, heightType;
+  getHeightTextureFormat(_heightPrecision, heightInternalFormat, heightType);
+  glBindTexture(GL_TEXTURE_2D, _heightMapTexture.get());
+  glTexImage2D(GL_TEXTURE_2D, 0, heightInternalFormat, _samplesTextureWidth,
+      _samplesTextureHeight, 0, GL_RED, heightType,
+      _currentSamples->getData(0, 0));
+  glBindTexture(GL_TEXTURE_2D, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+  // Chunk instances only grow, smaller pools use the front of the buffer.
+  _chunksX = max(1, _samplesTextureWidth / cChunkResolution);
+  _chunksZ = max(1, _samplesTextureHeight / cChunkResolution);
+  if (_chunksX * _chunksZ > _chunkInstanceCapacity) {
+    _chunkInstanceCapacity = _chunksX * _chunksZ;
+    glBindBuffer(GL_ARRAY_BUFFER, _chunkInstanceVbo.get());
+    glBufferData(GL_ARRAY_BUFFER,
+        _chunkInstanceCapacity * sizeof(glm::vec4), nullptr,
+        GL_STREAM_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  _textureMatrix = glm::scale(glm::mat4(1.0f), 
+      glm::vec3(1.0f/_planeWidth, 0, 1.0f/_planeHeight));
+  _textureMatrix = glm::translate(_textureMatrix, 
+      glm::vec3(0.5f * _planeWidth, 0, 0.5f * _planeHeight));
+
+  // The ocean spectrum and the GPU fields are sized by the samples too.
+  if (_simulationMode == WaterSimulationMode::Spectral ||
+      _simulationMode == WaterSimulationMode::Gpu) {
+    setSimulationMode(_simulationMode);
+  }
+}
+
+void WaterSurface::free() {
+  stopSimulationThread();
+  stopCapture();
+  _gpuSolver.reset();
+  _normalMapTexture.reset();
+  _heightMapTexture.reset();
+  _vao.reset();
+  _vbo.reset();
+  _ebo.reset();
+  _chunkInstanceVbo.reset();
+  _chunkInstanceCapacity = 0;
+  _gridLods.clear();
+}
+
+void WaterSurface::startSimulationThread() {
+  if (isSimulationThreadRunning()) {
+    return;
+  }
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    cerr << "Gpu water steps with the GL context, not on its own thread."
+      << endl;
+    return;
+  }
+
+  auto totalSamples = _samplesTextureWidth * _samplesTextureHeight;
+  for (auto &snapshot : _snapshots) {
+    snapshot.heights.resize(totalSamples * _samples.getBytesPerSample());
+    snapshot.normals.resize(_normalMapData.size());
+    snapshot.tileDirty.assign(_tilesX * _tilesY, 0);
+    snapshot.tileStale.assign(_tilesX * _tilesY, 1);
+  }
+
+  _shownSamples = *_currentSamples;
+  _shownNormals = _normalMapData;
+  _shownTileDirty.assign(_tilesX * _tilesY, 0);
+
+  _commands.clear();
+  _advanceTimes.clear();
+  _publishedSnapshots.clear();
+  _freeSnapshots.clear();
+  _freeSnapshots.push(0);
+  _freeSnapshots.push(1);
+  _pendingUpdates.store(0);
+  _simulationRunning.store(true);
+  _simulationThread = thread(&WaterSurface::simulationLoop, this);
+}
+
+void WaterSurface::stopSimulationThread() {
+  if (!isSimulationThreadRunning()) {
+    return;
+  }
+
+  _simulationRunning.store(false);
+  _simulationThread.join();
+
+  // Queued disturbances and updates are dropped, settings still apply.
+  // Snapshots still in flight are replaced by uploading the live samples
+  // in full.
+  WaterCommand command;
+  while (_commands.pop(command)) {
+    if (command.type == WaterCommandType::RefinementFocus) {
+      setRefinementFocus(command.position, command.value);
+    } else if (command.type == WaterCommandType::Substeps) {
+      setSubsteps((int)command.value);
+    }
+  }
+  _publishedSnapshots.clear();
+  _freeSnapshots.clear();
+  _pendingUpdates.store(0);
+  for (auto &footprints : _footprints) {
+    footprints.clear();
+  }
+  fill(_tileDirty.begin(), _tileDirty.end(), 1);
+}
+
+void WaterSurface::simulationLoop() {
+  WaterCommand command;
+  while (_simulationRunning.load(memory_order_acquire)) {
+    if (!_commands.pop(command)) {
+      this_thread::sleep_for(chrono::microseconds(200));
+      continue;
+    }
+
+    switch (command.type) {
+      case WaterCommandType::Disturbance:
+        applyDisturbance(command.position, command.value);
+        break;
+      case WaterCommandType::RefinementFocus:
+        _refinementFocus = command.position;
+        _refinementRadius = command.value;
+        break;
+      case WaterCommandType::Substeps:
+        _substeps = max(1, min(cTileSize, (int)command.value));
+        break;
+      case WaterCommandType::Update: {
+        auto start = chrono::steady_clock::now();
+        applyFootprints(_footprints[command.footprints]);
+        advance(command.value);
+        // Dropped when nobody collects them.
+        _advanceTimes.push(chrono::duration<float, milli>(
+              chrono::steady_clock::now() - start).count());
+        publishSnapshot();
+        _pendingUpdates.fetch_sub(1, memory_order_release);
+        break;
+      }
+    }
+  }
+}
+
+void WaterSurface::pushCommand(const WaterCommand &command) {
+  while (!_commands.push(command)) {
+    this_thread::yield();
+  }
+}
+
+void WaterSurface::publishSnapshot() {
+  int slot;
+  while (!_freeSnapshots.pop(slot)) {
+    if (!_simulationRunning.load(memory_order_acquire)) {
+      return;
+    }
+    this_thread::yield();
+  }
+
+  auto numTiles = _tilesX * _tilesY;
+  for (auto &snapshot : _snapshots) {
+    for (auto tile = 0; tile < numTiles; ++tile) {
+      snapshot.tileStale[tile] |= _tileDirty[tile];
+    }
+  }
+
+  // Copies cover the same border the uploads do.
+  auto &snapshot = _snapshots[slot];
+  auto bytesPerSample = _samples.getBytesPerSample();
+  auto heights = (const unsigned char*)_currentSamples->getData(0, 0);
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      auto tile = tileY * _tilesX + tileX;
+      if (!snapshot.tileStale[tile]) {
+        continue;
+      }
+      snapshot.tileStale[tile] = 0;
+
+      int x0, y0, x1, y1;
+      getTileRect(tileX, tileY, 1, x0, y0, x1, y1);
+      for (auto y = y0; y < y1; ++y) {
+        auto first = y * _samplesTextureWidth + x0;
+        memcpy(&snapshot.heights[first * bytesPerSample],
+            heights + first * bytesPerSample, (x1 - x0) * bytesPerSample);
+        memcpy(&snapshot.normals[first * _normalMapTexelSize],
+            &_normalMapData[first * _normalMapTexelSize],
+            (x1 - x0) * _normalMapTexelSize);
+      }
+    }
+  }
+
+  snapshot.tileDirty = _tileDirty;
+  fill(_tileDirty.begin(), _tileDirty.end(), 0);
+  _publishedSnapshots.push(slot);
+}
+
+void WaterSurface::setStorageFormat(HeightFieldPrecision heightPrecision,
+    NormalMapFormat normalMapFormat) {
+  _heightPrecision = heightPrecision;
+  _normalMapFormat = normalMapFormat;
+}
+
+void WaterSurface::applyDisturbaceInWorldSpace(glm::vec3 position, 
+    float strength) {
+  if (isSimulationThreadRunning()) {
+    WaterCommand command = {
+      WaterCommandType::Disturbance, position, strength
+    };
+    pushCommand(command);
+  } else {
+    applyDisturbance(position, strength);
+  }
+}
+
+void WaterSurface::applyDisturbance(glm::vec3 position, float strength) {
+  if (_simulationMode == WaterSimulationMode::Spectral) {
+    return;
+  }
+
+  auto textureSpacePosition = glm::vec3(
+      _textureMatrix * _invModelMatrix * glm::vec4(position, 1.0f)
+  );
+  
+  if (textureSpacePosition.x < 0.0f || textureSpacePosition.x > 1.0f ||
+      textureSpacePosition.z < 0.0f || textureSpacePosition.z > 1.0f) {
+    return;
+  }
+
+  int coordX = min((int)(textureSpacePosition.x * _samplesTextureWidth),
+      _samplesTextureWidth - 1);
+  int coordY = min((int)(textureSpacePosition.z * _samplesTextureHeight),
+      _samplesTextureHeight - 1);
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    _gpuSolver->addSplat(glm::vec4(coordX, coordY, 0.0f, strength));
+    return;
+  }
+
+  _currentSamples->set(coordX, coordY,
+      _currentSamples->get(coordX, coordY) + strength);
+
+  // Wake every tile the disturbance can reach before the next activity
+  // check.
+  auto reach = _substeps + 1;
+  auto tileX0 = max(0, coordX - reach) / cTileSize;
+  auto tileY0 = max(0, coordY - reach) / cTileSize;
+  auto tileX1 = min(_samplesTextureWidth - 1, coordX + reach) / cTileSize;
+  auto tileY1 = min(_samplesTextureHeight - 1, coordY + reach) / cTileSize;
+  for (auto tileY = tileY0; tileY <= tileY1; ++tileY) {
+    for (auto tileX = tileX0; tileX <= tileX1; ++tileX) {
+      _tileActive[tileY * _tilesX + tileX] = 1;
+    }
+  }
+}
+
+void WaterSurface::sampleDucks(DuckBatch &ducks, LinearArena &frameArena) {
+  auto count = ducks.size();
+  if (count == 0) {
+    return;
+  }
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    sampleDucksOnGpu(ducks, frameArena);
+    return;
+  }
+
+  const HeightField &field = isSimulationThreadRunning()
+    ? _shownSamples : *_currentSamples;
+  auto width = _samplesTextureWidth, height = _samplesTextureHeight;
+  auto spacing = _planeWidth / width;
+  auto radius = max(1.0f, ducks.hullRadius / spacing);
+
+  auto points = frameArena.allocate<glm::vec4>(count);
+  auto order = frameArena.allocate<int>(count);
+  auto tileStarts = frameArena.allocate<int>(_tilesX * _tilesY + 1);
+  for (auto i = 0; i < count; ++i) {
+    points[i] = glm::vec4(getSamplePosition(ducks.x[i], ducks.z[i]),
+        radius, 0.0f);
+  }
+  sortPointsByTile(points, count, _tilesX, _tilesY, order, tileStarts);
+
+  auto heightAt = [&](float x, float y) {
+    x = max(0.0f, min((float)(width - 1), x));
+    y = max(0.0f, min((float)(height - 1), y));
+    auto ix = min((int)x, max(0, width - 2));
+    auto iy = min((int)y, max(0, height - 2));
+    auto fx = x - ix, fy = y - iy;
+    auto nx = min(ix + 1, width - 1), ny = min(iy + 1, height - 1);
+    auto top = field.get(ix, iy)
+      + fx * (field.get(nx, iy) - field.get(ix, iy));
+    auto bottom = field.get(ix, ny)
+      + fx * (field.get(nx, ny) - field.get(ix, ny));
+    return top + fy * (bottom - top);
+  };
+
+  // Ducks are visited in tile order, so consecutive probes hit samples
+  // that are already in cache. Slopes come from the heights at the hull
+  // edges, so a duck tilts with waves of its own size and ignores shorter
+  // ripples.
+  for (auto k = 0; k < count; ++k) {
+    auto i = order[k];
+    auto &point = points[i];
+    auto r = point.z;
+    ducks.waterHeight[i] = spacing * heightAt(point.x, point.y);
+    ducks.slopeX[i] = (heightAt(point.x + r, point.y)
+        - heightAt(point.x - r, point.y)) / (2.0f * r);
+    ducks.slopeZ[i] = (heightAt(point.x, point.y + r)
+        - heightAt(point.x, point.y - r)) / (2.0f * r);
+  }
+}
+
+// All probes of a batch go out in one dispatch with a single readback.
+void WaterSurface::sampleDucksOnGpu(DuckBatch &ducks,
+    LinearArena &frameArena) {
+  auto count = ducks.size();
+  auto spacing = _planeWidth / _samplesTextureWidth;
+  auto r = max(1.0f, ducks.hullRadius / spacing);
+
+  // Probes come back a frame or two late, so the ducks ride the water as
+  // it was then. Until they do, ducks keep the heights they had.
+  auto heights = frameArena.allocate<float>(5 * count);
+  auto fetched = _gpuSolver->fetchSamples(heights, 5 * count) / 5;
+  for (auto i = 0; i < fetched; ++i) {
+    auto probe = heights + 5 * i;
+    ducks.waterHeight[i] = spacing * probe[0];
+    ducks.slopeX[i] = (probe[1] - probe[2]) / (2.0f * r);
+    ducks.slopeZ[i] = (probe[3] - probe[4]) / (2.0f * r);
+  }
+
+  auto points = frameArena.allocate<glm::vec2>(5 * count);
+  for (auto i = 0; i < count; ++i) {
+    auto center = getSamplePosition(ducks.x[i], ducks.z[i]);
+    points[5 * i] = center;
+    points[5 * i + 1] = center + glm::vec2(r, 0.0f);
+    points[5 * i + 2] = center - glm::vec2(r, 0.0f);
+    points[5 * i + 3] = center + glm::vec2(0.0f, r);
+    points[5 * i + 4] = center - glm::vec2(0.0f, r);
+  }
+  _gpuSolver->requestSamples(points, 5 * count);
+}
+
+void WaterSurface::splatDucks(const DuckBatch &ducks, float strength) {
+  if (_simulationMode == WaterSimulationMode::Spectral) {
+    return;
+  }
+
+  auto spacing = _planeWidth / _samplesTextureWidth;
+  auto radius = max(1.0f, ducks.hullRadius / spacing);
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    for (auto i = 0; i < ducks.size(); ++i) {
+      _gpuSolver->addSplat(glm::vec4(
+            getSamplePosition(ducks.x[i], ducks.z[i]), radius, -strength));
+    }
+    return;
+  }
+  auto &footprints = _footprints[_footprintWrite];
+  for (auto i = 0; i < ducks.size(); ++i) {
+    footprints.push_back(glm::vec4(getSamplePosition(ducks.x[i], ducks.z[i]),
+          radius, -strength));
+  }
+
+  if (!isSimulationThreadRunning()) {
+    applyFootprints(footprints);
+    footprints.clear();
+  }
+}
+
+void WaterSurface::applyFootprints(const vector<glm::vec4> &footprints) {
+  if (footprints.empty() ||
+      _simulationMode == WaterSimulationMode::Spectral) {
+    return;
+  }
+
+  _splatOrder.resize(footprints.size());
+  _splatTileStarts.resize(_tilesX * _tilesY + 1);
+  sortPointsByTile(&footprints[0], (int)footprints.size(), _tilesX, _tilesY,
+      &_splatOrder[0], &_splatTileStarts[0]);
+
+  // Footprints of a crowded tile share one window over their bounding
+  // box; scattered ones are cheaper to load and store one by one.
+  for (auto tile = 0; tile < _tilesX * _tilesY; ++tile) {
+    auto first = _splatTileStarts[tile], last = _splatTileStarts[tile + 1];
+    if (first == last) {
+      continue;
+    }
+
+    auto x0 = _samplesTextureWidth, y0 = _samplesTextureHeight;
+    auto x1 = 0, y1 = 0, footprintArea = 0;
+    for (auto k = first; k < last; ++k) {
+      int fx0, fy0, fx1, fy1;
+      getFootprintRect(footprints[_splatOrder[k]], fx0, fy0, fx1, fy1);
+      x0 = min(x0, fx0);
+      y0 = min(y0, fy0);
+      x1 = max(x1, fx1);
+      y1 = max(y1, fy1);
+      footprintArea += max(0, fx1 - fx0) * max(0, fy1 - fy0);
+    }
+
+    if ((x1 - x0) * (y1 - y0) <= footprintArea) {
+      splatFootprints(footprints, first, last, x0, y0, x1, y1);
+      continue;
+    }
+    for (auto k = first; k < last; ++k) {
+      getFootprintRect(footprints[_splatOrder[k]], x0, y0, x1, y1);
+      splatFootprints(footprints, k, k + 1, x0, y0, x1, y1);
+    }
+  }
+}
+
+void WaterSurface::getFootprintRect(const glm::vec4 &footprint,
+    int &x0, int &y0, int &x1, int &y1) {
+  x0 = max(0, (int)ceilf(footprint.x - footprint.z));
+  y0 = max(0, (int)ceilf(footprint.y - footprint.z));
+  x1 = min(_samplesTextureWidth, (int)floorf(footprint.x + footprint.z) + 1);
+  y1 = min(_samplesTextureHeight, (int)floorf(footprint.y + footprint.z) + 1);
+}
+
+void WaterSurface::splatFootprints(const vector<glm::vec4> &footprints,
+    int first, int last, int x0, int y0, int x1, int y1) {
+  if (x0 >= x1 || y0 >= y1) {
+    return;
+  }
+
+  loadWindow(*_currentSamples, x0, y0, x1, y1, _splatScratch);
+  auto stride = x1 - x0;
+  for (auto k = first; k < last; ++k) {
+    auto &footprint = footprints[_splatOrder[k]];
+    auto r = footprint.z;
+    int fx0, fy0, fx1, fy1;
+    getFootprintRect(footprint, fx0, fy0, fx1, fy1);
+    for (auto y = fy0; y < fy1; ++y) {
+      for (auto x = fx0; x < fx1; ++x) {
+        auto dx = x - footprint.x, dy = y - footprint.y;
+        auto d = (dx*dx + dy*dy) / (r*r);
+        if (d < 1.0f) {
+          _splatScratch[(y - y0) * stride + x - x0] +=
+            footprint.w * (1.0f - d) * (1.0f - d);
+        }
+      }
+    }
+  }
+  storeWindow(*_currentSamples, x0, y0, x1, y1, _splatScratch);
+
+  auto reach = _substeps + 1;
+  auto tileX0 = max(0, x0 - reach) / cTileSize;
+  auto tileY0 = max(0, y0 - reach) / cTileSize;
+  auto tileX1 = min(_samplesTextureWidth - 1, x1 - 1 + reach) / cTileSize;
+  auto tileY1 = min(_samplesTextureHeight - 1, y1 - 1 + reach) / cTileSize;
+  for (auto tileY = tileY0; tileY <= tileY1; ++tileY) {
+    for (auto tileX = tileX0; tileX <= tileX1; ++tileX) {
+      _tileActive[tileY * _tilesX + tileX] = 1;
+    }
+  }
+}
+
+void WaterSurface::readHeights(vector<float> &heights) {
+  heights.resize(_samplesTextureWidth * _samplesTextureHeight);
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    _gpuSolver->readHeights(&heights[0]);
+    return;
+  }
+
+  const HeightField &field = isSimulationThreadRunning()
+    ? _shownSamples : *_currentSamples;
+  for (auto y = 0; y < _samplesTextureHeight; ++y) {
+    field.loadRow(y, 0, _samplesTextureWidth,
+        &heights[y * _samplesTextureWidth]);
+  }
+}
+
+void WaterSurface::readNormals(vector<glm::vec3> &normals) {
+  auto totalSamples = _samplesTextureWidth * _samplesTextureHeight;
+  normals.resize(totalSamples);
+  if (isSimulationThreadRunning()) {
+    cerr << "Water normals cannot be read while the simulation thread runs."
+      << endl;
+    return;
+  }
+
+  vector<float> texels(2 * totalSamples);
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    _gpuSolver->readNormals(&texels[0]);
+  } else if (_normalMapFormat == NormalMapFormat::RG16) {
+    auto data = (const GLushort*)&_normalMapData[0];
+    for (auto i = 0; i < 2 * totalSamples; ++i) {
+      texels[i] = data[i] / 65535.0f;
+    }
+  } else {
+    for (auto i = 0; i < 2 * totalSamples; ++i) {
+      texels[i] = _normalMapData[i] / 255.0f;
+    }
+  }
+
+  for (auto i = 0; i < totalSamples; ++i) {
+    auto x = 2.0f * texels[2 * i] - 1.0f;
+    auto z = 2.0f * texels[2 * i + 1] - 1.0f;
+    normals[i] = glm::normalize(
+        glm::vec3(x, sqrtf(max(0.0f, 1.0f - x*x - z*z)), z));
+  }
+}
+
+// Sample centers sit half a sample into their texels.
+void WaterSurface::getBounds(glm::vec3 &minimum, glm::vec3 &maximum) {
+  minimum = glm::vec3(-0.5f * _planeWidth, -cBoundsHeightMargin - cSkirtDepth,
+      -0.5f * _planeHeight);
+  maximum = glm::vec3(0.5f * _planeWidth, cBoundsHeightMargin,
+      0.5f * _planeHeight);
+}
+
+glm::vec2 WaterSurface::getSamplePosition(float x, float z) {
+  auto textureSpacePosition = glm::vec3(
+      _textureMatrix * _invModelMatrix * glm::vec4(x, 0.0f, z, 1.0f)
+  );
+  return glm::vec2(textureSpacePosition.x * _samplesTextureWidth - 0.5f,
+      textureSpacePosition.z * _samplesTextureHeight - 0.5f);
+}
+
+void WaterSurface::setSimulationMode(WaterSimulationMode mode) {
+  if (isSimulationThreadRunning()) {
+    cerr << "Water simulation mode cannot change while its thread runs."
+      << endl;
+    return;
+  }
+
+  if (mode == WaterSimulationMode::Spectral) {
+    if (!isPowerOfTwo(_samplesTextureWidth) ||
+        !isPowerOfTwo(_samplesTextureHeight)) {
+      cerr << "Spectral water needs power of two sample counts, "
+        << "using finite differences." << endl;
+      mode = WaterSimulationMode::FiniteDifference;
+    } else {
+      _oceanSpectrum.create(_samplesTextureWidth, _samplesTextureHeight,
+          _planeWidth, _planeHeight, cOceanWind, cOceanAmplitude, cOceanSeed);
+      _spectralTime = 0.0f;
+    }
+  }
+
+  if (mode == WaterSimulationMode::Gpu && !GpuWaterSolver::isSupported()) {
+    cerr << "Gpu water needs GL 4.3, using finite differences." << endl;
+    mode = WaterSimulationMode::FiniteDifference;
+  }
+  if (mode == WaterSimulationMode::Gpu) {
+    if (!_gpuSolver) {
+      _gpuSolver.reset(new GpuWaterSolver());
+    }
+    _gpuSolver->create(_samplesTextureWidth, _samplesTextureHeight,
+        _normalMapFormat == NormalMapFormat::RG16 ? GL_RG16 : GL_RG8);
+  } else {
+    _gpuSolver.reset();
+  }
+
+  stopCapture();
+  _simulationMode = mode;
+  clearSamples();
+  fill(_tileDirty.begin(), _tileDirty.end(), 1);
+}
+
+void WaterSurface::setRefinementFocus(glm::vec3 position, float radius) {
+  if (isSimulationThreadRunning()) {
+    WaterCommand command = {
+      WaterCommandType::RefinementFocus, position, radius
+    };
+    pushCommand(command);
+  } else {
+    _refinementFocus = position;
+    _refinementRadius = radius;
+  }
+}
+
+void WaterSurface::setSubsteps(int substeps) {
+  if (isSimulationThreadRunning()) {
+    WaterCommand command = {
+      WaterCommandType::Substeps, glm::vec3(0.0f), (float)substeps
+    };
+    pushCommand(command);
+  } else {
+    _substeps = max(1, min(cTileSize, substeps));
+  }
+}
+
+void WaterSurface::update(float deltaTime) {
+  if (!isSimulationThreadRunning()) {
+    advance(deltaTime);
+    return;
+  }
+
+  // The thread runs at most one update ahead of the renderer. Waiting
+  // here when it falls behind keeps the frame time at the longer of the
+  // two instead of letting queued updates pile up. It may be waiting for
+  // a snapshot slot itself, so they are collected while waiting.
+  collectSnapshots();
+  while (_pendingUpdates.load(memory_order_acquire) >= 2) {
+    this_thread::yield();
+    collectSnapshots();
+  }
+  _pendingUpdates.fetch_add(1, memory_order_relaxed);
+  WaterCommand command = {
+    WaterCommandType::Update, glm::vec3(0.0f), deltaTime, _footprintWrite
+  };
+  pushCommand(command);
+
+  // With at most two updates in flight, the buffer after the one just
+  // handed over belongs to an update that has already finished.
+  _footprintWrite = (_footprintWrite + 1) % 3;
+  _footprints[_footprintWrite].clear();
+}
+
+void WaterSurface::advance(float deltaTime) {
+  if (_simulationMode == WaterSimulationMode::Spectral) {
+    updateSpectral(deltaTime);
+    countSteps(1);
+    return;
+  }
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    _gpuSolver->step(_substeps, waveCoefficient(), cDamping);
+    _gpuSolver->updateNormals();
+    countSteps(_substeps);
+    return;
+  }
+
+  // The coarse level of hierarchical mode is coupled in between single
+  // steps, so only plain finite differences are blocked in time.
+  if (_simulationMode == WaterSimulationMode::FiniteDifference &&
+      _substeps > 1 && _temporalBlocking) {
+    stepBlocked();
+    updateTileActivity(_substeps + 1);
+    _stepCounter += _substeps;
+    countSteps(_substeps);
+    return;
+  }
+
+  for (auto i = 0; i < _substeps; ++i) {
+    beginStep();
+    stepTileRows(0, _tilesY);
+    endStep();
+  }
+}
+
+bool WaterSurface::canSplitStep() {
+  return !isSimulationThreadRunning() && _substeps == 1 &&
+    _simulationMode != WaterSimulationMode::Spectral &&
+    _simulationMode != WaterSimulationMode::Gpu;
 }
 
-void WaterSurface::create(float planeWidth, float planeHeight,
-    int samplesTextureWidth, int samplesTextureHeight) {
-  _planeWidth = planeWidth;
-  _planeHeight = planeHeight;
-  _samplesTextureWidth = samplesTextureWidth;
-  _samplesTextureHeight = samplesTextureHeight;
+bool WaterSurface::mustStepOnCallingThread() {
+  return isSimulationThreadRunning() ||
+    _simulationMode == WaterSimulationMode::Gpu;
+}
 
-  clearSamples();
-  auto normalMapData = buildNormalMap();
+void WaterSurface::beginStep() {
+  if (_simulationMode == WaterSimulationMode::Hierarchical &&
+      _stepCounter % cCoarseFactor == 0) {
+    updateCoarseLevel();
+  }
+}
 
-  glGenTextures(1, &_normalMapTexture);
-  glBindTexture(GL_TEXTURE_2D, _normalMapTexture);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, _samplesTextureWidth,
-      _samplesTextureHeight, 0, GL_RGB, GL_UNSIGNED_BYTE, &normalMapData[0]);
-  glBindTexture(GL_TEXTURE_2D, 0);
+void WaterSurface::stepTileRows(int firstTileRow, int lastTileRow) {
+  float scratch[5 * (cTileSize + 2)];
+  auto A = waveCoefficient();
+  for (auto tileY = firstTileRow; tileY < lastTileRow; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      if (!_tileActive[tileY * _tilesX + tileX]) {
+        continue;
+      }
+      int x0, y0, x1, y1;
+      getTileRect(tileX, tileY, 0, x0, y0, x1, y1);
+      stepWaveEquation(*_currentSamples, *_previousSamples,
+          x0, y0, x1, y1, A, cDamping, scratch);
+    }
+  }
+}
 
-  createPlane(_planeWidth, _planeHeight, _vbo, _vao, _ebo);
+void WaterSurface::endStep() {
+  swap(_currentSamples, _previousSamples);
+  if (_simulationMode == WaterSimulationMode::Hierarchical) {
+    prolongateInactiveTiles();
+  }
+  updateTileActivity(2);
+  ++_stepCounter;
+  countSteps(1);
+}
 
-  _textureMatrix = glm::scale(glm::mat4(1.0f), 
-      glm::vec3(1.0f/_planeWidth, 0, 1.0f/_planeHeight));
-  _textureMatrix = glm::translate(_textureMatrix, 
-      glm::vec3(0.5f * _planeWidth, 0, 0.5f * _planeHeight));
+bool WaterSurface::startCapture(const string &path, int interval) {
+  if (isSimulationThreadRunning()) {
+    cerr << "Water capture cannot start while the simulation thread runs."
+      << endl;
+    return false;
+  }
 
-  VertexShader vertexShader(SHADER_PATH_PREFIX"water.vert");
-  FragmentShader fragmentShader(SHADER_PATH_PREFIX"water.frag");
-  _shader.attach(&vertexShader);
-  _shader.attach(&fragmentShader);
-  _shader.link();
+  // Gpu heights are read back as floats.
+  auto gpu = _simulationMode == WaterSimulationMode::Gpu;
+  HeightCaptureHeader header = {
+    _samplesTextureWidth, _samplesTextureHeight,
+    gpu ? HeightFieldPrecision::Float32 : _heightPrecision,
+    gpu ? 1.0f : _samples.getFixedPointRange(), max(1, interval)
+  };
+  if (!_capture.open(path, header)) {
+    return false;
+  }
+  _captureInterval = header.interval;
+  _captureCountdown = header.interval;
+  _capturedSteps = 0;
+  return true;
 }
 
-void WaterSurface::free() {
-  // todo: Free allocated resources.
+void WaterSurface::stopCapture() {
+  if (isSimulationThreadRunning()) {
+    cerr << "Water capture cannot stop while the simulation thread runs."
+      << endl;
+    return;
+  }
+  _capture.close();
 }
 
-void WaterSurface::applyDisturbaceInWorldSpace(glm::vec3 position, 
-    float strength) {
-  auto textureSpacePosition = glm::vec3(
-      _textureMatrix * _invModelMatrix * glm::vec4(position, 1.0f)
-  );
-  
-  if (textureSpacePosition.x < 0.0f || textureSpacePosition.x > 1.0f ||
-      textureSpacePosition.z < 0.0f || textureSpacePosition.z > 1.0f) {
+void WaterSurface::saveCheckpoint(CheckpointWriter &writer, int index) {
+  auto threaded = isSimulationThreadRunning();
+  stopSimulationThread();
+
+  WaterCheckpointHeader header = {
+    _samplesTextureWidth, _samplesTextureHeight,
+    (int32_t)_simulationMode, (int32_t)_heightPrecision,
+    _substeps, _stepCounter,
+    _currentSamples == &_samples2, _currentCoarseSamples == &_coarseSamples2,
+    { _refinementFocus.x, _refinementFocus.y, _refinementFocus.z },
+    _refinementRadius, _spectralTime
+  };
+  writer.add(cCheckpointHeaderTag, index, &header, sizeof(header));
+
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    auto totalSamples = _samplesTextureWidth * _samplesTextureHeight;
+    vector<float> current(totalSamples), previous(totalSamples);
+    _gpuSolver->readState(&current[0], &previous[0]);
+    writer.add(cCheckpointSamplesTags[0], index, current);
+    writer.add(cCheckpointSamplesTags[1], index, previous);
+  } else {
+    const HeightField *buffers[] = { &_samples, &_samples2 };
+    const HeightField *coarseBuffers[] = { &_coarseSamples, &_coarseSamples2 };
+    for (auto i = 0; i < 2; ++i) {
+      writer.add(cCheckpointSamplesTags[i], index,
+          buffers[i]->getData(0, 0), buffers[i]->getSizeInBytes());
+      if (_simulationMode == WaterSimulationMode::Hierarchical) {
+        writer.add(cCheckpointCoarseTags[i], index,
+            coarseBuffers[i]->getData(0, 0),
+            coarseBuffers[i]->getSizeInBytes());
+      }
+    }
+    writer.add(cCheckpointTilesTag, index, _tileActive);
+    writer.add(cCheckpointCoarseCalmTag, index, _tileCoarseCalm);
+    writer.add(cCheckpointNormalsTag, index, _normalMapData);
+  }
+
+  if (threaded) {
+    startSimulationThread();
+  }
+}
+
+static bool hasSection(const Checkpoint &checkpoint, uint32_t tag, int index,
+    size_t size) {
+  size_t found;
+  return checkpoint.find(tag, index, found) && found == size;
+}
+
+// Everything restoring relies on, looked at before anything changes.
+bool WaterSurface::checkCheckpoint(const Checkpoint &checkpoint, int index) {
+  WaterCheckpointHeader header;
+  if (!checkpoint.read(cCheckpointHeaderTag, index, header)) {
+    cerr << "Checkpoint has no water surface " << index << "." << endl;
+    return false;
+  }
+
+  auto mode = (WaterSimulationMode)header.mode;
+  auto gpu = mode == WaterSimulationMode::Gpu;
+  if (!gpu && header.precision != (int32_t)_heightPrecision) {
+    cerr << "Checkpoint of water surface " << index << " does not match "
+      << "its height precision." << endl;
+    return false;
+  }
+  if (gpu && !GpuWaterSolver::isSupported()) {
+    cerr << "Checkpoint of water surface " << index << " needs the Gpu "
+      << "mode, which is not supported." << endl;
+    return false;
+  }
+
+  auto valid = header.width > 0 && header.height > 0 &&
+    header.mode >= 0 && header.mode <= (int32_t)WaterSimulationMode::Gpu &&
+    (mode != WaterSimulationMode::Spectral ||
+     (isPowerOfTwo(header.width) && isPowerOfTwo(header.height)));
+  if (valid) {
+    auto sampleBytes = (size_t)header.width * header.height *
+      (gpu ? sizeof(float) : _samples.getBytesPerSample());
+    auto coarseBytes = (size_t)((header.width + cCoarseFactor - 1)
+        / cCoarseFactor) * ((header.height + cCoarseFactor - 1)
+        / cCoarseFactor) * sizeof(float);
+    auto numTiles = (size_t)((header.width + cTileSize - 1) / cTileSize) *
+      ((header.height + cTileSize - 1) / cTileSize);
+    for (auto i = 0; i < 2; ++i) {
+      valid = valid &&
+        hasSection(checkpoint, cCheckpointSamplesTags[i], index, sampleBytes);
+      if (mode == WaterSimulationMode::Hierarchical) {
+        valid = valid &&
+          hasSection(checkpoint, cCheckpointCoarseTags[i], index, coarseBytes);
+      }
+    }
+    if (!gpu) {
+      valid = valid &&
+        hasSection(checkpoint, cCheckpointTilesTag, index, numTiles) &&
+        hasSection(checkpoint, cCheckpointCoarseCalmTag, index, numTiles);
+    }
+  }
+  if (!valid) {
+    cerr << "Checkpoint of water surface " << index << " is damaged."
+      << endl;
+  }
+  return valid;
+}
+
+bool WaterSurface::restoreCheckpoint(const Checkpoint &checkpoint,
+    int index) {
+  WaterCheckpointHeader header;
+  if (!checkCheckpoint(checkpoint, index) ||
+      !checkpoint.read(cCheckpointHeaderTag, index, header)) {
+    return false;
+  }
+
+  auto mode = (WaterSimulationMode)header.mode;
+  auto threaded = isSimulationThreadRunning();
+  stopSimulationThread();
+  if (header.width != _samplesTextureWidth ||
+      header.height != _samplesTextureHeight) {
+    resize(_planeWidth, _planeHeight, header.width, header.height);
+  }
+  if (mode != _simulationMode) {
+    setSimulationMode(mode);
+  }
+
+  auto restored = _simulationMode == mode && restoreSamples(checkpoint, index);
+  if (restored) {
+    _currentSamples = header.samplesSwapped ? &_samples2 : &_samples;
+    _previousSamples = header.samplesSwapped ? &_samples : &_samples2;
+    _currentCoarseSamples = header.coarseSwapped
+      ? &_coarseSamples2 : &_coarseSamples;
+    _previousCoarseSamples = header.coarseSwapped
+      ? &_coarseSamples : &_coarseSamples2;
+    _stepCounter = header.stepCounter;
+    setSubsteps(header.substeps);
+    _refinementFocus = glm::vec3(header.refinementFocus[0],
+        header.refinementFocus[1], header.refinementFocus[2]);
+    _refinementRadius = header.refinementRadius;
+    _spectralTime = header.spectralTime;
+
+    // Normals saved in another format are rebuilt. The spectrum is a
+    // function of time, so it is evaluated again in full.
+    size_t normalsSize;
+    auto normals = checkpoint.find(cCheckpointNormalsTag, index, normalsSize);
+    if (_simulationMode == WaterSimulationMode::Spectral) {
+      updateSpectral(0.0f);
+    } else if (normals && normalsSize == _normalMapData.size()) {
+      memcpy(&_normalMapData[0], normals, normalsSize);
+    } else if (_simulationMode != WaterSimulationMode::Gpu) {
+      calculateNormalMap(0, 0, _samplesTextureWidth, _samplesTextureHeight);
+    }
+  } else {
+    cerr << "Checkpoint of water surface " << index << " is damaged."
+      << endl;
+    clearSamples();
+  }
+  fill(_tileDirty.begin(), _tileDirty.end(), 1);
+
+  if (threaded) {
+    startSimulationThread();
+  }
+  return restored;
+}
+
+// Samples are copied straight out of the mapped file.
+bool WaterSurface::restoreSamples(const Checkpoint &checkpoint, int index) {
+  size_t sizes[2];
+  const void *data[2];
+  for (auto i = 0; i < 2; ++i) {
+    data[i] = checkpoint.find(cCheckpointSamplesTags[i], index, sizes[i]);
+    if (!data[i]) {
+      return false;
+    }
+  }
+
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    auto bytes = _samplesTextureWidth * _samplesTextureHeight * sizeof(float);
+    if (sizes[0] != bytes || sizes[1] != bytes) {
+      return false;
+    }
+    _gpuSolver->writeState((const float*)data[0], (const float*)data[1]);
+    _gpuSolver->updateNormals();
+    return true;
+  }
+
+  HeightField *buffers[] = { &_samples, &_samples2 };
+  HeightField *coarseBuffers[] = { &_coarseSamples, &_coarseSamples2 };
+  for (auto i = 0; i < 2; ++i) {
+    if (sizes[i] != buffers[i]->getSizeInBytes()) {
+      return false;
+    }
+    memcpy(buffers[i]->getData(0, 0), data[i], sizes[i]);
+
+    if (_simulationMode == WaterSimulationMode::Hierarchical) {
+      size_t size;
+      auto coarse = checkpoint.find(cCheckpointCoarseTags[i], index, size);
+      if (!coarse || size != coarseBuffers[i]->getSizeInBytes()) {
+        return false;
+      }
+      memcpy(coarseBuffers[i]->getData(0, 0), coarse, size);
+    }
+  }
+
+  auto numTiles = (size_t)_tilesX * _tilesY;
+  return checkpoint.read(cCheckpointTilesTag, index, _tileActive)
+    && checkpoint.read(cCheckpointCoarseCalmTag, index, _tileCoarseCalm)
+    && _tileActive.size() == numTiles && _tileCoarseCalm.size() == numTiles;
+}
+
+// Runs on the thread that steps the samples, right after the steps.
+void WaterSurface::countSteps(int steps) {
+  _solverSteps.fetch_add(steps, memory_order_relaxed);
+  if (!_capture.isOpen()) {
+    return;
+  }
+
+  _capturedSteps += steps;
+  _captureCountdown -= steps;
+  if (_captureCountdown > 0) {
     return;
   }
+  _captureCountdown = _captureInterval;
 
-  int coordX = (int)(textureSpacePosition.x * _samplesTextureWidth);
-  int coordY = (int)(textureSpacePosition.z * _samplesTextureHeight);
-  (*_currentSamples)[coordY*_samplesTextureHeight+coordX] += strength;
+  if (_simulationMode == WaterSimulationMode::Gpu) {
+    _captureScratch.resize(_samplesTextureWidth * _samplesTextureHeight);
+    _gpuSolver->readHeights(&_captureScratch[0]);
+    _capture.submit(_capturedSteps, &_captureScratch[0]);
+  } else {
+    _capture.submit(_capturedSteps, _currentSamples->getData(0, 0));
+  }
 }
 
-void WaterSurface::update(float deltaTime) {
-  int N = 256;
-  float h = 2.0f / (N-1);
-  float c = 1.0f;
-  float dt = 1.0f / N;
+int WaterSurface::getNumActiveTiles() {
+  return (int)count(_tileActive.begin(), _tileActive.end(), 1);
+}
+
+void WaterSurface::stepBlocked() {
+  auto A = waveCoefficient();
+  auto bandSize = 2 * _substeps * _samplesTextureWidth;
+  _savedRows[0].resize(bandSize);
+  _savedRows[1].resize(bandSize);
+  _savedColumns.resize(2 * _substeps * cTileSize);
+
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    swap(_savedRows[0], _savedRows[1]);
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      if (_tileActive[tileY * _tilesX + tileX]) {
+        stepTileBlocked(tileX, tileY, A, _savedRows[1], _savedRows[0]);
+      }
+    }
+  }
+}
+
+void WaterSurface::stepTileBlocked(int tileX, int tileY, float A,
+    const vector<float> &savedRows, vector<float> &nextRows) {
+  auto k = _substeps;
+  auto width = _samplesTextureWidth, height = _samplesTextureHeight;
+  int x0, y0, x1, y1;
+  getTileRect(tileX, tileY, 0, x0, y0, x1, y1);
+
+  // The window is the tile with a halo of one sample per step and a ring
+  // of zeros standing in for samples outside of the pool.
+  auto wx0 = max(0, x0 - k), wy0 = max(0, y0 - k);
+  auto wx1 = min(width, x1 + k), wy1 = min(height, y1 + k);
+  auto stride = wx1 - wx0 + 2;
+  auto windowSize = stride * (wy1 - wy0 + 2);
+  _blockScratch.assign(2 * windowSize + stride, 0.0f);
+  float *fields[] = { &_blockScratch[0], &_blockScratch[windowSize] };
+  float *columnRamp = &_blockScratch[2 * windowSize];
+  auto at = [=](int x, int y) { return (y - wy0 + 1) * stride + x - wx0 + 1; };
+
+  HeightField *liveFields[] = { _currentSamples, _previousSamples };
+  for (auto f = 0; f < 2; ++f) {
+    for (auto y = wy0; y < wy1; ++y) {
+      liveFields[f]->loadRow(y, wx0, wx1, fields[f] + at(wx0, y));
+    }
+  }
+
+  // Tiles above and to the left have already been advanced; the halo
+  // takes their saved initial samples instead.
+  if (tileY > 0) {
+    for (auto tx = wx0 / cTileSize; tx * cTileSize < wx1; ++tx) {
+      if (!_tileActive[(tileY - 1) * _tilesX + tx]) {
+        continue;
+      }
+      auto cx0 = max(wx0, tx * cTileSize);
+      auto cx1 = min(wx1, (tx + 1) * cTileSize);
+      for (auto f = 0; f < 2; ++f) {
+        for (auto r = 0; r < k; ++r) {
+          auto source = &savedRows[(f * k + r) * width];
+          copy(source + cx0, source + cx1, fields[f] + at(cx0, y0 - k + r));
+        }
+      }
+    }
+  }
+
+  if (tileX > 0 && _tileActive[tileY * _tilesX + tileX - 1]) {
+    for (auto f = 0; f < 2; ++f) {
+      for (auto y = y0; y < y1; ++y) {
+        auto source = &_savedColumns[(f * cTileSize + y - y0) * k];
+        copy(source, source + k, fields[f] + at(x0 - k, y));
+      }
+    }
+  }
+
+  // Save this tile's own initial bands before it is advanced. The last
+  // row and column have no neighbours that would need them.
+  if (tileY < _tilesY - 1) {
+    for (auto f = 0; f < 2; ++f) {
+      for (auto r = 0; r < k; ++r) {
+        auto source = fields[f] + at(x0, y1 - k + r);
+        copy(source, source + x1 - x0,
+            &nextRows[(f * k + r) * width + x0]);
+      }
+    }
+  }
+
+  if (tileX < _tilesX - 1) {
+    for (auto f = 0; f < 2; ++f) {
+      for (auto y = y0; y < y1; ++y) {
+        auto source = fields[f] + at(x1 - k, y);
+        copy(source, source + k,
+            &_savedColumns[(f * cTileSize + y - y0) * k]);
+      }
+    }
+  }
 
-  float A = (c*c)*(dt*dt)/(h*h);
+  // Every step the valid region shrinks by one sample on the sides that
+  // border other tiles. After k steps it still covers the tile.
   float B = 2 - 4*A;
-  
-  for (auto y = 0; y < _samplesTextureHeight; ++y) {
-    for (auto x = 0; x < _samplesTextureWidth; ++x) {
-      auto baseIndex = y * _samplesTextureWidth + x;
-      float previous = (*_previousSamples)[baseIndex];
-      float current = (*_currentSamples)[baseIndex];
-      float neighborsSum = 0.0f;
-      int dispX[] = { -1, 1,  0, 0 };
-      int dispY[] = {  0, 0, -1, 1 };
-      for (int i = 0; i < 4; ++i) {
-        auto fx = x + dispX[i];
-        auto fy = y + dispY[i];
-        if (fx >= 0 && fx < _samplesTextureWidth &&
-            fy >= 0 && fy < _samplesTextureHeight) {
-          neighborsSum += (*_currentSamples)[fy*_samplesTextureWidth+fx];
+  float *current = fields[0], *previous = fields[1];
+  for (auto x = wx0; x < wx1; ++x) {
+    columnRamp[x - wx0] = wallRamp(x, width);
+  }
+  for (auto s = 1; s <= k; ++s) {
+    auto sx0 = wx0 > 0 ? wx0 + s : 0;
+    auto sy0 = wy0 > 0 ? wy0 + s : 0;
+    auto sx1 = wx1 < width ? wx1 - s : width;
+    auto sy1 = wy1 < height ? wy1 - s : height;
+    for (auto y = sy0; y < sy1; ++y) {
+      auto base = at(sx0, y);
+      auto ramp = columnRamp + sx0 - wx0;
+      float rowRamp = wallRamp(y, height);
+      for (auto i = 0; i < sx1 - sx0; ++i) {
+        auto index = base + i;
+        float neighborsSum = current[index - 1] + current[index + 1]
+          + current[index - stride] + current[index + stride];
+        float damping = cDamping * min(ramp[i], rowRamp);
+        previous[index] = damping
+          * (A*neighborsSum + B*current[index] - previous[index]);
+      }
+    }
+    swap(current, previous);
+  }
+
+  for (auto y = y0; y < y1; ++y) {
+    _currentSamples->storeRow(y, x0, x1, current + at(x0, y));
+    _previousSamples->storeRow(y, x0, x1, previous + at(x0, y));
+  }
+}
+
+void WaterSurface::updateSpectral(float deltaTime) {
+  _spectralTime += deltaTime;
+  _oceanSpectrum.evaluate(_spectralTime);
+
+  // Samples are kept in units of the sample spacing, which is what the
+  // renderer scales heights by.
+  auto sampleSpacing = _planeWidth / _samplesTextureWidth;
+  const auto &heights = _oceanSpectrum.getHeights();
+  const auto &slopesX = _oceanSpectrum.getSlopesX();
+  const auto &slopesZ = _oceanSpectrum.getSlopesZ();
+  auto &samples = *_currentSamples;
+
+  parallelFor(0, _samplesTextureHeight, [&](int firstRow, int lastRow) {
+    float row[cTileSize];
+    for (auto y = firstRow; y < lastRow; ++y) {
+      for (auto x0 = 0; x0 < _samplesTextureWidth; x0 += cTileSize) {
+        auto x1 = min(_samplesTextureWidth, x0 + cTileSize);
+        for (auto x = x0; x < x1; ++x) {
+          auto index = y * _samplesTextureWidth + x;
+          row[x - x0] = heights[index] / sampleSpacing;
+          storeNormal(index, glm::normalize(
+              glm::vec3(-slopesX[index], 1.0f, -slopesZ[index])));
         }
+        samples.storeRow(y, x0, x1, row);
+      }
+    }
+  });
+
+  fill(_tileDirty.begin(), _tileDirty.end(), 1);
+}
+
+void WaterSurface::updateCoarseLevel() {
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      if (_tileActive[tileY * _tilesX + tileX]) {
+        restrictTile(tileX, tileY);
+      }
+    }
+  }
+
+  _rowScratch.resize(5 * (_coarseWidth + 2));
+  stepWaveEquation(*_currentCoarseSamples, *_previousCoarseSamples,
+      0, 0, _coarseWidth, _coarseHeight,
+      waveCoefficient(), powf(cDamping, (float)cCoarseFactor),
+      &_rowScratch[0]);
+  swap(_currentCoarseSamples, _previousCoarseSamples);
+}
+
+// Runs after the swap, before activity is updated, so a tile that wakes up
+// is stepped from the coarse solution at the right time. Tiles the step
+// left alone would otherwise alternate between their two buffers.
+void WaterSurface::prolongateInactiveTiles() {
+  auto phase = _stepCounter % cCoarseFactor;
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      if (!_tileActive[tileY * _tilesX + tileX]) {
+        prolongateTile(tileX, tileY, phase);
       }
+    }
+  }
+}
 
-      float px = ((float)x) / (_samplesTextureWidth-1);
-      float py = ((float)y) / (_samplesTextureHeight-1);
-      float l = min(px, min(1.0f - px, min(py, 1.0f - py)));
-      float damping = 0.95f * min(1.0f, l/0.01f);
+void WaterSurface::restrictTile(int tileX, int tileY) {
+  int x0, y0, x1, y1;
+  getTileRect(tileX, tileY, 0, x0, y0, x1, y1);
+  auto &coarse = *_currentCoarseSamples;
 
-      (*_previousSamples)[baseIndex] 
-        = damping * (A*neighborsSum + B*current - previous);
+  for (auto cy = y0 / cCoarseFactor; cy * cCoarseFactor < y1; ++cy) {
+    for (auto cx = x0 / cCoarseFactor; cx * cCoarseFactor < x1; ++cx) {
+      float sum = 0.0f;
+      int count = 0;
+      for (auto y = cy * cCoarseFactor;
+          y < min(y1, (cy + 1) * cCoarseFactor); ++y) {
+        for (auto x = cx * cCoarseFactor;
+            x < min(x1, (cx + 1) * cCoarseFactor); ++x) {
+          sum += _currentSamples->get(x, y);
+          ++count;
+        }
+      }
+      coarse.set(cx, cy, sum / count);
     }
   }
+}
 
-  swap(_currentSamples, _previousSamples);
-  calculateNormalMap();
+void WaterSurface::prolongateTile(int tileX, int tileY, int phase) {
+  auto tile = tileY * _tilesX + tileX;
+  int x0, y0, x1, y1;
+  getTileRect(tileX, tileY, 0, x0, y0, x1, y1);
+
+  auto cx0 = max(0, x0 / cCoarseFactor - 1);
+  auto cy0 = max(0, y0 / cCoarseFactor - 1);
+  auto cx1 = min(_coarseWidth, x1 / cCoarseFactor + 1);
+  auto cy1 = min(_coarseHeight, y1 / cCoarseFactor + 1);
+  float maxCoarse = 0.0f;
+  for (auto cy = cy0; cy < cy1; ++cy) {
+    for (auto cx = cx0; cx < cx1; ++cx) {
+      maxCoarse = max(maxCoarse, max(fabs(_currentCoarseSamples->get(cx, cy)),
+            fabs(_previousCoarseSamples->get(cx, cy))));
+    }
+  }
+
+  // A calm coarse region is written as flat water once, in both buffers
+  // so the swaps leave it alone.
+  if (maxCoarse < cTileSleepEpsilon) {
+    if (!_tileCoarseCalm[tile]) {
+      _tileCoarseCalm[tile] = 1;
+      _currentSamples->clearRect(x0, y0, x1, y1);
+      _previousSamples->clearRect(x0, y0, x1, y1);
+      getTileRect(tileX, tileY, 1, x0, y0, x1, y1);
+      calculateNormalMap(x0, y0, x1, y1);
+      _tileDirty[tile] = 1;
+    }
+    return;
+  }
+  _tileCoarseCalm[tile] = 0;
+
+  // The coarse level spans cCoarseFactor fine steps, the samples are
+  // interpolated to the next fine step and the one before it.
+  float currentTime = (float)(phase + 1) / cCoarseFactor;
+  float previousTime = (float)phase / cCoarseFactor;
+  for (auto y = y0; y < y1; ++y) {
+    for (auto x = x0; x < x1; ++x) {
+      float current = sampleCoarse(*_currentCoarseSamples, x, y);
+      float previous = sampleCoarse(*_previousCoarseSamples, x, y);
+      _currentSamples->set(x, y,
+          previous + (current - previous) * currentTime);
+      _previousSamples->set(x, y,
+          previous + (current - previous) * previousTime);
+    }
+  }
+
+  // Normals and textures follow once per coarse step.
+  if (phase == cCoarseFactor - 1) {
+    getTileRect(tileX, tileY, 1, x0, y0, x1, y1);
+    calculateNormalMap(x0, y0, x1, y1);
+    _tileDirty[tile] = 1;
+  }
+}
+
+float WaterSurface::sampleCoarseAt(int x, int y, float time) {
+  float previous = sampleCoarse(*_previousCoarseSamples, x, y);
+  return previous + (sampleCoarse(*_currentCoarseSamples, x, y) - previous)
+    * time;
+}
+
+float WaterSurface::sampleCoarse(const HeightField &coarse, int x, int y) {
+  float u = (x + 0.5f) / cCoarseFactor - 0.5f;
+  float v = (y + 0.5f) / cCoarseFactor - 0.5f;
+  u = max(0.0f, min((float)(_coarseWidth - 1), u));
+  v = max(0.0f, min((float)(_coarseHeight - 1), v));
+
+  int u0 = (int)u, v0 = (int)v;
+  int u1 = min(u0 + 1, _coarseWidth - 1), v1 = min(v0 + 1, _coarseHeight - 1);
+  float fu = u - u0, fv = v - v0;
+
+  float top = (1.0f - fu) * coarse.get(u0, v0) + fu * coarse.get(u1, v0);
+  float bottom = (1.0f - fu) * coarse.get(u0, v1) + fu * coarse.get(u1, v1);
+  return (1.0f - fv) * top + fv * bottom;
+}
+
+void WaterSurface::updateTileActivity(int edgeBand) {
+  auto hierarchical = _simulationMode == WaterSimulationMode::Hierarchical;
+  auto coarseTime = (float)(_stepCounter % cCoarseFactor + 1) / cCoarseFactor;
+  fill(_tileNextActive.begin(), _tileNextActive.end(), 0);
+
+  if (hierarchical && _refinementRadius > 0.0f) {
+    markFocusTiles();
+  }
+
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      auto tile = tileY * _tilesX + tileX;
+      if (!_tileActive[tile]) {
+        continue;
+      }
+
+      int x0, y0, x1, y1;
+      getTileRect(tileX, tileY, 0, x0, y0, x1, y1);
+
+      // Waves travel one sample per step, so neighbours are woken while
+      // the wavefront is still more steps away from the tile edge than
+      // will be taken before the next check. In hierarchical mode only
+      // detail missing from the coarse level counts.
+      float maxHeight = 0.0f, maxVelocity = 0.0f;
+      float edgeHeight[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+      _rowScratch.resize(2 * cTileSize);
+      float *current = &_rowScratch[0], *previous = current + cTileSize;
+      for (auto y = y0; y < y1; ++y) {
+        _currentSamples->loadRow(y, x0, x1, current);
+        _previousSamples->loadRow(y, x0, x1, previous);
+        for (auto x = x0; x < x1; ++x) {
+          auto i = x - x0;
+          auto height = fabs(current[i] - (hierarchical
+                ? sampleCoarseAt(x, y, coarseTime) : 0.0f));
+          maxHeight = max(maxHeight, height);
+          maxVelocity = max(maxVelocity, fabs(current[i] - previous[i]));
+          if (x < x0 + edgeBand) edgeHeight[0] = max(edgeHeight[0], height);
+          if (x >= x1 - edgeBand) edgeHeight[1] = max(edgeHeight[1], height);
+          if (y < y0 + edgeBand) edgeHeight[2] = max(edgeHeight[2], height);
+          if (y >= y1 - edgeBand) edgeHeight[3] = max(edgeHeight[3], height);
+        }
+      }
+
+      int neighborX[] = { tileX - 1, tileX + 1, tileX, tileX };
+      int neighborY[] = { tileY, tileY, tileY - 1, tileY + 1 };
+      for (auto i = 0; i < 4; ++i) {
+        if (edgeHeight[i] > cTileSleepEpsilon &&
+            neighborX[i] >= 0 && neighborX[i] < _tilesX &&
+            neighborY[i] >= 0 && neighborY[i] < _tilesY) {
+          _tileNextActive[neighborY[i] * _tilesX + neighborX[i]] = 1;
+        }
+      }
+
+      if (hierarchical) {
+        if (maxHeight >= cTileSleepEpsilon) {
+          _tileNextActive[tile] = 1;
+        } else {
+          _tileCoarseCalm[tile] = 0;
+        }
+      } else if (maxHeight < cTileSleepEpsilon &&
+          maxVelocity < cTileSleepEpsilon) {
+        _currentSamples->clearRect(x0, y0, x1, y1);
+        _previousSamples->clearRect(x0, y0, x1, y1);
+      } else {
+        _tileNextActive[tile] = 1;
+      }
+
+      // Border normals depend on samples of the adjacent tiles.
+      getTileRect(tileX, tileY, 1, x0, y0, x1, y1);
+      calculateNormalMap(x0, y0, x1, y1);
+      _tileDirty[tile] = 1;
+    }
+  }
+
+  swap(_tileActive, _tileNextActive);
+}
+
+void WaterSurface::markFocusTiles() {
+  auto focus = glm::vec3(
+      _textureMatrix * _invModelMatrix * glm::vec4(_refinementFocus, 1.0f)
+  );
+  auto radiusX = _refinementRadius / _planeWidth * _samplesTextureWidth;
+  auto radiusY = _refinementRadius / _planeHeight * _samplesTextureHeight;
+  auto centerX = focus.x * _samplesTextureWidth;
+  auto centerY = focus.z * _samplesTextureHeight;
+
+  auto tileX0 = max(0, (int)((centerX - radiusX) / cTileSize));
+  auto tileY0 = max(0, (int)((centerY - radiusY) / cTileSize));
+  auto tileX1 = min(_tilesX - 1, (int)((centerX + radiusX) / cTileSize));
+  auto tileY1 = min(_tilesY - 1, (int)((centerY + radiusY) / cTileSize));
+  for (auto tileY = tileY0; tileY <= tileY1; ++tileY) {
+    for (auto tileX = tileX0; tileX <= tileX1; ++tileX) {
+      _tileNextActive[tileY * _tilesX + tileX] = 1;
+    }
+  }
+}
+
+void WaterSurface::getTileRect(int tileX, int tileY, int border,
+    int &x0, int &y0, int &x1, int &y1) {
+  x0 = max(0, tileX * cTileSize - border);
+  y0 = max(0, tileY * cTileSize - border);
+  x1 = min(_samplesTextureWidth, (tileX + 1) * cTileSize + border);
+  y1 = min(_samplesTextureHeight, (tileY + 1) * cTileSize + border);
 }
 
 void WaterSurface::draw(const glm::mat4 &viewProj, 
-    const glm::vec3 &cameraPosition) {
-  auto normalMapData = buildNormalMap();
-  copyNormalsToTexture(normalMapData);
+    const glm::vec3 &cameraPosition, LinearArena &frameArena) {
+  _numDrawCalls = 0;
+  if (isSimulationThreadRunning()) {
+    collectSnapshots();
+    uploadDirtyTiles(_shownTileDirty,
+        (const unsigned char*)_shownSamples.getData(0, 0), &_shownNormals[0]);
+  } else if (_simulationMode != WaterSimulationMode::Gpu) {
+    uploadDirtyTiles(_tileDirty,
+        (const unsigned char*)_currentSamples->getData(0, 0),
+        &_normalMapData[0]);
+  }
   
   glUseProgram(_shader.getId());
 
+  auto gpu = _simulationMode == WaterSimulationMode::Gpu;
   glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, _normalMapTexture);
+  glBindTexture(GL_TEXTURE_2D,
+      gpu ? _gpuSolver->getNormalTexture() : _normalMapTexture.get());
   glActiveTexture(GL_TEXTURE1);
   glBindTexture(GL_TEXTURE_CUBE_MAP, _cubemap);
+  glActiveTexture(GL_TEXTURE2);
+  glBindTexture(GL_TEXTURE_2D,
+      gpu ? _gpuSolver->getHeightTexture() : _heightMapTexture.get());
 
   glUniform1i(glGetUniformLocation(_shader.getId(), "textureSampler"), 0);
   glUniform1i(glGetUniformLocation(_shader.getId(), "cubemapSampler"), 1);
+  glUniform1i(glGetUniformLocation(_shader.getId(), "heightSampler"), 2);
+
+  // Normals are built with one sample per unit, so heights are scaled by
+  // the sample spacing to keep the displaced mesh consistent with them.
+  // Fixed point heights come back from the snorm texture divided by their
+  // range.
+  auto heightScale = _planeWidth / _samplesTextureWidth;
+  if (!gpu && _heightPrecision == HeightFieldPrecision::Fixed16) {
+    heightScale *= _samples.getFixedPointRange();
+  }
+  glUniform1f(glGetUniformLocation(_shader.getId(), "heightScale"),
+      heightScale);
+  glUniform1f(glGetUniformLocation(_shader.getId(), "skirtDepth"),
+      cSkirtDepth);
+  glUniform1f(glGetUniformLocation(_shader.getId(), "environmentLevels"),
+      (float)_cubemapLevels);
+  glUniform1f(glGetUniformLocation(_shader.getId(), "roughness"),
+      _roughness);
 
   GLuint viewMatrix = glGetUniformLocation(_shader.getId(), "viewProj");
   GLuint textureMatrixLoc = 
@@ -139,92 +1785,268 @@ void WaterSurface::draw(const glm::mat4 &viewProj,
   glUniformMatrix4fv(viewMatrix, 1, GL_FALSE, glm::value_ptr(viewProj));
   glUniform3fv(cameraPosLoc, 1, glm::value_ptr(cameraPosition));
 
-  glBindVertexArray(_vbo);
-  glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+  drawChunks(cameraPosition, frameArena);
+  glActiveTexture(GL_TEXTURE0);
+}
+
+void WaterSurface::drawChunks(const glm::vec3 &cameraPosition,
+    LinearArena &frameArena) {
+  auto numLods = _gridLods.size();
+  auto chunkWidth = _planeWidth / _chunksX;
+  auto chunkLength = _planeHeight / _chunksZ;
+  auto lodDistance = cChunkLodDistance * max(chunkWidth, chunkLength);
+  auto originX = -0.5f * _planeWidth;
+  auto originZ = -0.5f * _planeHeight;
+
+  auto numChunks = _chunksX * _chunksZ;
+  auto chunkLods = frameArena.allocate<int>(numChunks);
+  auto lodInstanceOffsets = frameArena.allocate<int>(numLods + 1);
+  auto chunkInstances = frameArena.allocate<glm::vec4>(numChunks);
+  fill(lodInstanceOffsets, lodInstanceOffsets + numLods + 1, 0);
+  for (auto z = 0; z < _chunksZ; ++z) {
+    for (auto x = 0; x < _chunksX; ++x) {
+      auto minX = originX + x * chunkWidth;
+      auto minZ = originZ + z * chunkLength;
+      auto closest = glm::vec3(
+          max(minX, min(minX + chunkWidth, cameraPosition.x)),
+          0.0f,
+          max(minZ, min(minZ + chunkLength, cameraPosition.z))
+      );
+      auto distance = glm::length(cameraPosition - closest);
+      auto lod = (int)floorf(log2f(max(1.0f, distance / lodDistance)));
+      lod = min(lod, (int)numLods - 1);
+      chunkLods[z * _chunksX + x] = lod;
+      lodInstanceOffsets[lod + 1]++;
+    }
+  }
+
+  for (auto lod = 0; lod < numLods; ++lod) {
+    lodInstanceOffsets[lod + 1] += lodInstanceOffsets[lod];
+  }
+
+  for (auto z = 0; z < _chunksZ; ++z) {
+    for (auto x = 0; x < _chunksX; ++x) {
+      auto lod = chunkLods[z * _chunksX + x];
+      chunkInstances[lodInstanceOffsets[lod]++] = glm::vec4(
+          originX + x * chunkWidth, originZ + z * chunkLength,
+          chunkWidth, chunkLength);
+    }
+  }
+
+  // Filling advanced every offset to the start of the following level.
+  for (auto lod = numLods; lod > 0; --lod) {
+    lodInstanceOffsets[lod] = lodInstanceOffsets[lod - 1];
+  }
+  lodInstanceOffsets[0] = 0;
+
+  glBindVertexArray(_vao.get());
+  glBindBuffer(GL_ARRAY_BUFFER, _chunkInstanceVbo.get());
+  glBufferSubData(GL_ARRAY_BUFFER, 0,
+      numChunks * sizeof(glm::vec4), chunkInstances);
+  _uploadedBytes += numChunks * sizeof(glm::vec4);
+
+  for (auto lod = 0; lod < numLods; ++lod) {
+    auto first = lodInstanceOffsets[lod];
+    auto count = lodInstanceOffsets[lod + 1] - first;
+    if (count == 0) {
+      continue;
+    }
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4),
+        (GLvoid*)(first * sizeof(glm::vec4)));
+    glDrawElementsInstanced(GL_TRIANGLES, _gridLods[lod].numIndices,
+        GL_UNSIGNED_INT,
+        (GLvoid*)(_gridLods[lod].firstIndex * sizeof(GLuint)), count);
+    ++_numDrawCalls;
+  }
+
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindVertexArray(0);
 }
 
 void WaterSurface::clearSamples() {
   auto totalSamples = _samplesTextureWidth * _samplesTextureHeight;
-  _samples.resize(totalSamples);
-  _samples2.resize(totalSamples);
-  _normals.resize(totalSamples);
+  auto fixedPointRange = _simulationMode == WaterSimulationMode::Spectral
+    ? cSpectralFixedPointHeightRange : cFixedPointHeightRange;
+  _samples.create(_samplesTextureWidth, _samplesTextureHeight,
+      _heightPrecision, fixedPointRange);
+  _samples2.create(_samplesTextureWidth, _samplesTextureHeight,
+      _heightPrecision, fixedPointRange);
+  _normalMapData.resize(_normalMapTexelSize * totalSamples);
+
+  _tilesX = (_samplesTextureWidth + cTileSize - 1) / cTileSize;
+  _tilesY = (_samplesTextureHeight + cTileSize - 1) / cTileSize;
+  _tileActive.assign(_tilesX * _tilesY, 0);
+  _tileNextActive.assign(_tilesX * _tilesY, 0);
+  _tileDirty.assign(_tilesX * _tilesY, 0);
+  _tileCoarseCalm.assign(_tilesX * _tilesY, 1);
+
+  _coarseWidth = (_samplesTextureWidth + cCoarseFactor - 1) / cCoarseFactor;
+  _coarseHeight = (_samplesTextureHeight + cCoarseFactor - 1) / cCoarseFactor;
+  auto hierarchical = _simulationMode == WaterSimulationMode::Hierarchical;
+  _coarseSamples.create(hierarchical ? _coarseWidth : 0,
+      hierarchical ? _coarseHeight : 0, HeightFieldPrecision::Float32);
+  _coarseSamples2.create(hierarchical ? _coarseWidth : 0,
+      hierarchical ? _coarseHeight : 0, HeightFieldPrecision::Float32);
+  _currentCoarseSamples = &_coarseSamples;
+  _previousCoarseSamples = &_coarseSamples2;
+  _stepCounter = 0;
 
   _currentSamples = &_samples;
   _previousSamples = &_samples2;
 
   for (auto i = 0; i < totalSamples; ++i) {
-    _samples[i] = 0.0f;
-    _samples2[i] = 0.0f;
-    _normals[i] = glm::vec3(0.0f, 1.0f, 0.0f);
+    storeNormal(i, glm::vec3(0.0f, 1.0f, 0.0f));
   }
 }
 
-void WaterSurface::calculateNormalMap() {
-  for (auto y = 0; y < _samplesTextureHeight; ++y) {
-    for (auto x = 0; x < _samplesTextureWidth; ++x) {
-      auto baseIndex = y * _samplesTextureWidth + x;
-      _normals[baseIndex] = glm::vec3(0.0f, 0.0f, 0.0f);
-    }
-  }
-   
-  for (auto y = 0; y < _samplesTextureHeight; ++y) {
-    for (auto x = 0; x < _samplesTextureWidth; ++x) {
-      auto baseIndex = y * _samplesTextureWidth + x;
-
-      int dispX[] = { -1, 1 };
-      int dispY[] = { -1, 1 };
-      for (auto i = 0; i < 2; ++i) {
-        auto fx = x + dispX[i];
-        auto fy = y + dispY[i];
-        if (fx < 0 || fx >= _samplesTextureHeight ||
-            fy < 0 || fy >= _samplesTextureWidth) {
+void WaterSurface::calculateNormalMap(int x0, int y0, int x1, int y1) {
+  auto n = x1 - x0 + 2;
+  _rowScratch.resize(3 * n);
+  float *above = &_rowScratch[0], *center = above + n, *below = center + n;
+
+  // Row buffers start one sample left of x0, so sample x sits at x - x0 + 1.
+  loadPaddedRow(*_currentSamples, y0 - 1, x0, x1, above);
+  loadPaddedRow(*_currentSamples, y0, x0, x1, center);
+  for (auto y = y0; y < y1; ++y) {
+    loadPaddedRow(*_currentSamples, y + 1, x0, x1, below);
+    const float *neighborRows[] = { above, below };
+
+    for (auto x = x0; x < x1; ++x) {
+      auto i = x - x0 + 1;
+      glm::vec3 normal(0.0f, 0.0f, 0.0f);
+
+      int disp[] = { -1, 1 };
+      for (auto k = 0; k < 2; ++k) {
+        auto fx = x + disp[k];
+        auto fy = y + disp[k];
+        if (fx < 0 || fx >= _samplesTextureWidth ||
+            fy < 0 || fy >= _samplesTextureHeight) {
           continue;
         }
 
-        auto dxShiftIndex = y * _samplesTextureWidth + fx;
-        auto dyShiftIndex = fy * _samplesTextureWidth + x;
-
-        glm::vec3 originPosition(x, (*_currentSamples)[baseIndex], y);
-        glm::vec3 dxPosition(fx, (*_currentSamples)[dxShiftIndex], y);
-        glm::vec3 dyPosition(x, (*_currentSamples)[dyShiftIndex], fy);
+        glm::vec3 originPosition(x, center[i], y);
+        glm::vec3 dxPosition(fx, center[i + disp[k]], y);
+        glm::vec3 dyPosition(x, neighborRows[k][i], fy);
 
         auto dx = dxPosition - originPosition;
         auto dy = dyPosition - originPosition;
-        _normals[baseIndex] += glm::cross(dy, dx);
+        normal += glm::cross(dy, dx);
       }
 
-      _normals[baseIndex] = glm::normalize(_normals[baseIndex]);
+      // Two corners have neither neighbour pair and stay pointing up.
+      storeNormal(y * _samplesTextureWidth + x, normal.y > 0.0f
+          ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f));
     }
+
+    auto rolled = above;
+    above = center;
+    center = below;
+    below = rolled;
   }
 }
 
-vector<GLubyte> WaterSurface::buildNormalMap() {
-  // todo: Read about move constructor.
-  auto totalSamples = _samplesTextureWidth * _samplesTextureHeight;
-  vector<unsigned char> normalMapData(3*totalSamples);
+void WaterSurface::storeNormal(int index, glm::vec3 normal) {
+  float x = 0.5f * max(-1.0f, min(1.0f, normal.x)) + 0.5f;
+  float z = 0.5f * max(-1.0f, min(1.0f, normal.z)) + 0.5f;
+  if (_normalMapFormat == NormalMapFormat::RG16) {
+    auto texel = (GLushort*)&_normalMapData[4 * index];
+    texel[0] = (GLushort)(65535.0f * x + 0.5f);
+    texel[1] = (GLushort)(65535.0f * z + 0.5f);
+  } else {
+    _normalMapData[2 * index] = (GLubyte)(255.0f * x + 0.5f);
+    _normalMapData[2 * index + 1] = (GLubyte)(255.0f * z + 0.5f);
+  }
+}
 
-  for (auto y = 0; y < _samplesTextureHeight; ++y) {
-    for (auto x = 0; x < _samplesTextureWidth; ++x) {
-      auto baseIndex = y * _samplesTextureWidth + x;
-      auto normal = _normals[baseIndex];
-      for (auto i = 0; i < 3; ++i) {
-        normalMapData[3*baseIndex+i] = convertNormalCoordToColor(normal[i]);
+// Snapshots are taken on the renderer's thread whether the surface is
+// drawn or not, so the simulation thread never waits for a draw. Tiles
+// they changed stay dirty until the next draw uploads them.
+void WaterSurface::collectSnapshots() {
+  int slot;
+  while (_publishedSnapshots.pop(slot)) {
+    auto &snapshot = _snapshots[slot];
+    copyShownTiles(snapshot.tileDirty, &snapshot.heights[0],
+        &snapshot.normals[0]);
+    _freeSnapshots.push(slot);
+  }
+}
+
+void WaterSurface::copyShownTiles(const vector<unsigned char> &tileDirty,
+    const unsigned char *heights, const GLubyte *normals) {
+  auto bytesPerSample = _samples.getBytesPerSample();
+  auto shown = (unsigned char*)_shownSamples.getData(0, 0);
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX; ++tileX) {
+      auto tile = tileY * _tilesX + tileX;
+      if (!tileDirty[tile]) {
+        continue;
+      }
+      _shownTileDirty[tile] = 1;
+
+      int x0, y0, x1, y1;
+      getTileRect(tileX, tileY, 1, x0, y0, x1, y1);
+      for (auto y = y0; y < y1; ++y) {
+        auto first = y * _samplesTextureWidth + x0;
+        memcpy(shown + first * bytesPerSample,
+            heights + first * bytesPerSample, (x1 - x0) * bytesPerSample);
+        memcpy(&_shownNormals[first * _normalMapTexelSize],
+            normals + first * _normalMapTexelSize,
+            (x1 - x0) * _normalMapTexelSize);
+      }
+    }
+  }
+}
+
+void WaterSurface::uploadDirtyTiles(vector<unsigned char> &tileDirty,
+    const unsigned char *heights, const GLubyte *normals) {
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, _samplesTextureWidth);
+
+  // Runs of dirty tiles within a tile row are sent as one rectangle.
+  for (auto tileY = 0; tileY < _tilesY; ++tileY) {
+    for (auto tileX = 0; tileX < _tilesX;) {
+      if (!tileDirty[tileY * _tilesX + tileX]) {
+        ++tileX;
+        continue;
+      }
+      auto firstTileX = tileX;
+      while (tileX < _tilesX && tileDirty[tileY * _tilesX + tileX]) {
+        tileDirty[tileY * _tilesX + tileX] = 0;
+        ++tileX;
       }
+
+      int x0, y0, x1, y1;
+      getTileRect(firstTileX, tileY, 1, x0, y0, x1, y1);
+      x1 = min(_samplesTextureWidth, tileX * cTileSize + 1);
+      copyNormalsToTexture(x0, y0, x1, y1, normals);
+      copyHeightsToTexture(x0, y0, x1, y1, heights);
     }
   }
 
-  return normalMapData;
+  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 }
 
-void WaterSurface::copyNormalsToTexture(vector<unsigned char> &normals) {
-  glBindTexture(GL_TEXTURE_2D, _normalMapTexture);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _samplesTextureWidth,
-      _samplesTextureHeight, GL_RGB, GL_UNSIGNED_BYTE, &normals[0]);
+void WaterSurface::copyNormalsToTexture(int x0, int y0, int x1, int y1,
+    const GLubyte *normals) {
+  glBindTexture(GL_TEXTURE_2D, _normalMapTexture.get());
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, GL_RG,
+      _normalMapFormat == NormalMapFormat::RG16
+        ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE,
+      normals + _normalMapTexelSize * (y0 * _samplesTextureWidth + x0));
   glBindTexture(GL_TEXTURE_2D, 0);
+  _uploadedBytes += (uint64_t)_normalMapTexelSize * (x1 - x0) * (y1 - y0);
 }
 
-unsigned char WaterSurface::convertNormalCoordToColor(float coord) {
-  coord = max(-1.0f, min(1.0f, coord));
-  return (unsigned char)(255.0f * (coord + 1.0f) / 2.0f);
+void WaterSurface::copyHeightsToTexture(int x0, int y0, int x1, int y1,
+    const unsigned char *heights) {
+  glBindTexture(GL_TEXTURE_2D, _heightMapTexture.get());
+  GLenum internalFormat, type;
+  getHeightTextureFormat(_heightPrecision, internalFormat, type);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, GL_RED,
+      type, heights
+        + _samples.getBytesPerSample() * (y0 * _samplesTextureWidth + x0));
+  glBindTexture(GL_TEXTURE_2D, 0);
+  _uploadedBytes += (uint64_t)_samples.getBytesPerSample()
+    * (x1 - x0) * (y1 - y0);
 }
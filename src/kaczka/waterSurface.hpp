@@ -1,27 +1,197 @@
 #ifndef __WATER_SURFACE_HPP__
 #define __WATER_SURFACE_HPP__
 
+#include "allocators.hpp"
+#include "checkpoint.hpp"
+#include "duckBatch.hpp"
+#include "glHandles.hpp"
+#include "gpuWaterSolver.hpp"
+#include "heightCapture.hpp"
+#include "heightField.hpp"
+#include "helpers.hpp"
+#include "oceanSpectrum.hpp"
 #include "shaders.hpp"
+#include "spscQueue.hpp"
 
 #include <gl/glew.h>
 #include <glm/glm.hpp>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
 #include <vector>
 
+enum class WaterSimulationMode {
+  FiniteDifference,
+  Hierarchical,
+  Spectral,
+  // Finite differences in compute shaders, see GpuWaterSolver. Steps on
+  // the thread that owns the GL context, without the simulation thread.
+  Gpu
+};
+
+// Normal map texels keep the x and z components only; y is the up axis,
+// never negative for a height field, and is rebuilt in the shader.
+enum class NormalMapFormat {
+  RG8,
+  RG16
+};
+
+// Samples and normals handed from the simulation thread to the renderer.
+// Both slots hold full images; only tiles changed since a slot was last
+// written are copied into it.
+struct WaterSnapshot {
+  std::vector<unsigned char> heights;
+  std::vector<GLubyte> normals;
+  std::vector<unsigned char> tileDirty;
+  std::vector<unsigned char> tileStale;
+};
+
+enum class WaterCommandType {
+  Disturbance,
+  RefinementFocus,
+  Substeps,
+  Update
+};
+
+// Updates also name the buffer of duck footprints to add before the step.
+struct WaterCommand {
+  WaterCommandType type;
+  glm::vec3 position;
+  float value;
+  int footprints;
+};
+
 class WaterSurface {
 public:
   WaterSurface();
   virtual ~WaterSurface();
 
+  // Creating again frees what the surface held first.
   void create(float planeWidth, float planeHeight, 
       int samplesTextureWidth, int samplesTextureHeight);
+  // Changes the size in place: the GL objects and the program are kept,
+  // texture storage is specified again and CPU buffers keep their memory
+  // when shrinking. The water is resampled bilinearly onto the new grid,
+  // a running simulation thread is restarted and a capture is stopped.
+  void resize(float planeWidth, float planeHeight,
+      int samplesTextureWidth, int samplesTextureHeight);
+  // Releases every GL object but the program, which goes with the surface.
   void free();
 
+  // Storage formats are picked up by the next create().
+  void setStorageFormat(HeightFieldPrecision heightPrecision,
+      NormalMapFormat normalMapFormat);
+
+  // While the simulation thread runs, update and disturbances are queued
+  // for it and draw shows the latest finished step. The thread does not
+  // wait for draws, a culled surface keeps stepping. Modes and storage
+  // formats can only change while it is stopped.
+  void startSimulationThread();
+  void stopSimulationThread();
+  inline bool isSimulationThreadRunning() {
+    return _simulationThread.joinable();
+  }
+
+  // Gpu mode falls back to finite differences without GL 4.3.
+  void setSimulationMode(WaterSimulationMode mode);
+  inline WaterSimulationMode getSimulationMode() { return _simulationMode; }
+  void setRefinementFocus(glm::vec3 position, float radius);
+
+  // Solver steps taken per update. Finite difference mode advances them
+  // together, tile by tile, while the tile stays in cache. While the
+  // simulation thread runs the change is queued for it.
+  void setSubsteps(int substeps);
+  inline int getSubsteps() { return _substeps; }
+  // Without blocking every substep sweeps the whole pool, for comparing
+  // the two. Changed while the simulation thread is stopped.
+  inline void setTemporalBlocking(bool blocking) {
+    _temporalBlocking = blocking;
+  }
+
   void applyDisturbaceInWorldSpace(glm::vec3 position, float strength);
   void update(float deltaTime);
-  void draw(const glm::mat4 &viewProj, const glm::vec3 &cameraPosition);
 
-  inline void setCubemap(GLuint cubemap) { _cubemap = cubemap; }
+  // Two-way coupling with a batch of ducks. Both passes visit the ducks
+  // sorted by tile. Queries read the samples being shown, so ducks ride
+  // the drawn surface, in Gpu mode as it was a frame or two before;
+  // footprints push the water down by strength at the hull center, fading
+  // out at its radius, and are added before the next step.
+  void sampleDucks(DuckBatch &ducks, LinearArena &frameArena);
+  void splatDucks(const DuckBatch &ducks, float strength);
+
+  // A single step can be shared between threads: beginStep, stepTileRows
+  // over disjoint ranges of tile rows, then endStep. Spectral mode,
+  // temporally blocked steps and the simulation thread only step whole.
+  bool canSplitStep();
+  // Updates that must not run as jobs on other threads: they only queue
+  // work for the simulation thread or the GPU.
+  bool mustStepOnCallingThread();
+  void beginStep();
+  void stepTileRows(int firstTileRow, int lastTileRow);
+  void endStep();
+  inline int getNumTileRows() { return _tilesY; }
+  int getNumActiveTiles();
+
+  // Streams the heights of every interval-th step to a capture file, see
+  // HeightCaptureWriter. Capture starts and stops only while the
+  // simulation thread is stopped, and stops when the mode changes.
+  bool startCapture(const std::string &path, int interval);
+  void stopCapture();
+  inline bool isCapturing() { return _capture.isOpen(); }
+
+  // Complete solver state: both sample buffers and which one is current,
+  // the coarse level, tile activity, step counts and the refinement focus,
+  // as sections of the given index. A running simulation thread is
+  // restarted around both, dropping the updates it had queued. Restoring
+  // needs a surface created with the same height precision, resizes it to
+  // the saved samples and switches to the saved mode. A checkpoint that
+  // fails checkCheckpoint leaves the surface as it was.
+  void saveCheckpoint(CheckpointWriter &writer, int index);
+  bool checkCheckpoint(const Checkpoint &checkpoint, int index);
+  bool restoreCheckpoint(const Checkpoint &checkpoint, int index);
+
+  // Heights of the latest step in sample spacings, row by row. In Gpu
+  // mode this waits for the GPU to finish.
+  void readHeights(std::vector<float> &heights);
+  // Normals of the latest step as the renderer decodes them from the
+  // normal map, row by row. Read with the simulation thread stopped; in
+  // Gpu mode this waits for the GPU.
+  void readNormals(std::vector<glm::vec3> &normals);
+
+  // Box around the drawn surface, for culling.
+  void getBounds(glm::vec3 &minimum, glm::vec3 &maximum);
+
+  inline int getSamplesTextureWidth() { return _samplesTextureWidth; }
+  inline int getSamplesTextureHeight() { return _samplesTextureHeight; }
+  // Scratch arrays of the frame come from the arena.
+  void draw(const glm::mat4 &viewProj, const glm::vec3 &cameraPosition,
+      LinearArena &frameArena);
+  // GL draw calls of the latest draw, and bytes of heights, normals and
+  // chunk instances sent to GL by every draw so far.
+  inline int getNumDrawCalls() { return _numDrawCalls; }
+  inline std::uint64_t getUploadedBytes() { return _uploadedBytes; }
+  // Solver steps taken so far, every substep counted, on whichever thread
+  // took them.
+  inline std::uint64_t getSolverSteps() {
+    return _solverSteps.load(std::memory_order_relaxed);
+  }
+  // Milliseconds the simulation thread spent on each update, oldest
+  // first. Only the last few are kept until they are popped.
+  inline bool popUpdateTime(float &milliseconds) {
+    return _advanceTimes.pop(milliseconds);
+  }
+
+  // A cubemap with levels is taken as prefiltered by roughness, see
+  // createPrefilteredCubemap, and is read with a lobe that widens with the
+  // roughness and with the spread of the reflections within a pixel.
+  inline void setCubemap(GLuint cubemap, int numLevels = 0) {
+    _cubemap = cubemap;
+    _cubemapLevels = numLevels;
+  }
   inline GLuint getCubemap() { return _cubemap; }
+  inline void setRoughness(float roughness) { _roughness = roughness; }
 
   inline glm::mat4 getModelMatrix() { return _modelMatrix; }
   inline void setModelMatrix(glm::mat4 modelMatrix) { 
@@ -30,24 +200,134 @@ public:
   }
 
 protected:
+  void simulationLoop();
+  void pushCommand(const WaterCommand &command);
+  void applyDisturbance(glm::vec3 position, float strength);
+  void sampleDucksOnGpu(DuckBatch &ducks, LinearArena &frameArena);
+  void applyFootprints(const std::vector<glm::vec4> &footprints);
+  void getFootprintRect(const glm::vec4 &footprint,
+      int &x0, int &y0, int &x1, int &y1);
+  void splatFootprints(const std::vector<glm::vec4> &footprints,
+      int first, int last, int x0, int y0, int x1, int y1);
+  glm::vec2 getSamplePosition(float x, float z);
+  void allocate(float planeWidth, float planeHeight,
+      int samplesTextureWidth, int samplesTextureHeight);
+  static void resampleHeights(const std::vector<float> &source,
+      int sourceWidth, int sourceHeight, std::vector<float> &destination,
+      int width, int height);
+  void writeSamples(const std::vector<float> &current,
+      const std::vector<float> &previous);
+  void advance(float deltaTime);
+  void countSteps(int steps);
+  bool restoreSamples(const Checkpoint &checkpoint, int index);
+  void publishSnapshot();
   void clearSamples();
-  void calculateNormalMap();
-  std::vector<GLubyte> buildNormalMap();
-  void copyNormalsToTexture(std::vector<unsigned char> &normals);
-
-  unsigned char convertNormalCoordToColor(float coord);
+  void stepBlocked();
+  void stepTileBlocked(int tileX, int tileY, float A,
+      const std::vector<float> &savedRows, std::vector<float> &nextRows);
+  void updateTileActivity(int edgeBand);
+  void markFocusTiles();
+  void updateSpectral(float deltaTime);
+  void updateCoarseLevel();
+  void restrictTile(int tileX, int tileY);
+  void prolongateInactiveTiles();
+  void prolongateTile(int tileX, int tileY, int phase);
+  float sampleCoarseAt(int x, int y, float time);
+  float sampleCoarse(const HeightField &coarse, int x, int y);
+  void getTileRect(int tileX, int tileY, int border,
+      int &x0, int &y0, int &x1, int &y1);
+  void calculateNormalMap(int x0, int y0, int x1, int y1);
+  void storeNormal(int index, glm::vec3 normal);
+  void collectSnapshots();
+  void copyShownTiles(const std::vector<unsigned char> &tileDirty,
+      const unsigned char *heights, const GLubyte *normals);
+  void uploadDirtyTiles(std::vector<unsigned char> &tileDirty,
+      const unsigned char *heights, const GLubyte *normals);
+  void copyNormalsToTexture(int x0, int y0, int x1, int y1,
+      const GLubyte *normals);
+  void copyHeightsToTexture(int x0, int y0, int x1, int y1,
+      const unsigned char *heights);
+  void drawChunks(const glm::vec3 &cameraPosition, LinearArena &frameArena);
 
 private:
-  GLuint _vbo, _vao, _ebo;
+  GLVertexArray _vao;
+  GLBuffer _vbo, _ebo;
+  GLBuffer _chunkInstanceVbo;
+  int _chunkInstanceCapacity;
   GLuint _cubemap;
+  int _cubemapLevels;
+  float _roughness;
+
+  std::vector<GridLod> _gridLods;
+  int _chunksX, _chunksZ;
+  int _numDrawCalls;
+  std::uint64_t _uploadedBytes;
 
   float _planeWidth, _planeHeight;
   int _samplesTextureWidth, _samplesTextureHeight;
-  std::vector<float> _samples, _samples2;
-  std::vector<glm::vec3> _normals;
-  GLuint _normalMapTexture;
+  HeightFieldPrecision _heightPrecision;
+  NormalMapFormat _normalMapFormat;
+  HeightField _samples, _samples2;
+  std::vector<GLubyte> _normalMapData;
+  int _normalMapTexelSize;
+  GLTexture _normalMapTexture;
+  GLTexture _heightMapTexture;
+  std::vector<float> _rowScratch;
+
+  HeightField *_currentSamples, *_previousSamples;
+
+  int _tilesX, _tilesY;
+  std::vector<unsigned char> _tileActive, _tileNextActive;
+  std::vector<unsigned char> _tileDirty;
+
+  // Temporal blocking overwrites tiles in raster order. Their initial
+  // bottom rows and right columns are kept for the windows of the tiles
+  // below and to the right.
+  int _substeps;
+  bool _temporalBlocking;
+  std::vector<float> _blockScratch;
+  std::vector<float> _savedRows[2];
+  std::vector<float> _savedColumns;
+
+  WaterSimulationMode _simulationMode;
+  int _coarseWidth, _coarseHeight;
+  HeightField _coarseSamples, _coarseSamples2;
+  HeightField *_currentCoarseSamples, *_previousCoarseSamples;
+  std::vector<unsigned char> _tileCoarseCalm;
+  int _stepCounter;
+  glm::vec3 _refinementFocus;
+  float _refinementRadius;
+
+  OceanSpectrum _oceanSpectrum;
+  float _spectralTime;
+
+  std::unique_ptr<GpuWaterSolver> _gpuSolver;
+
+  HeightCaptureWriter _capture;
+  int _captureInterval, _captureCountdown, _capturedSteps;
+  std::vector<float> _captureScratch;
+
+  std::thread _simulationThread;
+  std::atomic<bool> _simulationRunning;
+  std::atomic<int> _pendingUpdates;
+  std::atomic<std::uint64_t> _solverSteps;
+  SpscQueue<float, 16> _advanceTimes;
+  SpscQueue<WaterCommand, 256> _commands;
+  WaterSnapshot _snapshots[2];
+  SpscQueue<int, 2> _freeSnapshots, _publishedSnapshots;
+  // What the renderer has taken from the snapshots, with the tiles it has
+  // not uploaded yet.
+  HeightField _shownSamples;
+  std::vector<GLubyte> _shownNormals;
+  std::vector<unsigned char> _shownTileDirty;
 
-  std::vector<float> *_currentSamples, *_previousSamples;
+  // Footprints are (sample x, sample y, radius, strength). The renderer
+  // fills one buffer while the simulation thread may still read the two
+  // handed over before it.
+  std::vector<glm::vec4> _footprints[3];
+  int _footprintWrite;
+  std::vector<int> _splatOrder, _splatTileStarts;
+  std::vector<float> _splatScratch;
 
   glm::mat4 _modelMatrix;
   glm::mat4 _invModelMatrix;
@@ -0,0 +1,153 @@
+#include "waterWorld.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace std;
+
+// Fewer tile rows than this per job do not pay for scheduling them.
+static const int cMinTileRowsPerJob = 2;
+
+// Weight of the newest step time in the running average.
+static const float cStepTimeSmoothing = 0.05f;
+
+WaterWorld::WaterWorld(JobScheduler &scheduler) :
+  _scheduler(scheduler), _deltaTime(0.0f) {
+}
+
+WaterWorld::~WaterWorld() {
+  for (auto task : _tasks) {
+    _taskPool.destroy(task);
+  }
+  for (auto surface : _surfaces) {
+    _surfacePool.destroy(surface);
+  }
+}
+
+WaterSurface &WaterWorld::addSurface() {
+  auto surface = _surfacePool.create();
+  auto task = _taskPool.create();
+  task->world = this;
+  task->surface = surface;
+  task->stats = WaterSurfaceStats();
+
+  _surfaces.push_back(surface);
+  _tasks.push_back(task);
+  _order.push_back((int)_order.size());
+  return *surface;
+}
+
+void WaterWorld::update(float deltaTime) {
+  _deltaTime = deltaTime;
+
+  // Largest pools are queued first, so they are the first to be stolen
+  // and the small ones fill in the gaps at the end.
+  sort(_order.begin(), _order.end(), [this](int a, int b) {
+    return _surfaces[a]->getSamplesTextureWidth()
+        * _surfaces[a]->getSamplesTextureHeight()
+      > _surfaces[b]->getSamplesTextureWidth()
+        * _surfaces[b]->getSamplesTextureHeight();
+  });
+
+  // Surfaces with a thread of their own only queue the update here. It may
+  // wait for that thread, so it must not run as a job: the thread helps
+  // with queued jobs while it waits for its own and could pick it up.
+  // Gpu surfaces issue GL calls, which only the context's thread may.
+  JobCounter counter;
+  for (auto index : _order) {
+    if (_surfaces[index]->mustStepOnCallingThread()) {
+      stepSurface(*_tasks[index]);
+    } else {
+      _scheduler.submit(stepSurfaceJob, _tasks[index], 0, 0, counter);
+    }
+  }
+  _scheduler.wait(counter);
+}
+
+void WaterWorld::draw(const glm::mat4 &viewProj,
+    const glm::vec3 &cameraPosition, LinearArena &frameArena) {
+  for (auto surface : _surfaces) {
+    surface->draw(viewProj, cameraPosition, frameArena);
+  }
+}
+
+void WaterWorld::saveCheckpoint(CheckpointWriter &writer) {
+  for (auto i = 0; i < (int)_surfaces.size(); ++i) {
+    _surfaces[i]->saveCheckpoint(writer, i);
+  }
+}
+
+// Every surface is checked first, so a checkpoint refused for one of
+// them changes none.
+bool WaterWorld::restoreCheckpoint(const Checkpoint &checkpoint) {
+  for (auto i = 0; i < (int)_surfaces.size(); ++i) {
+    if (!_surfaces[i]->checkCheckpoint(checkpoint, i)) {
+      return false;
+    }
+  }
+  auto restored = true;
+  for (auto i = 0; i < (int)_surfaces.size(); ++i) {
+    restored = _surfaces[i]->restoreCheckpoint(checkpoint, i) && restored;
+  }
+  return restored;
+}
+
+void WaterWorld::stepSurfaceJob(void *context, int begin, int end) {
+  auto task = (SurfaceTask*)context;
+  task->world->stepSurface(*task);
+}
+
+void WaterWorld::stepTileRowsJob(void *context, int begin, int end) {
+  auto task = (SurfaceTask*)context;
+  task->surface->stepTileRows(begin, end);
+}
+
+void WaterWorld::stepSurface(SurfaceTask &task) {
+  auto start = chrono::steady_clock::now();
+  auto &surface = *task.surface;
+  auto numJobs = 1;
+
+  if (!surface.canSplitStep()) {
+    surface.update(_deltaTime);
+  } else {
+    surface.beginStep();
+
+    auto numRows = surface.getNumTileRows();
+    numJobs = max(1, min(_scheduler.getNumThreads(),
+          numRows / cMinTileRowsPerJob));
+    for (auto i = 1; i < numJobs; ++i) {
+      _scheduler.submit(stepTileRowsJob, &task, numRows * i / numJobs,
+          numRows * (i + 1) / numJobs, task.rows);
+    }
+    surface.stepTileRows(0, numRows / numJobs);
+    _scheduler.wait(task.rows);
+
+    surface.endStep();
+  }
+
+  auto elapsed = chrono::duration<float, milli>(
+      chrono::steady_clock::now() - start).count();
+  auto &stats = task.stats;
+  stats.jobs = numJobs;
+  stats.activeTiles = surface.getNumActiveTiles();
+
+  // Surfaces with a thread of their own were only handed the update, the
+  // thread reports how long the updates it finished took.
+  if (surface.isSimulationThreadRunning()) {
+    float milliseconds;
+    while (surface.popUpdateTime(milliseconds)) {
+      addStepTime(stats, milliseconds);
+    }
+  } else {
+    addStepTime(stats, elapsed);
+  }
+}
+
+void WaterWorld::addStepTime(WaterSurfaceStats &stats, float milliseconds) {
+  stats.averageStepTime = stats.steps == 0 ? milliseconds
+    : (1.0f - cStepTimeSmoothing) * stats.averageStepTime
+      + cStepTimeSmoothing * milliseconds;
+  stats.lastStepTime = milliseconds;
+  addMetricsSample(stats.stepTime, milliseconds / 1000.0);
+  ++stats.steps;
+}
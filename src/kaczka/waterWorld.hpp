@@ -0,0 +1,76 @@
+#ifndef __WATER_WORLD_HPP__
+#define __WATER_WORLD_HPP__
+
+#include "allocators.hpp"
+#include "jobScheduler.hpp"
+#include "metrics.hpp"
+#include "waterSurface.hpp"
+
+#include <glm/glm.hpp>
+#include <vector>
+
+// Step times, in milliseconds, are of whole updates with all their
+// substeps, timed on the thread that stepped the surface. Steps counts the
+// timed updates.
+struct WaterSurfaceStats {
+  int steps;
+  int jobs;
+  int activeTiles;
+  float lastStepTime;
+  float averageStepTime;
+  MetricsHistogram stepTime;
+};
+
+// Owns the pools of a scene and steps all of them on a job scheduler.
+// Every surface is one job; surfaces with enough tile rows also split
+// their step into jobs over ranges of rows.
+class WaterWorld {
+public:
+  explicit WaterWorld(JobScheduler &scheduler);
+  virtual ~WaterWorld();
+
+  // The surface still has to be created by the caller.
+  WaterSurface &addSurface();
+
+  void update(float deltaTime);
+  void draw(const glm::mat4 &viewProj, const glm::vec3 &cameraPosition,
+      LinearArena &frameArena);
+
+  // Surfaces are saved and restored in the order they were added, see
+  // WaterSurface::saveCheckpoint.
+  void saveCheckpoint(CheckpointWriter &writer);
+  bool restoreCheckpoint(const Checkpoint &checkpoint);
+
+  inline int getNumSurfaces() { return (int)_surfaces.size(); }
+  inline WaterSurface &getSurface(int index) { return *_surfaces[index]; }
+  inline const WaterSurfaceStats &getStats(int index) {
+    return _tasks[index]->stats;
+  }
+
+protected:
+  struct SurfaceTask {
+    WaterWorld *world;
+    WaterSurface *surface;
+    JobCounter rows;
+    WaterSurfaceStats stats;
+  };
+
+  static void stepSurfaceJob(void *context, int begin, int end);
+  static void stepTileRowsJob(void *context, int begin, int end);
+  void stepSurface(SurfaceTask &task);
+  static void addStepTime(WaterSurfaceStats &stats, float milliseconds);
+
+private:
+  JobScheduler &_scheduler;
+
+  // Jobs keep pointers to surfaces and tasks, so they live in pools with
+  // stable addresses.
+  PoolAllocator<WaterSurface> _surfacePool;
+  PoolAllocator<SurfaceTask> _taskPool;
+  std::vector<WaterSurface*> _surfaces;
+  std::vector<SurfaceTask*> _tasks;
+  std::vector<int> _order;
+  float _deltaTime;
+};
+
+#endif
@@ -9,6 +9,7 @@ uniform mat4 modelMatrix;
 
 void main()
 {
-  gl_Position = viewProj * modelMatrix * vec4(position, 1.0f);
+  // On the far plane, drawn last only where nothing else is.
+  gl_Position = (viewProj * modelMatrix * vec4(position, 1.0f)).xyww;
   outPosition = position;
 }
@@ -14,17 +14,17 @@ out VS_OUT {
 } vsOut;
 
 uniform mat4 viewProj;
-uniform mat4 modelMatrix;
+uniform mat4x3 modelMatrix;
 uniform vec3 cameraPosition;
 uniform vec3 lightPosition;
 
 void main()
 {
-  vec4 worldPosition = modelMatrix * vec4(position, 1.0f);
-  gl_Position = viewProj * worldPosition; 
+  vec3 worldPosition = modelMatrix * vec4(position, 1.0f);
+  gl_Position = viewProj * vec4(worldPosition, 1.0f);
 
-  vsOut.cameraDirection = cameraPosition - worldPosition.xyz;
-  vsOut.lightDirection = lightPosition - worldPosition.xyz;
+  vsOut.cameraDirection = cameraPosition - worldPosition;
+  vsOut.lightDirection = lightPosition - worldPosition;
 
   mat3 normalModelMatrix = mat3(modelMatrix);
   vsOut.normal = normalModelMatrix * normal;
@@ -0,0 +1,55 @@
+#version 330 core
+
+layout (location = 0) in vec3 position;
+layout (location = 1) in uint tangentFrame;
+layout (location = 3) in vec2 texCoord;
+
+out VS_OUT {
+  vec3 normal;
+  vec3 tangent;
+  vec2 texCoord;
+  vec3 cameraDirection;
+  vec3 lightDirection;
+} vsOut;
+
+uniform mat4 viewProj;
+uniform mat4x3 modelMatrix;
+uniform vec3 cameraPosition;
+uniform vec3 lightPosition;
+
+// Three 9 bit components and the index of the largest, which is rebuilt.
+vec4 unpackQuaternion(uint frame) {
+  uvec3 bits = uvec3(frame, frame >> 9u, frame >> 18u) & 511u;
+  vec3 small = (vec3(bits) / 511.0 * 2.0 - 1.0) * 0.70710678;
+  float largest = sqrt(max(0.0, 1.0 - dot(small, small)));
+  uint index = (frame >> 27u) & 3u;
+  if (index == 0u) {
+    return vec4(largest, small);
+  } else if (index == 1u) {
+    return vec4(small.x, largest, small.yz);
+  } else if (index == 2u) {
+    return vec4(small.xy, largest, small.z);
+  }
+  return vec4(small, largest);
+}
+
+void main()
+{
+  vec3 worldPosition = modelMatrix * vec4(position, 1.0f);
+  gl_Position = viewProj * vec4(worldPosition, 1.0f);
+
+  vsOut.cameraDirection = cameraPosition - worldPosition;
+  vsOut.lightDirection = lightPosition - worldPosition;
+
+  // The frame rotates the x axis onto the tangent and z onto the normal.
+  vec4 q = unpackQuaternion(tangentFrame);
+  vec3 normal = vec3(2.0 * (q.x * q.z + q.w * q.y),
+      2.0 * (q.y * q.z - q.w * q.x), 1.0 - 2.0 * (q.x * q.x + q.y * q.y));
+  vec3 tangent = vec3(1.0 - 2.0 * (q.y * q.y + q.z * q.z),
+      2.0 * (q.x * q.y + q.w * q.z), 2.0 * (q.x * q.z - q.w * q.y));
+
+  mat3 normalModelMatrix = mat3(modelMatrix);
+  vsOut.normal = normalModelMatrix * normal;
+  vsOut.tangent = normalModelMatrix * tangent;
+  vsOut.texCoord = texCoord;
+}
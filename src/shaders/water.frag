@@ -7,6 +7,8 @@ out vec4 color;
 
 uniform sampler2D textureSampler;
 uniform samplerCube cubemapSampler;
+uniform float environmentLevels;
+uniform float roughness;
 
 vec3 cubemapCoordFromAnyPoint(vec3 origin, vec3 direction) {
   float t = min(max((1-origin.x)/direction.x, (-1-origin.x)/direction.x),
@@ -15,6 +17,21 @@ vec3 cubemapCoordFromAnyPoint(vec3 origin, vec3 direction) {
   return origin + t * direction;
 }
 
+// Level l of a prefiltered cubemap is blurred for roughness
+// l / (environmentLevels - 1). The lobe also widens with the spread of the
+// lookups within the pixel, so distant ripples average out instead of
+// shimmering. Without levels the cubemap is sampled as it is.
+vec3 sampleEnvironment(vec3 lookup) {
+  if (environmentLevels < 1.0) {
+    return texture(cubemapSampler, lookup).rgb;
+  }
+  vec3 direction = normalize(lookup);
+  float spread = length(fwidth(direction));
+  float lobe = max(roughness, sqrt(min(spread, 1.0)));
+  return textureLod(cubemapSampler, direction,
+      lobe * (environmentLevels - 1.0)).rgb;
+}
+
 const float rzero = pow((1.33 - 1.0)/(1.33 + 1.0), 2.0);
 float schlick(float cosfi) {
   return rzero + (1.0 - rzero)*pow(1.0 - cosfi, 5.0);
@@ -26,8 +43,10 @@ void main()
   vec3 lightVec = normalize(psLightVec);
   vec3 cameraVec = normalize(psCameraVec);
 
-  vec3 waterNormalTex = texture(textureSampler, psTexCoord).rgb;
-  vec3 waterNormal = normalize(2.0 * (waterNormalTex - vec3(0.5, 0.5, 0.5)));
+  vec2 waterNormalXZ = 2.0 * texture(textureSampler, psTexCoord).rg - 1.0;
+  vec3 waterNormal = normalize(vec3(waterNormalXZ.x,
+      sqrt(max(0.0, 1.0 - dot(waterNormalXZ, waterNormalXZ))),
+      waterNormalXZ.y));
 
   float diffuse = clamp(dot(waterNormal, lightVec), 0.0f, 1.0f);
   vec3 diffuseColor = diffuse * lightColor;
@@ -43,15 +62,13 @@ void main()
   vec3 waterReflectionVec = reflect(-cameraVec, waterNormal);
   vec3 fixedWaterReflectionVec = cubemapCoordFromAnyPoint(positionInCube,
       waterReflectionVec);
-  vec3 cubemapReflectionColor = texture(cubemapSampler,
-      fixedWaterReflectionVec).rgb;
+  vec3 cubemapReflectionColor = sampleEnvironment(fixedWaterReflectionVec);
 
   float refractionRatio = 1.0 / 1.33;
   vec3 waterRefractionVec = refract(-cameraVec, waterNormal, refractionRatio);
   vec3 fixedWaterRefractionVec = cubemapCoordFromAnyPoint(positionInCube,
       waterRefractionVec);
-  vec3 cubemapRefractionColor = texture(cubemapSampler, 
-      fixedWaterRefractionVec).rgb;
+  vec3 cubemapRefractionColor = sampleEnvironment(fixedWaterRefractionVec);
 
   float fresnelFactor = schlick(abs(cameraVec.y));
   vec3 reflRefrFactor = (1.0 - fresnelFactor) * cubemapRefractionColor +
@@ -1,6 +1,7 @@
 #version 330 core
 
-layout (location = 0) in vec3 position;
+layout (location = 0) in vec3 gridPosition;
+layout (location = 1) in vec4 chunkRect;
 
 out vec2 psTexCoord;
 out vec3 psLightVec;
@@ -9,11 +10,20 @@ out vec3 psCameraVec;
 uniform vec3 cameraPosition;
 uniform mat4 viewProj;
 uniform mat4 textureMatrix;
+uniform sampler2D heightSampler;
+uniform float heightScale;
+uniform float skirtDepth;
 
 void main()
 {
-  gl_Position = viewProj * vec4(position, 1.0f);
+  vec3 position = vec3(chunkRect.x + gridPosition.x * chunkRect.z, 0.0,
+      chunkRect.y + gridPosition.y * chunkRect.w);
   psTexCoord = (textureMatrix * vec4(position, 1.0f)).xz;
+
+  float height = textureLod(heightSampler, psTexCoord, 0.0).r;
+  position.y = heightScale * height - skirtDepth * gridPosition.z;
+
+  gl_Position = viewProj * vec4(position, 1.0f);
   psLightVec = vec3(0,5,0) - position;
   psCameraVec = cameraPosition - position;
 }
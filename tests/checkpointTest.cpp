@@ -0,0 +1,144 @@
+#include "checkpoint.hpp"
+#include "glTestContext.hpp"
+#include "waterSurface.hpp"
+
+#include <glm/glm.hpp>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// A stirred surface is saved, restored into a fresh one of another size
+// and both have to hold the same heights, then and after stepping on from
+// the same drops. Files cut short or with another magic are not opened.
+static const int cSize = 128;
+static const int cNumUpdates = 60;
+static const char *cPath = "checkpointTest.kcp";
+static const char *cDamagedPath = "checkpointTest-damaged.kcp";
+static const uint32_t cExtraTag = makeCheckpointTag('T', 'E', 'S', 'T');
+
+static void stepSurface(WaterSurface &surface, mt19937 &random) {
+  uniform_real_distribution<float> position(-4.5f, 4.5f);
+  for (auto i = 0; i < cNumUpdates; ++i) {
+    if (i % 4 == 0) {
+      auto x = position(random);
+      auto z = position(random);
+      surface.applyDisturbaceInWorldSpace(glm::vec3(x, 0.0f, z), 0.5f);
+    }
+    surface.update(0.016f);
+  }
+}
+
+static bool compareHeights(WaterSurface &expected, WaterSurface &actual,
+    const char *when) {
+  vector<float> expectedHeights, actualHeights;
+  expected.readHeights(expectedHeights);
+  actual.readHeights(actualHeights);
+  if (expectedHeights != actualHeights) {
+    cerr << "The restored heights differ " << when << "." << endl;
+    return false;
+  }
+  return true;
+}
+
+static bool writeFile(const char *path, const vector<char> &contents) {
+  ofstream file(path, ios::binary | ios::trunc);
+  file.write(contents.data(), contents.size());
+  return (bool)file;
+}
+
+// Damaged copies of the saved file have to be rejected by open.
+static bool checkDamaged() {
+  ifstream file(cPath, ios::binary);
+  vector<char> contents((istreambuf_iterator<char>(file)),
+      istreambuf_iterator<char>());
+  if (contents.size() < 16) {
+    cerr << "The checkpoint was not saved." << endl;
+    return false;
+  }
+
+  auto passed = true;
+  size_t sizes[] = { 8, contents.size() / 2, contents.size() - 1 };
+  for (auto size : sizes) {
+    Checkpoint checkpoint;
+    if (writeFile(cDamagedPath,
+          vector<char>(contents.begin(), contents.begin() + size))
+        && checkpoint.open(cDamagedPath)) {
+      cerr << "A checkpoint cut to " << size << " of " << contents.size()
+        << " bytes was opened." << endl;
+      passed = false;
+    }
+  }
+
+  auto wrongMagic = contents;
+  wrongMagic[0] ^= 0xff;
+  Checkpoint checkpoint;
+  if (writeFile(cDamagedPath, wrongMagic) && checkpoint.open(cDamagedPath)) {
+    cerr << "A checkpoint with the wrong magic was opened." << endl;
+    passed = false;
+  }
+  remove(cDamagedPath);
+  return passed;
+}
+
+int main() {
+  GLTestContext context;
+  if (!context.create()) {
+    return 1;
+  }
+
+  WaterSurface saved;
+  saved.setStorageFormat(HeightFieldPrecision::Float16, NormalMapFormat::RG8);
+  saved.create(10.0f, 10.0f, cSize, cSize);
+  mt19937 random(3);
+  stepSurface(saved, random);
+
+  CheckpointWriter writer;
+  saved.saveCheckpoint(writer, 0);
+  vector<int> extra = { 1, 2, 3 };
+  writer.add(cExtraTag, 1, extra);
+  if (!writer.save(cPath)) {
+    return 1;
+  }
+
+  auto passed = true;
+  Checkpoint checkpoint;
+  if (!checkpoint.open(cPath)) {
+    cerr << "The saved checkpoint cannot be opened." << endl;
+    return 1;
+  }
+  size_t size;
+  vector<int> readExtra;
+  if (!checkpoint.read(cExtraTag, 1, readExtra) || readExtra != extra
+      || checkpoint.find(cExtraTag, 0, size)) {
+    cerr << "Sections are not found by tag and index." << endl;
+    passed = false;
+  }
+
+  WaterSurface restored;
+  restored.setStorageFormat(HeightFieldPrecision::Float16,
+      NormalMapFormat::RG8);
+  restored.create(10.0f, 10.0f, cSize / 2, cSize / 2);
+  if (!restored.restoreCheckpoint(checkpoint, 0)) {
+    cerr << "The checkpoint cannot be restored." << endl;
+    return 1;
+  }
+  checkpoint.close();
+  passed = compareHeights(saved, restored, "after restoring") && passed;
+
+  auto restoredRandom = random;
+  stepSurface(saved, random);
+  stepSurface(restored, restoredRandom);
+  passed = compareHeights(saved, restored, "after stepping on") && passed;
+
+  passed = checkDamaged() && passed;
+  remove(cPath);
+  if (passed) {
+    cout << "The restored surface matches the saved one." << endl;
+  }
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+#include "allocationCounter.hpp"
+#include "allocators.hpp"
+#include "duckBatch.hpp"
+#include "glTestContext.hpp"
+#include "jobScheduler.hpp"
+#include "renderQueue.hpp"
+#include "splines.hpp"
+#include "transformBatch.hpp"
+#include "waterWorld.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// The scene's frame loop without a window: ducks follow a spline, sample
+// and splat the water, one pool steps on a thread of its own and one on
+// the job scheduler, and everything is culled and drawn. Once warmed up,
+// no frame may allocate. The last frames leave the water out of the
+// drawing, as culling does, and must not stall its thread.
+static const int cWarmupFrames = 120;
+static const int cCountedFrames = 240;
+static const int cUndrawnFrames = 30;
+static const int cNumDucks = 8;
+static const size_t cFrameArenaSize = 256 * 1024;
+
+static void drawNothing(void *context, int index, const RenderView &view) {
+  ++*view.drawCalls;
+}
+
+int main() {
+  if (!isCountingAllocations()) {
+    cerr << "The test was built without KACZKA_COUNT_ALLOCATIONS." << endl;
+    return 1;
+  }
+  GLTestContext context;
+  if (!context.create()) {
+    return 1;
+  }
+  JobScheduler scheduler;
+  JobScheduler::setGlobal(&scheduler);
+
+  WaterWorld world(scheduler);
+  auto &pool = world.addSurface();
+  pool.setStorageFormat(HeightFieldPrecision::Float16, NormalMapFormat::RG8);
+  pool.create(10.0f, 10.0f, 256, 256);
+  pool.setSubsteps(2);
+  pool.startSimulationThread();
+  auto &pond = world.addSurface();
+  pond.create(10.0f, 10.0f, 128, 128);
+  pond.setSimulationMode(WaterSimulationMode::Hierarchical);
+
+  mt19937 generator(5);
+  uniform_real_distribution<float> randomReal(-1.0f, 1.0f);
+  BSpline2D spline;
+  vector<glm::vec2> controlPoints;
+  for (auto i = 0; i < 10; ++i) {
+    controlPoints.push_back(5.0f *
+        glm::vec2(randomReal(generator), randomReal(generator)));
+  }
+  spline.setLoopedControlPoints(controlPoints);
+
+  DuckBatch ducks;
+  ducks.resize(cNumDucks);
+  ducks.hullRadius = 0.3f;
+  TransformBatch duckTransforms;
+  duckTransforms.resize(cNumDucks);
+
+  RenderQueue renderQueue;
+  vector<int> duckObjects;
+  for (auto i = 0; i < cNumDucks; ++i) {
+    duckObjects.push_back(renderQueue.add({RenderLayer::Opaque, 0,
+          GL_TEXTURE_2D, 0, drawNothing, nullptr, i}));
+  }
+
+  LinearArena frameArena(cFrameArenaSize);
+  auto viewProj = glm::perspective(glm::radians(90.0f), 4.0f / 3.0f, 0.1f,
+      100.0f) * glm::lookAt(glm::vec3(5.0f, 5.0f, 5.0f), glm::vec3(0.0f),
+      glm::vec3(0.0f, 1.0f, 0.0f));
+  auto cameraPosition = glm::vec3(5.0f, 5.0f, 5.0f);
+  auto deltaTime = 1.0f / 60.0f;
+  auto duckParameter = 0.0f;
+
+  auto passed = true;
+  auto numFrames = cWarmupFrames + cCountedFrames + cUndrawnFrames;
+  for (auto frame = 0; frame < numFrames; ++frame) {
+    frameArena.reset();
+    auto allocations = getAllocationCount();
+
+    duckParameter += deltaTime / 30.0f;
+    duckParameter -= (int)duckParameter;
+    if (frame % 5 == 0) {
+      auto drop = glm::vec3(5.0f * randomReal(generator), 0.0f,
+          5.0f * randomReal(generator));
+      pool.applyDisturbaceInWorldSpace(drop, 0.3f);
+      pond.applyDisturbaceInWorldSpace(drop, 0.3f);
+    }
+    for (auto i = 0; i < ducks.size(); ++i) {
+      auto parameter = duckParameter + (float)i / cNumDucks;
+      parameter -= (int)parameter;
+      auto position = spline.evaluate(parameter);
+      auto tangent = glm::normalize(spline.derivative(parameter));
+      ducks.x[i] = position.x;
+      ducks.z[i] = position.y;
+      ducks.headingX[i] = -tangent.x;
+      ducks.headingZ[i] = -tangent.y;
+    }
+
+    pool.sampleDucks(ducks, frameArena);
+    updateDuckBuoyancy(ducks, deltaTime);
+    pool.splatDucks(ducks, 0.01f);
+    pond.splatDucks(ducks, 0.01f);
+    pond.setRefinementFocus(cameraPosition, 3.0f);
+    world.update(deltaTime);
+
+    buildDuckTransforms(ducks, 0.005f, duckTransforms);
+    for (auto i = 0; i < ducks.size(); ++i) {
+      auto center = transformPoint(duckTransforms.getMatrix(i),
+          glm::vec3(0.0f));
+      renderQueue.setBoundingSphere(duckObjects[i], center, 0.5f);
+    }
+    RenderView view;
+    view.viewProj = viewProj;
+    view.cameraPosition = cameraPosition;
+    view.frameArena = &frameArena;
+    auto drawCalls = 0;
+    view.drawCalls = &drawCalls;
+    renderQueue.draw(view);
+    if (frame < cWarmupFrames + cCountedFrames) {
+      world.draw(viewProj, cameraPosition, frameArena);
+    }
+
+    allocations = getAllocationCount() - allocations;
+    if (frame >= cWarmupFrames && allocations > 0) {
+      cerr << "Frame " << frame << " made " << allocations
+        << " heap allocations." << endl;
+      passed = false;
+    }
+  }
+
+  pool.stopSimulationThread();
+  JobScheduler::setGlobal(nullptr);
+  if (passed) {
+    cout << cCountedFrames + cUndrawnFrames << " frames after "
+      << cWarmupFrames << " warm up frames made no heap allocations, "
+      << cUndrawnFrames << " of them without drawing the water." << endl;
+  }
+  return passed ? 0 : 1;
+}
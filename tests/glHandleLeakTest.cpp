@@ -0,0 +1,108 @@
+#include "config.hpp"
+#include "duckBatch.hpp"
+#include "glHandles.hpp"
+#include "glTestContext.hpp"
+#include "gpuTimer.hpp"
+#include "helpers.hpp"
+#include "mesh.hpp"
+#include "shaders.hpp"
+#include "waterSurface.hpp"
+
+#include <iostream>
+
+using namespace std;
+
+static const char *cHandleTypeNames[] = {
+  "buffers", "vertex arrays", "textures", "shaders", "programs", "queries"
+};
+
+static void getLiveHandles(int *counts) {
+  for (auto i = 0; i < cNumGLHandleTypes; ++i) {
+    counts[i] = getNumLiveGLHandles((GLHandleType)i);
+  }
+}
+
+// Every GL object of the loop has to be released by the end of it, and
+// creating and resizing again must not add names over the first round.
+static bool exerciseWater() {
+  WaterSurface surface;
+  surface.create(10.0f, 10.0f, 128, 128);
+  surface.create(10.0f, 10.0f, 256, 256);
+
+  DuckBatch ducks;
+  ducks.resize(4);
+  LinearArena frameArena;
+  int sizes[] = { 512, 128, 64, 256 };
+  int counts[cNumGLHandleTypes], firstRound[cNumGLHandleTypes];
+  for (auto round = 0; round < 4; ++round) {
+    for (auto mode : { WaterSimulationMode::FiniteDifference,
+        WaterSimulationMode::Gpu }) {
+      surface.setSimulationMode(mode);
+      for (auto size : sizes) {
+        surface.resize(10.0f, 10.0f, size, size);
+        surface.update(0.016f);
+        surface.sampleDucks(ducks, frameArena);
+        frameArena.reset();
+      }
+    }
+    getLiveHandles(round == 0 ? firstRound : counts);
+    for (auto i = 0; round > 0 && i < cNumGLHandleTypes; ++i) {
+      if (counts[i] != firstRound[i]) {
+        cerr << "Resizing went from " << firstRound[i] << " to "
+          << counts[i] << " " << cHandleTypeNames[i] << "." << endl;
+        return false;
+      }
+    }
+  }
+
+  surface.free();
+  surface.create(10.0f, 10.0f, 64, 64);
+  return true;
+}
+
+static void exerciseAssets() {
+  for (auto i = 0; i < 3; ++i) {
+    Mesh mesh(ASSETS_PATH_PREFIX"meshes/duck.mesh");
+    mesh.load(ASSETS_PATH_PREFIX"meshes/duck.mesh", true);
+
+    VertexShader vertexShader(SHADER_PATH_PREFIX"cubemap.vert");
+    FragmentShader fragmentShader(SHADER_PATH_PREFIX"cubemap.frag");
+    ShaderProgram program;
+    program.attach(&vertexShader);
+    program.attach(&fragmentShader);
+    program.link();
+
+    GLVertexArray vao;
+    GLBuffer vbo, ebo;
+    GLuint numIndices;
+    createSkybox(1.0f, vao, vbo, ebo, numIndices);
+    createSkybox(2.0f, vao, vbo, ebo, numIndices);
+
+    auto texture = loadTexture(ASSETS_PATH_PREFIX"textures/ducktex.jpg");
+
+    GpuTimer timer;
+    timer.create();
+    timer.begin();
+    timer.end();
+  }
+}
+
+int main() {
+  GLTestContext context;
+  if (!context.create()) {
+    return 1;
+  }
+
+  auto passed = exerciseWater();
+  exerciseAssets();
+
+  int counts[cNumGLHandleTypes];
+  getLiveHandles(counts);
+  for (auto i = 0; i < cNumGLHandleTypes; ++i) {
+    if (counts[i] != 0) {
+      cerr << counts[i] << " " << cHandleTypeNames[i] << " leaked." << endl;
+      passed = false;
+    }
+  }
+  return passed && checkGLHandleLeaks() ? 0 : 1;
+}
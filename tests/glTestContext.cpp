@@ -0,0 +1,69 @@
+#include "glTestContext.hpp"
+
+#include <GL/glew.h>
+#include <EGL/eglext.h>
+#include <iostream>
+
+using namespace std;
+
+GLTestContext::GLTestContext() :
+  _display(EGL_NO_DISPLAY), _context(EGL_NO_CONTEXT) {
+}
+
+GLTestContext::~GLTestContext() {
+  destroy();
+}
+
+bool GLTestContext::create() {
+  destroy();
+
+  auto getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)
+    eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (!getPlatformDisplay) {
+    cerr << "EGL cannot open a display without a window system." << endl;
+    return false;
+  }
+  _display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+      EGL_DEFAULT_DISPLAY, nullptr);
+  if (_display == EGL_NO_DISPLAY ||
+      !eglInitialize(_display, nullptr, nullptr)) {
+    cerr << "Cannot initialize a surfaceless EGL display." << endl;
+    _display = EGL_NO_DISPLAY;
+    return false;
+  }
+
+  const EGLint attributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 4,
+    EGL_CONTEXT_MINOR_VERSION, 5,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE
+  };
+  eglBindAPI(EGL_OPENGL_API);
+  _context = eglCreateContext(_display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT,
+      attributes);
+  if (_context == EGL_NO_CONTEXT || !eglMakeCurrent(_display, EGL_NO_SURFACE,
+        EGL_NO_SURFACE, _context)) {
+    cerr << "Cannot create an OpenGL 4.5 core context." << endl;
+    destroy();
+    return false;
+  }
+
+  // GLEW built for GLX reports a missing X display after it has loaded
+  // the GL entry points, which is all the tests need.
+  glewExperimental = GL_TRUE;
+  glewInit();
+  return true;
+}
+
+void GLTestContext::destroy() {
+  if (_display == EGL_NO_DISPLAY) {
+    return;
+  }
+  eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  if (_context != EGL_NO_CONTEXT) {
+    eglDestroyContext(_display, _context);
+  }
+  eglTerminate(_display);
+  _display = EGL_NO_DISPLAY;
+  _context = EGL_NO_CONTEXT;
+}
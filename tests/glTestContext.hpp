@@ -0,0 +1,22 @@
+#ifndef __GL_TEST_CONTEXT_HPP__
+#define __GL_TEST_CONTEXT_HPP__
+
+#include <EGL/egl.h>
+
+// OpenGL 4.5 core context without a window or a display, made current on
+// the calling thread. Mesa's llvmpipe provides one on machines without a
+// GPU, which is how the tests run in CI.
+class GLTestContext {
+public:
+  GLTestContext();
+  ~GLTestContext();
+
+  bool create();
+  void destroy();
+
+private:
+  EGLDisplay _display;
+  EGLContext _context;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "glTestContext.hpp"
+#include "gpuWaterSolver.hpp"
+#include "waterSurface.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// The compute shaders step the same scheme as the CPU solver, so both run
+// from the same seeded drops and have to agree up to float rounding and
+// the CPU putting calm tiles to sleep. Heights are in sample spacings,
+// normals in degrees.
+static const int cWidth = 200;
+static const int cHeight = 150;
+static const int cNumUpdates = 240;
+static const float cMaxHeightError = 2e-3f;
+static const float cMaxNormalError = 0.2f;
+static const int cNumProbes = 100;
+static const float cMaxProbeError = 1e-5f;
+
+static void simulate(WaterSimulationMode mode, vector<float> &heights,
+    vector<glm::vec3> &normals) {
+  WaterSurface surface;
+  surface.setStorageFormat(HeightFieldPrecision::Float32,
+      NormalMapFormat::RG16);
+  surface.create(8.0f, 6.0f, cWidth, cHeight);
+  surface.setSimulationMode(mode);
+
+  mt19937 random(11);
+  uniform_real_distribution<float> positionX(-3.5f, 3.5f);
+  uniform_real_distribution<float> positionZ(-2.5f, 2.5f);
+  for (auto i = 0; i < cNumUpdates; ++i) {
+    if (i % 8 == 0) {
+      auto x = positionX(random);
+      auto z = positionZ(random);
+      surface.applyDisturbaceInWorldSpace(glm::vec3(x, 0.0f, z), 0.5f);
+    }
+    surface.setSubsteps(1 + i % 3);
+    surface.update(0.016f);
+  }
+
+  surface.readHeights(heights);
+  surface.readNormals(normals);
+}
+
+static float sampleBilinear(const vector<float> &heights, glm::vec2 point) {
+  auto x = max(0.0f, min((float)(cWidth - 1), point.x));
+  auto y = max(0.0f, min((float)(cHeight - 1), point.y));
+  auto x0 = min((int)x, cWidth - 2), y0 = min((int)y, cHeight - 2);
+  auto fx = x - x0, fy = y - y0;
+  auto at = [&](int dx, int dy) {
+    return heights[(y0 + dy) * cWidth + x0 + dx];
+  };
+  auto top = at(0, 0) + fx * (at(1, 0) - at(0, 0));
+  auto bottom = at(0, 1) + fx * (at(1, 1) - at(0, 1));
+  return top + fy * (bottom - top);
+}
+
+// Probes come back once the GPU has finished them, from the newest
+// request, and some fall outside the field to check the clamping.
+static float measureProbeError(const vector<float> &heights) {
+  GpuWaterSolver solver;
+  solver.create(cWidth, cHeight, GL_RG16);
+
+  mt19937 random(5);
+  uniform_real_distribution<float> x(-5.0f, cWidth + 5.0f);
+  uniform_real_distribution<float> y(-5.0f, cHeight + 5.0f);
+  vector<glm::vec2> points(cNumProbes);
+  vector<float> probes(cNumProbes);
+  auto error = 0.0f;
+  for (auto request = 0; request < 2; ++request) {
+    solver.writeState(&heights[0], &heights[0]);
+    for (auto &point : points) {
+      point = glm::vec2(x(random), y(random));
+    }
+    solver.requestSamples(&points[0], cNumProbes);
+    glFinish();
+    if (solver.fetchSamples(&probes[0], cNumProbes) != cNumProbes) {
+      cerr << "Finished probes were not fetched." << endl;
+      return INFINITY;
+    }
+    for (auto i = 0; i < cNumProbes; ++i) {
+      error = max(error,
+          fabs(probes[i] - sampleBilinear(heights, points[i])));
+    }
+  }
+  return error;
+}
+
+int main() {
+  GLTestContext context;
+  if (!context.create()) {
+    return 1;
+  }
+  if (!GpuWaterSolver::isSupported()) {
+    cerr << "The context cannot run the GPU water solver." << endl;
+    return 1;
+  }
+
+  vector<float> cpuHeights, gpuHeights;
+  vector<glm::vec3> cpuNormals, gpuNormals;
+  simulate(WaterSimulationMode::FiniteDifference, cpuHeights, cpuNormals);
+  simulate(WaterSimulationMode::Gpu, gpuHeights, gpuNormals);
+
+  auto maxHeight = 0.0f, heightError = 0.0f, normalError = 0.0f;
+  for (size_t i = 0; i < cpuHeights.size(); ++i) {
+    maxHeight = max(maxHeight, fabs(cpuHeights[i]));
+    heightError = max(heightError, fabs(gpuHeights[i] - cpuHeights[i]));
+    auto cosine = min(1.0f, glm::dot(gpuNormals[i], cpuNormals[i]));
+    normalError = max(normalError, glm::degrees(acosf(cosine)));
+  }
+
+  auto probeError = measureProbeError(cpuHeights);
+
+  cout << "heights up to " << maxHeight << ", error " << heightError
+    << " (max " << cMaxHeightError << "), normals " << normalError
+    << " degrees (max " << cMaxNormalError << "), probes " << probeError
+    << " (max " << cMaxProbeError << ")" << endl;
+  if (maxHeight < 0.01f) {
+    cerr << "The simulation left the water flat." << endl;
+    return 1;
+  }
+  return heightError <= cMaxHeightError && normalError <= cMaxNormalError &&
+    probeError <= cMaxProbeError ? 0 : 1;
+}
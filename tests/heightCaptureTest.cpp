@@ -0,0 +1,90 @@
+#include "heightCapture.hpp"
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// Capture frames have to decode to the samples they were encoded from,
+// key frames on their own and delta frames on top of the frame before,
+// and every truncated record has to be rejected instead of decoded.
+static const int cNumSamples = 600;
+static const int cBytesPerSample = 2;
+
+struct CaptureCase {
+  const char *name;
+  vector<unsigned char> samples;
+  // Empty for key frames.
+  vector<unsigned char> previous;
+};
+
+// Every byte of the samples in [first, last) changes, so their XOR with
+// the frame before is never zero.
+static void changeSamples(vector<unsigned char> &samples, int first, int last,
+    mt19937 &random) {
+  uniform_int_distribution<int> change(1, 255);
+  for (auto i = first * cBytesPerSample; i < last * cBytesPerSample; ++i) {
+    samples[i] ^= (unsigned char)change(random);
+  }
+}
+
+static bool checkCase(const CaptureCase &captureCase) {
+  auto keyFrame = captureCase.previous.empty();
+  vector<unsigned char> planes, encoded;
+  encodeCaptureFrame(&captureCase.samples[0],
+      keyFrame ? nullptr : &captureCase.previous[0], cNumSamples,
+      cBytesPerSample, planes, encoded);
+
+  auto decoded = keyFrame
+    ? vector<unsigned char>(captureCase.samples.size(), 0xcd)
+    : captureCase.previous;
+  if (!decodeCaptureFrame(&encoded[0], encoded.size(), keyFrame,
+        cNumSamples, cBytesPerSample, planes, &decoded[0])
+      || decoded != captureCase.samples) {
+    cerr << captureCase.name << ": the frame does not round trip." << endl;
+    return false;
+  }
+
+  for (size_t size = 0; size < encoded.size(); ++size) {
+    decoded = keyFrame ? vector<unsigned char>(decoded.size(), 0)
+      : captureCase.previous;
+    if (decodeCaptureFrame(&encoded[0], size, keyFrame, cNumSamples,
+          cBytesPerSample, planes, &decoded[0])) {
+      cerr << captureCase.name << ": " << size << " of " << encoded.size()
+        << " bytes decoded." << endl;
+      return false;
+    }
+  }
+  cout << captureCase.name << ": " << captureCase.samples.size()
+    << " bytes in " << encoded.size() << endl;
+  return true;
+}
+
+int main() {
+  mt19937 random(11);
+  vector<CaptureCase> cases;
+
+  // Literal runs of 200 bytes in each plane, then zeros up to its end.
+  vector<unsigned char> first(cNumSamples * cBytesPerSample, 0);
+  changeSamples(first, 0, 200, random);
+  cases.push_back({"key frame", first, {}});
+
+  // 100 zeros, a 300 byte literal run and 200 zeros in each plane.
+  auto second = first;
+  changeSamples(second, 100, 400, random);
+  cases.push_back({"delta frame", second, first});
+
+  // The planes end in two zeros, too few for a zero run of their own.
+  auto third = second;
+  changeSamples(third, 0, cNumSamples - 2, random);
+  cases.push_back({"delta frame ending in literal zeros", third, second});
+
+  cases.push_back({"unchanged delta frame", third, third});
+
+  auto passed = true;
+  for (const auto &captureCase : cases) {
+    passed = checkCase(captureCase) && passed;
+  }
+  return passed ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+#include "glTestContext.hpp"
+#include "jobScheduler.hpp"
+#include "waterSurface.hpp"
+
+#include <glm/glm.hpp>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+
+using namespace std;
+
+// Times whole updates of pools kept stirred so that every tile stays
+// awake. Not a test: the numbers only mean something on the machine they
+// were measured on, so it is run by hand.
+static const int cTileSize = 32;
+static const int cWarmupUpdates = 10;
+static const int cTimedUpdates = 20;
+static const int cDropsPerUpdate = 64;
+static const int cBlockedSizes[] = { 1024, 2048 };
+static const int cBlockedSubsteps[] = { 2, 4, 8 };
+static const int cSpectralSizes[] = { 256, 512, 1024 };
+
+struct Timing {
+  double milliseconds;
+  double activeTiles;
+};
+
+static void stir(WaterSurface &surface, mt19937 &random) {
+  uniform_real_distribution<float> position(-4.9f, 4.9f);
+  for (auto i = 0; i < cDropsPerUpdate; ++i) {
+    auto x = position(random);
+    auto z = position(random);
+    surface.applyDisturbaceInWorldSpace(glm::vec3(x, 0.0f, z), 0.5f);
+  }
+}
+
+static Timing timeUpdates(WaterSurface &surface) {
+  mt19937 random(3);
+  for (auto i = 0; i < cWarmupUpdates; ++i) {
+    stir(surface, random);
+    surface.update(1.0f / 60.0f);
+  }
+
+  Timing timing = { 0.0, 0.0 };
+  for (auto i = 0; i < cTimedUpdates; ++i) {
+    stir(surface, random);
+    auto start = chrono::steady_clock::now();
+    surface.update(1.0f / 60.0f);
+    timing.milliseconds += chrono::duration<double, milli>(
+        chrono::steady_clock::now() - start).count();
+    timing.activeTiles += surface.getNumActiveTiles();
+  }
+  timing.milliseconds /= cTimedUpdates;
+  timing.activeTiles /= cTimedUpdates;
+  return timing;
+}
+
+// Height field bytes read and written per update of one tile. A sweep
+// reads both fields and writes one for every substep, then reads both for
+// the tile activity. Blocking reads both fields once with a halo of one
+// sample per substep, writes both back and checks activity once.
+static double modelTileBytes(int substeps, bool blocked, int bytesPerSample) {
+  auto samples = (double)cTileSize * cTileSize;
+  if (!blocked) {
+    return substeps * 5.0 * samples * bytesPerSample;
+  }
+  auto windowSize = cTileSize + 2.0 * substeps;
+  return (2.0 * windowSize * windowSize + 4.0 * samples) * bytesPerSample;
+}
+
+static void benchmarkBlocking() {
+  cout << "Finite differences, float16 heights, per update:" << endl
+    << setw(6) << "size" << setw(10) << "substeps"
+    << setw(14) << "sweeps ms" << setw(12) << "sweeps MB"
+    << setw(14) << "blocked ms" << setw(12) << "blocked MB" << endl;
+  for (auto size : cBlockedSizes) {
+    for (auto substeps : cBlockedSubsteps) {
+      Timing timings[2];
+      for (auto blocked = 0; blocked < 2; ++blocked) {
+        WaterSurface surface;
+        surface.setStorageFormat(HeightFieldPrecision::Float16,
+            NormalMapFormat::RG8);
+        surface.create(10.0f, 10.0f, size, size);
+        surface.setSubsteps(substeps);
+        surface.setTemporalBlocking(blocked != 0);
+        timings[blocked] = timeUpdates(surface);
+      }
+      cout << setw(6) << size << setw(10) << substeps << fixed;
+      for (auto blocked = 0; blocked < 2; ++blocked) {
+        auto bytes = timings[blocked].activeTiles *
+          modelTileBytes(substeps, blocked != 0, 2);
+        cout << setprecision(2) << setw(14) << timings[blocked].milliseconds
+          << setprecision(1) << setw(12) << bytes / 1e6;
+      }
+      cout << defaultfloat << endl;
+    }
+  }
+}
+
+// Drops only keep the stencil's tiles awake, the spectral mode ignores them
+// and evaluates its whole spectrum every update.
+static void benchmarkSpectral() {
+  cout << "Stencil and spectral water at equal resolution, per update:"
+    << endl << setw(6) << "size" << setw(14) << "stencil ms"
+    << setw(14) << "spectral ms" << endl;
+  for (auto size : cSpectralSizes) {
+    WaterSimulationMode modes[] = {
+      WaterSimulationMode::FiniteDifference, WaterSimulationMode::Spectral
+    };
+    cout << setw(6) << size << fixed << setprecision(2);
+    for (auto mode : modes) {
+      WaterSurface surface;
+      surface.create(10.0f, 10.0f, size, size);
+      surface.setSimulationMode(mode);
+      cout << setw(14) << timeUpdates(surface).milliseconds;
+    }
+    cout << defaultfloat << endl;
+  }
+}
+
+int main() {
+  GLTestContext context;
+  if (!context.create()) {
+    return 1;
+  }
+  JobScheduler scheduler;
+  JobScheduler::setGlobal(&scheduler);
+
+  benchmarkBlocking();
+  cout << endl;
+  benchmarkSpectral();
+
+  JobScheduler::setGlobal(nullptr);
+  context.destroy();
+  return 0;
+}
@@ -0,0 +1,107 @@
+#include "glTestContext.hpp"
+#include "waterSurface.hpp"
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+// Reduced precision storage runs the same seeded simulation as float32
+// heights with RG16 normals and has to stay within these errors, heights
+// in sample spacings and normals in degrees.
+static const int cSize = 128;
+static const int cNumUpdates = 200;
+
+struct PrecisionCase {
+  const char *name;
+  HeightFieldPrecision heightPrecision;
+  NormalMapFormat normalMapFormat;
+  float maxHeightError;
+  float maxNormalError;
+};
+
+static void simulate(HeightFieldPrecision heightPrecision,
+    NormalMapFormat normalMapFormat, vector<float> &heights,
+    vector<glm::vec3> &normals) {
+  WaterSurface surface;
+  surface.setStorageFormat(heightPrecision, normalMapFormat);
+  surface.create(10.0f, 10.0f, cSize, cSize);
+  surface.setSimulationMode(WaterSimulationMode::FiniteDifference);
+
+  mt19937 random(7);
+  uniform_real_distribution<float> position(-4.5f, 4.5f);
+  uniform_real_distribution<float> strength(0.05f, 0.5f);
+  for (auto i = 0; i < cNumUpdates; ++i) {
+    if (i % 3 == 0) {
+      auto x = position(random);
+      auto z = position(random);
+      surface.applyDisturbaceInWorldSpace(glm::vec3(x, 0.0f, z),
+          strength(random));
+    }
+    surface.update(0.016f);
+  }
+
+  surface.readHeights(heights);
+  surface.readNormals(normals);
+}
+
+int main() {
+  GLTestContext context;
+  if (!context.create()) {
+    return 1;
+  }
+
+  vector<float> referenceHeights, heights;
+  vector<glm::vec3> referenceNormals, normals;
+  simulate(HeightFieldPrecision::Float32, NormalMapFormat::RG16,
+      referenceHeights, referenceNormals);
+
+  auto maxReference = 0.0f;
+  for (auto height : referenceHeights) {
+    maxReference = max(maxReference, fabs(height));
+  }
+  if (maxReference < 0.01f) {
+    cerr << "The reference simulation left the water flat." << endl;
+    return 1;
+  }
+
+  const PrecisionCase cases[] = {
+    { "float32 RG8", HeightFieldPrecision::Float32, NormalMapFormat::RG8,
+      0.0f, 0.5f },
+    { "float16 RG8", HeightFieldPrecision::Float16, NormalMapFormat::RG8,
+      2.5e-4f, 0.5f },
+    { "float16 RG16", HeightFieldPrecision::Float16, NormalMapFormat::RG16,
+      2.5e-4f, 0.05f },
+    { "fixed16 RG8", HeightFieldPrecision::Fixed16, NormalMapFormat::RG8,
+      1e-3f, 0.5f },
+    { "fixed16 RG16", HeightFieldPrecision::Fixed16, NormalMapFormat::RG16,
+      1e-3f, 0.05f },
+  };
+
+  auto failed = false;
+  for (const auto &testCase : cases) {
+    simulate(testCase.heightPrecision, testCase.normalMapFormat, heights,
+        normals);
+
+    auto heightError = 0.0f, normalError = 0.0f;
+    for (size_t i = 0; i < heights.size(); ++i) {
+      heightError = max(heightError, fabs(heights[i] - referenceHeights[i]));
+      auto cosine = min(1.0f, glm::dot(normals[i], referenceNormals[i]));
+      normalError = max(normalError, glm::degrees(acosf(cosine)));
+    }
+
+    auto passed = heightError <= testCase.maxHeightError &&
+      normalError <= testCase.maxNormalError;
+    cout << testCase.name << ": heights " << heightError << " (max "
+      << testCase.maxHeightError << "), normals " << normalError
+      << " degrees (max " << testCase.maxNormalError << ")"
+      << (passed ? "" : " FAILED") << endl;
+    failed = failed || !passed;
+  }
+
+  return failed ? 1 : 0;
+}